@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -15,12 +16,38 @@ void list_commands()
 	printf("  - list all files in the current directory\n");
 	printf("cd <dir>\n");
 	printf("  - change directory\n");
-	printf("cat <file>\n");
-	printf("  - print the contents of a file in the current directory\n");
+	printf("cat <file> [offset length]\n");
+	printf("  - print the contents of a file in the current directory, a negative offset counts from the end\n");
 	printf("pwd\n");
 	printf("  - print the current directory\n");
-	printf("export <file>\n");
-	printf("  - export a file in the current directory to the local disk\n");
+	printf("export [--range offset length] <file>\n");
+	printf("  - export a file (or part of it) in the current directory to the local disk\n");
+	printf("export <file or pattern>... | --from-list <list file>\n");
+	printf("  - export every file in the current directory matching the names or patterns (* and ?) in one pass\n");
+	printf("check [threads]\n");
+	printf("  - check the FAT copies and every cluster chain for cross-links, loops, lost clusters and size mismatches\n");
+	printf("du [-d depth] [path]\n");
+	printf("  - total the file sizes and allocated clusters below every directory, down to a depth\n");
+	printf("tree [path]\n");
+	printf("  - print every file and directory below a directory with its size, sorted by name\n");
+	printf("find [-name pattern] [-size [+|-]n[K|M|G]] [-newer yyyy-mm-dd] [-older yyyy-mm-dd] [-attr RHSAD] [-type f|d]\n");
+	printf("  - list every entry on the partition matching all predicates, -newer and -older split at the start of the day\n");
+	printf("diff <other image> [part num]\n");
+	printf("  - list every file added, removed or modified in the same partition of another image by path\n");
+	printf("undelete [file]\n");
+	printf("  - list deleted files in the current directory, or recover one to the local disk\n");
+	printf("carve [dir] [threads]\n");
+	printf("  - scan unallocated clusters for JPEG/PNG/PDF/ZIP files and write them to a local directory\n");
+	printf("index\n");
+	printf("  - build a sidecar index of the partition next to the image, used automatically on later runs\n");
+	printf("extract-all [dir]\n");
+	printf("  - extract every file on the partition to a local directory in one pass over the image\n");
+	printf("prefetch [on | off | <depth> [budget KB]]\n");
+	printf("  - read subdirectories in the background after each directory loads so cd finds them in memory\n");
+	printf("direct [on|off]\n");
+	printf("  - read file data for cat, export and extract-all with direct I/O, bypassing the page cache\n");
+	printf("trace [<file> | off]\n");
+	printf("  - log the offset, length, time and calling function of every image read to a binary trace file\n");
 	printf("help\n");
 	printf("  - display this menu\n");
 	printf("exit\n");
@@ -39,6 +66,18 @@ void run_command_handler(FileManagerContext* context)
 		{"cat ", cat_file},
 		{"pwd", display_pwd},
 		{"export ", export_to_file},
+		{"extract-all", extract_all},
+		{"index", build_index},
+		{"check", check_partition},
+		{"du", disk_usage},
+		{"tree", display_tree},
+		{"find", find_files},
+		{"diff ", diff_images},
+		{"undelete", undelete_file},
+		{"carve", carve_files},
+		{"direct", set_direct_io},
+		{"prefetch", set_prefetch},
+		{"trace", set_trace},
 		{"help", list_commands},
 		{"exit", exit_file_manager }
 	};
@@ -47,9 +86,18 @@ void run_command_handler(FileManagerContext* context)
 	while (true)
 	{
 		bool valid_command = false;
-		printf("file-manager: %s $ ", context->pwd);
+		// sessions driven by another program get bare output with no prompt
+		if (context->interactive)
+			printf("file-manager: %s $ ", context->pwd);
 		char* input = get_line_dynamic();
 
+		// commands piped in have run out, nothing more will arrive
+		if (input[0] == '\0' && feof(stdin))
+		{
+			free(input);
+			exit_file_manager(context, "");
+		}
+
 		// see if the input matches any commands
 		for (int i = 0; i < num_commands; i++)
 		{
@@ -67,5 +115,7 @@ void run_command_handler(FileManagerContext* context)
 		{
 			printf("Invalid Command: %s\nType 'help' for a list of commands.\n\n", input);
 		}
+		if (!context->interactive)
+			fflush(stdout);
 	}
 }
\ No newline at end of file
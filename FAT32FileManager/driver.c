@@ -1,12 +1,161 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "fatcontextfactory.h"
 #include "cmdparser.h"
+#include "fatstream.h"
+#include "fatserver.h"
+#include "fattrace.h"
+#include "fatfleet.h"
+#include "fatbench.h"
+#include "ConsoleUtil.h"
+#include "utilties.h"
 
 
 int main(int argc, char* argv[])
 {
+	// record every read of the session or the stream, starting with the MBR
+	if (argc >= 4 && strcmp(argv[1], "--trace") == 0)
+	{
+		if (argc > 4 && strcmp(argv[3], "--stream") != 0)
+		{
+			printf("Usage: %s --trace <trace file> <image file | --stream <output dir> [part num]>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		if (!start_trace(argv[2]))
+			return EXIT_FAILURE;
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+	}
+
+	// streaming mode reads the image from stdin instead of opening it
+	if (argc >= 3 && strcmp(argv[1], "--stream") == 0)
+	{
+		int32_t part_index = -1;
+		if (argc > 4 || (argc == 4 && (string_to_int(argv[3], &part_index) || part_index < 0)))
+		{
+			printf("Usage: %s --stream <output dir> [part num] < <image file>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		const bool success = extract_stream(stdin, part_index < 0 ? SIZE_MAX : (size_t)part_index, argv[2]);
+		stop_trace();
+		return success ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// keep an image mounted and take commands over a local socket
+	if (argc >= 4 && strcmp(argv[1], "--serve") == 0)
+	{
+		int32_t part_index = 0;
+		const bool create_index = argc > 4 && strcmp(argv[argc - 1], "--index") == 0;
+		const int num_args = create_index ? argc - 1 : argc;
+		if (num_args > 5 || (num_args == 5 && (string_to_int(argv[4], &part_index) || part_index < 0)))
+		{
+			printf("Usage: %s --serve <socket> <image file> [part num] [--index]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		return run_server(argv[2], argv[3], (size_t)part_index, create_index) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc >= 3 && strcmp(argv[1], "--client") == 0)
+	{
+		if (argc - 3 > MAX_CLIENT_COMMANDS)
+		{
+			printf("Too many commands, at most %d can be sent at once.\n", MAX_CLIENT_COMMANDS);
+			return EXIT_FAILURE;
+		}
+		return run_client(argv[2], &argv[3], (size_t)(argc - 3)) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc == 6 && strcmp(argv[1], "--load-test") == 0)
+	{
+		int32_t num_requests;
+		int32_t concurrency;
+		if (string_to_int(argv[3], &num_requests) || string_to_int(argv[4], &concurrency) || num_requests <= 0 ||
+			concurrency <= 0)
+		{
+			printf("Usage: %s --load-test <socket> <requests> <connections> <command>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		return run_load_test(argv[2], argv[5], (size_t)num_requests, (size_t)concurrency) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// re-issue a recorded trace against an image without mounting anything
+	if (argc >= 4 && strcmp(argv[1], "--replay") == 0)
+	{
+		const bool timed = strcmp(argv[argc - 1], "--timed") == 0;
+		const int num_args = timed ? argc - 1 : argc;
+		ReplayBackend backend = REPLAY_STDIO;
+		if (num_args > 5 || (num_args == 5 && !parse_replay_backend(argv[4], &backend)))
+		{
+			printf("Usage: %s --replay <trace file> <image file> [stdio|pread|mmap|direct] [--timed]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		return replay_trace(argv[2], argv[3], backend, timed) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// run one command over a list of images in this process
+	if (argc >= 4 && strcmp(argv[1], "--fleet") == 0)
+	{
+		FleetCommand command = FLEET_LS;
+		const char* destination = NULL;
+		bool recursive = false;
+		int arg_idx = 4;
+		bool valid = parse_fleet_command(argv[3], &command);
+		if (valid && command == FLEET_LS && argc > 4 && strcmp(argv[4], "-r") == 0)
+		{
+			recursive = true;
+			arg_idx++;
+		}
+		if (valid && command == FLEET_EXPORT)
+		{
+			valid = argc > 4;
+			destination = argv[4];
+			arg_idx++;
+		}
+
+		int32_t num_threads = (int32_t)get_cpu_count();
+		int32_t per_disk = 2;
+		int32_t part_index = 0;
+		for (; valid && arg_idx < argc; arg_idx += 2)
+		{
+			int32_t* option = strcmp(argv[arg_idx], "--threads") == 0 ? &num_threads :
+				strcmp(argv[arg_idx], "--per-disk") == 0 ? &per_disk :
+				strcmp(argv[arg_idx], "--part") == 0 ? &part_index : NULL;
+			valid = option && arg_idx + 1 < argc && !string_to_int(argv[arg_idx + 1], option);
+		}
+		if (!valid || num_threads < 1 || per_disk < 1 || part_index < 0)
+		{
+			printf("Usage: %s --fleet <image list> <ls [-r]|hash|check|export <output dir>> [--threads n] [--per-disk n] [--part n]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+		return run_fleet(argv[2], (size_t)part_index, command, recursive, destination, (size_t)num_threads,
+			(size_t)per_disk) ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// time chain walks over FAT tables built in memory
+	if (argc >= 2 && argc <= 4 && strcmp(argv[1], "--bench") == 0)
+	{
+		int32_t num_clusters = DEFAULT_BENCH_CLUSTERS;
+		int32_t rounds = DEFAULT_BENCH_ROUNDS;
+		if ((argc > 2 && (string_to_int(argv[2], &num_clusters) || num_clusters < 2)) ||
+			(argc > 3 && (string_to_int(argv[3], &rounds) || rounds < 1)))
+		{
+			printf("Usage: %s --bench [clusters] [rounds]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		return run_chain_bench((size_t)num_clusters, (size_t)rounds) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	// parse cmdline input
 	if (argc > 2) 
 	{
@@ -16,6 +165,15 @@ int main(int argc, char* argv[])
 	if (argc < 2) 
 	{
 		printf("Usage: %s <image file>.\n", argv[0]);
+		printf("       %s --stream <output dir> [part num] < <image file>\n", argv[0]);
+		printf("       %s --serve <socket> <image file> [part num] [--index]\n", argv[0]);
+		printf("       %s --client <socket> [command]...\n", argv[0]);
+		printf("       %s --load-test <socket> <requests> <connections> <command>\n", argv[0]);
+		printf("       %s --trace <trace file> <image file | --stream <output dir> [part num]>\n", argv[0]);
+		printf("       %s --fleet <image list> <ls [-r]|hash|check|export <output dir>> [--threads n] [--per-disk n] [--part n]\n",
+			argv[0]);
+		printf("       %s --replay <trace file> <image file> [stdio|pread|mmap|direct] [--timed]\n", argv[0]);
+		printf("       %s --bench [clusters] [rounds]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -0,0 +1,176 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatbench.h"
+#include "fatwidth.h"
+#include "utilties.h"
+
+// fewest links followed per round, short chains are walked again until the timer can see them
+#define MIN_LINKS_PER_ROUND (16 * 1024 * 1024)
+
+// where a walk ended, the same for every method if they all follow the chain correctly
+typedef struct BenchWalk
+{
+	size_t links;
+	uint32_t last_cluster;
+} BenchWalk;
+
+static uint8_t* build_chain_table(const FatOps* ops, const size_t num_fat_entries, const bool fragmented,
+	uint32_t* head)
+{
+	// a fragmented chain is shuffled so every link is a jump, like a file written to a badly fragmented volume
+	uint32_t* order = malloc(num_fat_entries * sizeof(uint32_t));
+	const size_t num_chain_clusters = num_fat_entries - 2;
+	for (size_t idx = 0; idx < num_chain_clusters; idx++)
+		order[idx] = (uint32_t)(idx + 2);
+	uint64_t state = 0x9E3779B97F4A7C15;
+	for (size_t idx = num_chain_clusters - 1; fragmented && idx > 0; idx--)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		const size_t swap = (size_t)(state % (idx + 1));
+		const uint32_t cluster = order[idx];
+		order[idx] = order[swap];
+		order[swap] = cluster;
+	}
+
+	// entries 0 and 1 are reserved and hold end of chain values, like on disk
+	uint8_t* fat_table = malloc(num_fat_entries * ops->fat_entry_size);
+	for (size_t idx = 0; idx < num_chain_clusters + 2; idx++)
+	{
+		const uint32_t cluster = idx < 2 ? (uint32_t)idx : order[idx - 2];
+		const uint32_t fat_entry = idx >= 2 && idx - 1 < num_chain_clusters ? order[idx - 1] : ops->entry_mask;
+		if (ops->fat_entry_size == sizeof(uint16_t))
+			((uint16_t*)fat_table)[cluster] = (uint16_t)fat_entry;
+		else
+			((uint32_t*)fat_table)[cluster] = fat_entry;
+	}
+	*head = order[0];
+	free(order);
+	return fat_table;
+}
+
+static BenchWalk walk_generic(const uint8_t* fat_table, const PartitionType part_type, const size_t num_fat_entries,
+	const uint32_t head)
+{
+	BenchWalk walk = { 0, head };
+	while (true)
+	{
+		const uint32_t next_cluster = get_fat_entry(fat_table, part_type, walk.last_cluster);
+		if (is_end_of_chain(next_cluster, part_type) || next_cluster >= num_fat_entries)
+			break;
+		walk.last_cluster = next_cluster;
+		walk.links++;
+	}
+	return walk;
+}
+
+static BenchWalk walk_next_cluster(const uint8_t* fat_table, const FatOps* ops, const size_t num_fat_entries,
+	const uint32_t head)
+{
+	BenchWalk walk = { 0, head };
+	uint32_t next_cluster;
+	while ((next_cluster = ops->next_cluster(fat_table, num_fat_entries, walk.last_cluster)) != 0)
+	{
+		walk.last_cluster = next_cluster;
+		walk.links++;
+	}
+	return walk;
+}
+
+static BenchWalk walk_advance_chain(const uint8_t* fat_table, const FatOps* ops, const size_t num_fat_entries,
+	const uint32_t head)
+{
+	BenchWalk walk = { 0, head };
+	walk.last_cluster = ops->advance_chain(fat_table, num_fat_entries, head, SIZE_MAX, &walk.links);
+	return walk;
+}
+
+static double time_walk(const int method, const uint8_t* fat_table, const PartitionType part_type, const FatOps* ops,
+	const size_t num_fat_entries, const uint32_t head, const size_t walks_per_round, const size_t rounds,
+	BenchWalk* result)
+{
+	double best = -1.0;
+	for (size_t round = 0; round < rounds; round++)
+	{
+		const double start = get_time_ms();
+		for (size_t walk = 0; walk < walks_per_round; walk++)
+		{
+			if (method == 0)
+				*result = walk_generic(fat_table, part_type, num_fat_entries, head);
+			else if (method == 1)
+				*result = walk_next_cluster(fat_table, ops, num_fat_entries, head);
+			else
+				*result = walk_advance_chain(fat_table, ops, num_fat_entries, head);
+		}
+		const double elapsed = get_time_ms() - start;
+		if (best < 0.0 || elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+bool run_chain_bench(const size_t num_clusters, size_t rounds)
+{
+	if (num_clusters < 2)
+	{
+		printf("Need a chain of at least 2 clusters.\n");
+		return false;
+	}
+	if (rounds == 0)
+		rounds = 1;
+
+	const PartitionType part_types[] = { FAT12, FAT16_LBA, FAT32_LBA };
+	bool success = true;
+	printf("Chain walk, best of %zu rounds\n", rounds);
+	printf("%-6s %-11s %10s %16s %16s %16s %9s\n", "width", "layout", "links", "generic ns/link", "next ns/link",
+		"advance ns/link", "speedup");
+	for (size_t test_idx = 0; test_idx < 2 * sizeof(part_types) / sizeof(part_types[0]); test_idx++)
+	{
+		// every cluster up to the first end of chain value can be part of a chain
+		const PartitionType part_type = part_types[test_idx / 2];
+		const bool fragmented = test_idx % 2 == 1;
+		const FatOps* ops = get_fat_ops(part_type);
+		size_t num_fat_entries = num_clusters + 2;
+		if (num_fat_entries > ops->end_of_chain)
+			num_fat_entries = ops->end_of_chain;
+		uint32_t head;
+		uint8_t* fat_table = build_chain_table(ops, num_fat_entries, fragmented, &head);
+		const size_t links_per_round = num_clusters > MIN_LINKS_PER_ROUND ? num_clusters : MIN_LINKS_PER_ROUND;
+		const size_t walks_per_round = (links_per_round + num_fat_entries - 4) / (num_fat_entries - 3);
+
+		BenchWalk walks[3];
+		double elapsed[3];
+		for (int method = 0; method < 3; method++)
+			elapsed[method] = time_walk(method, fat_table, part_type, ops, num_fat_entries, head,
+				walks_per_round, rounds, &walks[method]);
+		free(fat_table);
+
+		const double total_links = (double)walks[0].links * (double)walks_per_round;
+		printf("%-6s %-11s %10zu %16.2f %16.2f %16.2f %8.2fx\n", ops->name, fragmented ? "fragmented" : "contiguous",
+			walks[0].links,
+			elapsed[0] * 1000000.0 / total_links, elapsed[1] * 1000000.0 / total_links,
+			elapsed[2] * 1000000.0 / total_links, elapsed[0] / elapsed[2]);
+
+		// all three have to agree, otherwise the faster numbers mean nothing
+		for (int method = 1; method < 3; method++)
+		{
+			if (walks[method].links != walks[0].links || walks[method].last_cluster != walks[0].last_cluster)
+			{
+				printf("  %s walks disagree: %zu links to cluster %u against %zu links to cluster %u\n", ops->name,
+					walks[method].links, walks[method].last_cluster, walks[0].links, walks[0].last_cluster);
+				success = false;
+			}
+		}
+		if (walks[0].links != num_fat_entries - 3)
+		{
+			printf("  %s chain is %zu links, expected %zu\n", ops->name, walks[0].links, num_fat_entries - 3);
+			success = false;
+		}
+	}
+	return success;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+// defaults for --bench, a FAT32 chain this long is a file of 16 GB at 4 KB clusters
+#define DEFAULT_BENCH_CLUSTERS (4 * 1024 * 1024)
+#define DEFAULT_BENCH_ROUNDS 5
+
+/**
+ * @brief Time long chain walks through the generic FAT lookups and through the per-width functions
+ *
+ * Builds a FAT of every width in memory holding one chain through all of its clusters, once in order and
+ * once shuffled, then follows it with get_fat_entry and is_end_of_chain, with FatOps next_cluster and with
+ * FatOps advance_chain. No image is needed, the numbers only depend on the lookups and the memory they touch.
+ *
+ * @param num_clusters Clusters in the FAT32 chain, FAT12 and FAT16 are capped at their largest table
+ * @param rounds Times each walk is repeated, the fastest round is reported
+ * @return true Every walk ended on the same cluster after the same number of links
+ */
+bool run_chain_bench(size_t num_clusters, size_t rounds);
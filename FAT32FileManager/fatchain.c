@@ -0,0 +1,160 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatchain.h"
+#include "utilties.h"
+#include "fattrace.h"
+
+ChainIndex* get_chain_index(ChainCache* cache, const uint32_t first_cluster)
+{
+	for (size_t idx = 0; idx < CHAIN_CACHE_SIZE; idx++)
+	{
+		if (cache->indexes[idx].checkpoints && cache->indexes[idx].first_cluster == first_cluster)
+			return &cache->indexes[idx];
+	}
+
+	// reuse slots round robin
+	ChainIndex* index = &cache->indexes[cache->next_slot];
+	cache->next_slot = (cache->next_slot + 1) % CHAIN_CACHE_SIZE;
+	free(index->checkpoints);
+
+	index->first_cluster = first_cluster;
+	index->last_cluster = first_cluster;
+	index->num_walked = 1;
+	index->complete = false;
+	index->checkpoints = malloc(sizeof(uint32_t) * 4);
+	index->checkpoints[0] = first_cluster;
+	index->num_checkpoints = 1;
+	return index;
+}
+
+void clear_chain_cache(ChainCache* cache)
+{
+	for (size_t idx = 0; idx < CHAIN_CACHE_SIZE; idx++)
+	{
+		free(cache->indexes[idx].checkpoints);
+		cache->indexes[idx].checkpoints = NULL;
+	}
+	cache->next_slot = 0;
+}
+
+static void add_checkpoint(ChainIndex* index, const uint32_t cluster)
+{
+	// grow in powers of two
+	if ((index->num_checkpoints & (index->num_checkpoints - 1)) == 0 && index->num_checkpoints >= 4)
+		index->checkpoints = realloc(index->checkpoints, sizeof(uint32_t) * index->num_checkpoints * 2);
+	index->checkpoints[index->num_checkpoints++] = cluster;
+}
+
+static uint32_t step_chain(const FatVolume* volume, ChainIndex* index, const uint32_t cluster, const size_t position)
+{
+	// follow one link, recording it if this is further than we have walked before
+	const uint32_t next_cluster = volume->ops->next_cluster(volume->fat_table, volume->num_fat_entries, cluster);
+	const bool at_frontier = position + 1 == index->num_walked;
+	if (!next_cluster || index->num_walked > volume->num_fat_entries)
+	{
+		if (at_frontier)
+			index->complete = true;
+		return 0;
+	}
+
+	if (at_frontier)
+	{
+		index->num_walked++;
+		index->last_cluster = next_cluster;
+		if ((position + 1) % CHAIN_CHECKPOINT_INTERVAL == 0)
+			add_checkpoint(index, next_cluster);
+	}
+	return next_cluster;
+}
+
+uint32_t seek_chain(const FatVolume* volume, ChainIndex* index, const size_t position)
+{
+	size_t steps_taken;
+	if (position < index->num_walked)
+	{
+		// start from the closest checkpoint, links behind the frontier need no bookkeeping
+		const size_t current = position / CHAIN_CHECKPOINT_INTERVAL * CHAIN_CHECKPOINT_INTERVAL;
+		const uint32_t cluster = index->checkpoints[position / CHAIN_CHECKPOINT_INTERVAL];
+		return volume->ops->advance_chain(volume->fat_table, volume->num_fat_entries, cluster, position - current,
+			&steps_taken);
+	}
+	if (index->complete)
+		return 0;
+
+	// push the frontier out one checkpoint interval at a time
+	size_t current = index->num_walked - 1;
+	uint32_t cluster = index->last_cluster;
+	while (current < position)
+	{
+		const size_t next_checkpoint = (current / CHAIN_CHECKPOINT_INTERVAL + 1) * CHAIN_CHECKPOINT_INTERVAL;
+		const size_t target = position < next_checkpoint ? position : next_checkpoint;
+		cluster = volume->ops->advance_chain(volume->fat_table, volume->num_fat_entries, cluster, target - current,
+			&steps_taken);
+		current += steps_taken;
+		index->num_walked = current + 1;
+		index->last_cluster = cluster;
+
+		// a chain longer than the FAT has entries must loop
+		if (current < target || index->num_walked > volume->num_fat_entries)
+		{
+			index->complete = true;
+			return 0;
+		}
+		if (current % CHAIN_CHECKPOINT_INTERVAL == 0)
+			add_checkpoint(index, cluster);
+	}
+	return cluster;
+}
+
+size_t read_file_range(const FatVolume* volume, ChainIndex* index, const size_t file_size,
+	const size_t offset, size_t length, uint8_t* buffer)
+{
+	if (offset >= file_size)
+		return 0;
+	if (length > file_size - offset)
+		length = file_size - offset;
+
+	const size_t cluster_size = get_cluster_size(volume->part_info);
+	size_t position = offset / cluster_size;
+	size_t cluster_offset = offset % cluster_size;
+	uint32_t cluster = seek_chain(volume, index, position);
+	size_t bytes_read = 0;
+
+	while (bytes_read < length && cluster)
+	{
+		// gather clusters that follow each other on disk into one read
+		const uint64_t run_offset = get_cluster_offset(volume->part_info, volume->part_offsets, cluster) + cluster_offset;
+		size_t run_length = cluster_size - cluster_offset;
+		uint32_t next_cluster = step_chain(volume, index, cluster, position);
+		position++;
+		while (bytes_read + run_length < length && next_cluster == cluster + 1)
+		{
+			cluster = next_cluster;
+			run_length += cluster_size;
+			next_cluster = step_chain(volume, index, cluster, position);
+			position++;
+		}
+		if (run_length > length - bytes_read)
+			run_length = length - bytes_read;
+
+		const uint64_t read_time = get_trace_time();
+		if (volume->direct)
+		{
+			if (!direct_read(volume->direct, run_offset, run_length, &buffer[bytes_read]))
+				break;
+		}
+		else if (seek_file(volume->fp, run_offset) ||
+			fread(&buffer[bytes_read], 1, run_length, volume->fp) != run_length)
+			break;
+		trace_read(TRACE_READ_FILE_RANGE, run_offset, run_length, read_time);
+
+		bytes_read += run_length;
+		cluster = next_cluster;
+		cluster_offset = 0;
+	}
+	return bytes_read;
+}
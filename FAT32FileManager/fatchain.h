@@ -0,0 +1,76 @@
+#pragma once
+#include <stdio.h>
+
+#include "fatparser.h"
+#include "fatdirect.h"
+#include "fatwidth.h"
+
+// one checkpoint is kept every this many clusters of a chain
+#define CHAIN_CHECKPOINT_INTERVAL 64
+// number of files whose chain positions are remembered
+#define CHAIN_CACHE_SIZE 32
+
+typedef struct ChainIndex
+{
+	uint32_t first_cluster;
+	uint32_t last_cluster;
+	size_t num_walked;
+	bool complete;
+	uint32_t *checkpoints;
+	size_t num_checkpoints;
+} ChainIndex;
+
+typedef struct ChainCache
+{
+	ChainIndex indexes[CHAIN_CACHE_SIZE];
+	size_t next_slot;
+} ChainCache;
+
+typedef struct FatVolume
+{
+	FILE *fp;
+	const PartitionInfo *part_info;
+	const PartitionLocations *part_offsets;
+	PartitionType part_type;
+	const FatOps *ops;
+	const uint8_t *fat_table;
+	size_t num_fat_entries;
+	DirectReader *direct;	// bypass the page cache for file data when set
+} FatVolume;
+
+/**
+ * @brief Get the chain position index of a file, creating it if it is not cached yet
+ *
+ * @param cache Cache of recently used chains
+ * @param first_cluster First cluster of the file
+ * @return ChainIndex* Index for the file
+ */
+ChainIndex *get_chain_index(ChainCache *cache, const uint32_t first_cluster);
+/**
+ * @brief Free every index in the cache
+ *
+ * @param cache Cache to clear
+ */
+void clear_chain_cache(ChainCache *cache);
+/**
+ * @brief Find the cluster at a position in a chain, jumping from the nearest checkpoint
+ *
+ * @param volume Mounted volume
+ * @param index Chain index of the file, extended as the chain is walked
+ * @param position Cluster position in the file
+ * @return uint32_t Cluster number, 0 if the chain is shorter than the position
+ */
+uint32_t seek_chain(const FatVolume *volume, ChainIndex *index, const size_t position);
+/**
+ * @brief Read part of a file without touching the clusters before the range
+ *
+ * @param volume Mounted volume
+ * @param index Chain index of the file
+ * @param file_size Size of the file
+ * @param offset First byte to read
+ * @param length Number of bytes to read
+ * @param buffer Output buffer of at least length bytes
+ * @return size_t Number of bytes read
+ */
+size_t read_file_range(const FatVolume *volume, ChainIndex *index, const size_t file_size,
+					   const size_t offset, size_t length, uint8_t *buffer);
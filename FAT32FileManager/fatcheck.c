@@ -0,0 +1,471 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatcheck.h"
+#include "fatwalk.h"
+#include "fatwidth.h"
+#include "workpool.h"
+
+// most individual problems printed before only the totals are shown
+#define MAX_PRINTED_ISSUES 32
+
+typedef enum EntryIssue
+{
+	ISSUE_NONE = 0,
+	ISSUE_CROSS_LINKED = 1,
+	ISSUE_LOOP = 2,
+	ISSUE_BROKEN = 4,
+	ISSUE_SIZE = 8
+} EntryIssue;
+
+typedef struct DirCycle
+{
+	size_t entry;		// directory entry pointing back up the tree
+	size_t ancestor;	// directory it points at, SIZE_MAX for the root
+} DirCycle;
+
+typedef struct CheckShared
+{
+	const uint8_t *fat_table[2];
+	size_t num_fat_entries;
+	const FatOps *ops;
+	size_t cluster_size;
+	const VolumeTree *tree;
+	uint8_t *entry_issues;
+	size_t *chain_lengths;
+	uint64_t *owned;
+	uint64_t *conflicts;
+	uint64_t *worker_owned;
+	uint64_t *worker_conflicts;
+	size_t num_workers;
+	size_t bitmap_words;
+} CheckShared;
+
+typedef struct CheckWorker
+{
+	WorkRange range;
+	const CheckShared *shared;
+	uint64_t *owned;
+	uint64_t *conflicts;
+	size_t fat_mismatches;
+	size_t cross_linked_clusters;
+	size_t lost_clusters;
+	size_t lost_chains;
+} CheckWorker;
+
+static size_t count_bits(uint64_t word)
+{
+#if defined(__GNUC__)
+	return (size_t)__builtin_popcountll(word);
+#else
+	size_t count = 0;
+	for (; word; count++)
+		word &= word - 1;
+	return count;
+#endif
+}
+
+static bool test_bit(const uint64_t* bitmap, const uint32_t bit)
+{
+	return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit(uint64_t* bitmap, const uint32_t bit)
+{
+	bitmap[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static bool is_allocated(const CheckShared* shared, const uint32_t fat_entry)
+{
+	return fat_entry != 0 && fat_entry != shared->ops->bad_cluster;
+}
+
+static bool chain_loops(const CheckShared* shared, const uint32_t head)
+{
+	// Brent's cycle detection, constant memory
+	uint32_t tortoise = head;
+	uint32_t hare = head;
+	size_t power = 1;
+	size_t length = 1;
+	while (true)
+	{
+		const uint32_t next_cluster = shared->ops->next_cluster(shared->fat_table[0], shared->num_fat_entries, hare);
+		if (!next_cluster)
+			return false;
+		hare = next_cluster;
+		if (hare == tortoise)
+			return true;
+		if (length == power)
+		{
+			tortoise = hare;
+			power *= 2;
+			length = 0;
+		}
+		length++;
+	}
+}
+
+typedef struct CycleList
+{
+	const FatOps *ops;
+	uint32_t root_cluster;
+	DirCycle *cycles;
+	size_t num_cycles;
+	size_t capacity;
+} CycleList;
+
+static void find_cycle(void* context, const VolumeTree* tree, const size_t entry, const uint32_t cluster,
+	const bool past_end)
+{
+	// invalid clusters are left to the chain walk, which reports them as broken
+	CycleList* list = context;
+	if (past_end)
+		return;
+
+	// opened before, pointing at one of its own parents is a cycle, anywhere else it is a cross-link
+	for (size_t ancestor = tree->entries[entry].parent;; ancestor = tree->entries[ancestor].parent)
+	{
+		const uint32_t ancestor_cluster = ancestor == SIZE_MAX ? list->root_cluster :
+			list->ops->get_cluster_number(&tree->entries[ancestor].record);
+		if (ancestor_cluster == cluster)
+		{
+			if (list->num_cycles == list->capacity)
+			{
+				list->capacity = list->capacity ? list->capacity * 2 : 16;
+				list->cycles = realloc(list->cycles, list->capacity * sizeof(DirCycle));
+			}
+			list->cycles[list->num_cycles].entry = entry;
+			list->cycles[list->num_cycles].ancestor = ancestor;
+			list->num_cycles++;
+			return;
+		}
+		if (ancestor == SIZE_MAX)
+			return;
+	}
+}
+
+static VolumeTree* load_check_tree(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, const size_t num_fat_entries, DirCycle** cycles,
+	size_t* num_cycles)
+{
+	// the walk has to end on exactly the volumes we are checking, so every directory cluster is opened once
+	CycleList list = { get_fat_ops(part_type), is_fat32(part_type) ? part_info->root_dir_first_cluster : 0, NULL, 0, 0 };
+	const VolumeWalkHooks hooks = { &list, NULL, find_cycle };
+	VolumeTree* tree = walk_volume_tree(fp, part_info, part_offsets, part_type, snapshot, num_fat_entries, &hooks);
+	*cycles = list.cycles;
+	*num_cycles = list.num_cycles;
+	return tree;
+}
+
+static int compare_fat_range(void* arg)
+{
+	// memcmp is vectorized by the C library, only fall back to entries when a block differs
+	CheckWorker* worker = arg;
+	const CheckShared* shared = worker->shared;
+	const size_t block_entries = 4096;
+	for (size_t block = worker->range.first; block < worker->range.last; block += block_entries)
+	{
+		const size_t block_end = block + block_entries < worker->range.last ? block + block_entries : worker->range.last;
+		const size_t offset = block * shared->ops->fat_entry_size;
+		const size_t length = (block_end - block) * shared->ops->fat_entry_size;
+		if (memcmp(shared->fat_table[0] + offset, shared->fat_table[1] + offset, length) == 0)
+			continue;
+
+		for (size_t entry = block; entry < block_end; entry++)
+		{
+			if (shared->ops->get_fat_entry(shared->fat_table[0], (uint32_t)entry) !=
+				shared->ops->get_fat_entry(shared->fat_table[1], (uint32_t)entry))
+				worker->fat_mismatches++;
+		}
+	}
+	return 0;
+}
+
+static int walk_chains(void* arg)
+{
+	// every worker claims clusters in its own bitmap, overlaps between workers are found when merging
+	CheckWorker* worker = arg;
+	const CheckShared* shared = worker->shared;
+	for (size_t idx = worker->range.first; idx < worker->range.last; idx++)
+	{
+		const FileRecord* record = &shared->tree->entries[idx].record;
+		uint32_t cluster = shared->ops->get_cluster_number(record);
+		size_t length = 0;
+
+		while (cluster >= 2 && cluster < shared->num_fat_entries)
+		{
+			if (test_bit(worker->owned, cluster))
+			{
+				// seen before by this worker, either our own chain loops or another chain owns it
+				if (chain_loops(shared, shared->ops->get_cluster_number(record)))
+					shared->entry_issues[idx] |= ISSUE_LOOP;
+				else
+					set_bit(worker->conflicts, cluster);
+				break;
+			}
+			set_bit(worker->owned, cluster);
+			length++;
+
+			// a chain must end in an end-of-chain marker, not a free, bad or out of range cluster
+			const uint32_t next_cluster = shared->ops->get_fat_entry(shared->fat_table[0], cluster);
+			if (!is_allocated(shared, next_cluster) || next_cluster == 1)
+			{
+				shared->entry_issues[idx] |= ISSUE_BROKEN;
+				break;
+			}
+			if (next_cluster >= shared->ops->end_of_chain)
+				break;
+			if (next_cluster >= shared->num_fat_entries ||
+				!is_allocated(shared, shared->ops->get_fat_entry(shared->fat_table[0], next_cluster)))
+			{
+				shared->entry_issues[idx] |= ISSUE_BROKEN;
+				break;
+			}
+			cluster = next_cluster;
+		}
+		shared->chain_lengths[idx] = length;
+
+		if (!record->directory && !(shared->entry_issues[idx] & (ISSUE_LOOP | ISSUE_CROSS_LINKED)))
+		{
+			const size_t expected = (record->file_size + shared->cluster_size - 1) / shared->cluster_size;
+			if (length != expected)
+				shared->entry_issues[idx] |= ISSUE_SIZE;
+		}
+	}
+	return 0;
+}
+
+static int merge_owned(void* arg)
+{
+	// split by bitmap words, a cluster claimed by more than one worker is cross-linked
+	CheckWorker* worker = arg;
+	const CheckShared* shared = worker->shared;
+	for (size_t word = worker->range.first; word < worker->range.last; word++)
+	{
+		uint64_t merged = 0;
+		uint64_t conflicts = 0;
+		for (size_t walker = 0; walker < shared->num_workers; walker++)
+		{
+			const uint64_t claimed = shared->worker_owned[walker * shared->bitmap_words + word];
+			conflicts |= (merged & claimed) | shared->worker_conflicts[walker * shared->bitmap_words + word];
+			merged |= claimed;
+		}
+		shared->owned[word] = merged;
+		shared->conflicts[word] = conflicts;
+		worker->cross_linked_clusters += count_bits(conflicts);
+	}
+	return 0;
+}
+
+static int flag_cross_links(void* arg)
+{
+	// mark every entry whose chain touches a cross-linked cluster, not just the one that found it
+	CheckWorker* worker = arg;
+	const CheckShared* shared = worker->shared;
+	for (size_t idx = worker->range.first; idx < worker->range.last; idx++)
+	{
+		uint32_t cluster = shared->ops->get_cluster_number(&shared->tree->entries[idx].record);
+		for (size_t step = 0; step < shared->chain_lengths[idx] + 1 && cluster >= 2 && cluster < shared->num_fat_entries; step++)
+		{
+			if (test_bit(shared->conflicts, cluster))
+			{
+				shared->entry_issues[idx] |= ISSUE_CROSS_LINKED;
+				break;
+			}
+			cluster = shared->ops->get_fat_entry(shared->fat_table[0], cluster);
+		}
+	}
+	return 0;
+}
+
+static int find_lost_clusters(void* arg)
+{
+	// a lost chain has exactly one tail, so counting tails counts chains
+	CheckWorker* worker = arg;
+	const CheckShared* shared = worker->shared;
+	for (size_t cluster = worker->range.first; cluster < worker->range.last; cluster++)
+	{
+		const uint32_t fat_entry = shared->ops->get_fat_entry(shared->fat_table[0], (uint32_t)cluster);
+		if (!is_allocated(shared, fat_entry) || test_bit(shared->owned, (uint32_t)cluster))
+			continue;
+
+		worker->lost_clusters++;
+		if (fat_entry < 2 || fat_entry >= shared->ops->end_of_chain || fat_entry >= shared->num_fat_entries ||
+			test_bit(shared->owned, fat_entry) || !is_allocated(shared, shared->ops->get_fat_entry(shared->fat_table[0], fat_entry)))
+			worker->lost_chains++;
+	}
+	return 0;
+}
+
+bool check_volume(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, const size_t num_threads,
+	FILE* out, CheckReport* report)
+{
+	memset(report, 0, sizeof(CheckReport));
+
+	CheckShared shared;
+	memset(&shared, 0, sizeof(CheckShared));
+	shared.ops = get_fat_ops(part_type);
+	shared.cluster_size = get_cluster_size(part_info);
+
+	size_t num_entries_copy = 0;
+	uint8_t* fat_tables[2];
+	fat_tables[0] = read_fat_table(fp, part_info, part_offsets, part_type, 0, &shared.num_fat_entries);
+	fat_tables[1] = part_info->num_fat_tables > 1 ?
+		read_fat_table(fp, part_info, part_offsets, part_type, 1, &num_entries_copy) : NULL;
+	if (!fat_tables[0])
+	{
+		fprintf(out, "Could not read FAT.\n");
+		free(fat_tables[1]);
+		return false;
+	}
+	shared.fat_table[0] = fat_tables[0];
+	shared.fat_table[1] = fat_tables[1];
+
+	// every worker keeps two bitmaps as big as the FAT, so running out of memory has to end the check cleanly
+	bool consistent = false;
+	VolumeTree* tree = NULL;
+	DirCycle* cycles = NULL;
+	size_t num_cycles = 0;
+	CheckWorker* workers = calloc(num_threads, sizeof(CheckWorker));
+	if (!workers)
+		goto out_of_memory;
+	for (size_t idx = 0; idx < num_threads; idx++)
+		workers[idx].shared = &shared;
+
+	// 1. both FAT copies should be identical
+	if (fat_tables[1])
+	{
+		run_parallel(workers, sizeof(CheckWorker), num_threads, compare_fat_range, 0, shared.num_fat_entries);
+		for (size_t idx = 0; idx < num_threads; idx++)
+			report->fat_mismatches += workers[idx].fat_mismatches;
+	}
+
+	// 2. walk every chain, each worker owning a slice of the tree and its own ownership bitmap
+	tree = load_check_tree(fp, part_info, part_offsets, part_type, snapshot, shared.num_fat_entries, &cycles,
+		&num_cycles);
+	report->directory_cycles = num_cycles;
+	shared.tree = tree;
+	shared.entry_issues = calloc(tree->num_entries + 1, sizeof(uint8_t));
+	shared.chain_lengths = calloc(tree->num_entries + 1, sizeof(size_t));
+	shared.bitmap_words = (shared.num_fat_entries + 63) / 64;
+	shared.num_workers = num_threads;
+	shared.worker_owned = calloc(num_threads * shared.bitmap_words, sizeof(uint64_t));
+	shared.worker_conflicts = calloc(num_threads * shared.bitmap_words, sizeof(uint64_t));
+	shared.owned = calloc(shared.bitmap_words, sizeof(uint64_t));
+	shared.conflicts = calloc(shared.bitmap_words, sizeof(uint64_t));
+	if (!shared.entry_issues || !shared.chain_lengths || !shared.worker_owned || !shared.worker_conflicts ||
+		!shared.owned || !shared.conflicts)
+		goto out_of_memory;
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		workers[idx].owned = &shared.worker_owned[idx * shared.bitmap_words];
+		workers[idx].conflicts = &shared.worker_conflicts[idx * shared.bitmap_words];
+	}
+	run_parallel(workers, sizeof(CheckWorker), num_threads, walk_chains, 0, tree->num_entries);
+
+	// 3. merge the bitmaps, then point every owner of a cross-linked cluster out
+	run_parallel(workers, sizeof(CheckWorker), num_threads, merge_owned, 0, shared.bitmap_words);
+	for (size_t idx = 0; idx < num_threads; idx++)
+		report->cross_linked_clusters += workers[idx].cross_linked_clusters;
+
+	// the FAT32 root directory is a chain of its own without an entry pointing at it
+	if (is_fat32(part_type))
+	{
+		uint32_t cluster = part_info->root_dir_first_cluster;
+		for (size_t step = 0; step < shared.num_fat_entries && cluster >= 2 && cluster < shared.num_fat_entries; step++)
+		{
+			if (test_bit(shared.owned, cluster))
+			{
+				set_bit(shared.conflicts, cluster);
+				report->cross_linked_clusters++;
+				break;
+			}
+			set_bit(shared.owned, cluster);
+			cluster = shared.ops->next_cluster(fat_tables[0], shared.num_fat_entries, cluster);
+		}
+	}
+	if (report->cross_linked_clusters)
+		run_parallel(workers, sizeof(CheckWorker), num_threads, flag_cross_links, 0, tree->num_entries);
+
+	// 4. allocated clusters nobody owns
+	run_parallel(workers, sizeof(CheckWorker), num_threads, find_lost_clusters, 2, shared.num_fat_entries);
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		report->lost_clusters += workers[idx].lost_clusters;
+		report->lost_chains += workers[idx].lost_chains;
+	}
+
+	// print what we found per entry, then the totals
+	size_t printed = 0;
+	for (size_t idx = 0; idx < num_cycles; idx++)
+	{
+		if (printed++ >= MAX_PRINTED_ISSUES)
+			continue;
+		const size_t ancestor = cycles[idx].ancestor;
+		fprintf(out, "  %s: directory points back at %s, not descending\n", tree->entries[cycles[idx].entry].path,
+			ancestor == SIZE_MAX ? "the root directory" : tree->entries[ancestor].path);
+	}
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		const uint8_t issues = shared.entry_issues[idx];
+		if (issues & ISSUE_LOOP)
+			report->looped_chains++;
+		if (issues & ISSUE_BROKEN)
+			report->broken_chains++;
+		if (issues & ISSUE_SIZE)
+			report->size_mismatches++;
+		if (!issues || printed++ >= MAX_PRINTED_ISSUES)
+			continue;
+
+		const VolumeEntry* entry = &tree->entries[idx];
+		if (issues & ISSUE_CROSS_LINKED)
+			fprintf(out, "  %s: cluster chain is cross-linked with another entry\n", entry->path);
+		if (issues & ISSUE_LOOP)
+			fprintf(out, "  %s: cluster chain loops back on itself\n", entry->path);
+		if (issues & ISSUE_BROKEN)
+			fprintf(out, "  %s: cluster chain runs into a free or invalid cluster\n", entry->path);
+		if (issues & ISSUE_SIZE)
+			fprintf(out, "  %s: size %u needs %zu clusters, chain has %zu\n", entry->path, entry->record.file_size,
+				(entry->record.file_size + shared.cluster_size - 1) / shared.cluster_size, shared.chain_lengths[idx]);
+	}
+	if (printed > MAX_PRINTED_ISSUES)
+		fprintf(out, "  ... %zu more entries with problems\n", printed - MAX_PRINTED_ISSUES);
+
+	fprintf(out, "Checked %zu entries and %zu clusters with %zu threads.\n", tree->num_entries,
+		shared.num_fat_entries > 2 ? shared.num_fat_entries - 2 : 0, num_threads);
+	if (!fat_tables[1])
+		fprintf(out, "  only one FAT copy, nothing to compare\n");
+	fprintf(out, "  FAT copy mismatches:    %zu\n", report->fat_mismatches);
+	fprintf(out, "  cross-linked clusters:  %zu\n", report->cross_linked_clusters);
+	fprintf(out, "  looped chains:          %zu\n", report->looped_chains);
+	fprintf(out, "  broken chains:          %zu\n", report->broken_chains);
+	fprintf(out, "  size mismatches:        %zu\n", report->size_mismatches);
+	fprintf(out, "  lost clusters:          %zu in %zu chains\n", report->lost_clusters, report->lost_chains);
+	fprintf(out, "  directory cycles:       %zu\n", report->directory_cycles);
+
+	consistent = report->fat_mismatches == 0 && report->cross_linked_clusters == 0 &&
+		report->looped_chains == 0 && report->broken_chains == 0 && report->size_mismatches == 0 &&
+		report->lost_clusters == 0 && report->directory_cycles == 0;
+	fprintf(out, "%s\n\n", consistent ? "Volume is consistent." : "Volume has errors.");
+	goto done;
+
+out_of_memory:
+	fprintf(out, "Not enough memory to check the volume with %zu threads.\n\n", num_threads);
+done:
+	free(shared.conflicts);
+	free(shared.owned);
+	free(shared.worker_conflicts);
+	free(shared.worker_owned);
+	free(shared.chain_lengths);
+	free(shared.entry_issues);
+	free_volume_tree(tree);
+	free(cycles);
+	free(workers);
+	free(fat_tables[0]);
+	free(fat_tables[1]);
+	return consistent;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+
+typedef struct CheckReport
+{
+	size_t fat_mismatches;
+	size_t cross_linked_clusters;
+	size_t looped_chains;
+	size_t broken_chains;
+	size_t size_mismatches;
+	size_t lost_clusters;
+	size_t lost_chains;
+	size_t directory_cycles;
+} CheckReport;
+
+/**
+ * @brief Check the FAT copies and every cluster chain of the partition for consistency
+ *
+ * Compares FAT[0] with FAT[1], then walks the chain of every file and directory to find
+ * cross-linked clusters, loops, chains running into free clusters, chain lengths that do not match
+ * the file size, allocated clusters nobody owns, and directories pointing back at one of their own parents.
+ * FAT ranges and the tree are split across threads.
+ *
+ * @param fp Disk image
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param part_type Partition filesystem type
+ * @param snapshot Sidecar snapshot to read directories from, may be NULL
+ * @param num_threads Number of worker threads
+ * @param out Stream to print findings to
+ * @param report Totals of every problem found
+ * @return true The volume is consistent
+ */
+bool check_volume(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+				  const PartitionType part_type, const Snapshot *snapshot, const size_t num_threads,
+				  FILE *out, CheckReport *report);
@@ -0,0 +1,307 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "fatcolumns.h"
+#include "fatwalk.h"
+#include "fatwidth.h"
+#include "utilties.h"
+
+// entries filtered together, small enough for the keep flags to stay in L1
+#define SCAN_BLOCK_SIZE 4096
+
+static uint8_t get_attribute_byte(const FileRecord* record)
+{
+	// the attribute bit fields share the byte after the extension
+	return ((const uint8_t*)record)[offsetof(FileRecord, extension) + sizeof(record->extension)];
+}
+
+typedef struct NameColumn
+{
+	ColumnStore *store;
+	size_t capacity;
+} NameColumn;
+
+static void append_names(void* context, const VolumeTree* tree, const FileRecord* records, const size_t num_records,
+	const size_t first_entry)
+{
+	// the walk keeps only short names, take the long one of every entry it kept from this listing
+	NameColumn* column = context;
+	ColumnStore* store = column->store;
+	(void)tree;
+	(void)first_entry;
+	DirNames* names = index_dir_names(records, num_records);
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		if (!is_tree_record(&records[idx]))
+			continue;
+
+		const char* name = get_display_name(names, records, idx);
+		const size_t name_length = strlen(name) + 1;
+		while (store->names_size + name_length > column->capacity)
+		{
+			column->capacity = column->capacity ? column->capacity * 2 : 16384;
+			store->names = realloc(store->names, column->capacity);
+		}
+		memcpy(&store->names[store->names_size], name, name_length);
+		store->names_size += name_length;
+	}
+	free_dir_names(names);
+}
+
+ColumnStore* load_column_store(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, const size_t num_fat_entries)
+{
+	// same walk as the volume tree, the names are collected as the listings go by and the rest is split into columns
+	const FatOps* ops = get_fat_ops(part_type);
+	ColumnStore* store = calloc(1, sizeof(ColumnStore));
+	NameColumn column = { store, 0 };
+	const VolumeWalkHooks hooks = { &column, append_names, NULL };
+	VolumeTree* tree = walk_volume_tree(fp, part_info, part_offsets, part_type, snapshot, num_fat_entries, &hooks);
+
+	const size_t num_entries = tree->num_entries;
+	store->num_entries = num_entries;
+	store->sizes = malloc((num_entries + 1) * sizeof(uint32_t));
+	store->first_clusters = malloc((num_entries + 1) * sizeof(uint32_t));
+	store->modified = malloc((num_entries + 1) * sizeof(uint32_t));
+	store->attributes = malloc((num_entries + 1) * sizeof(uint8_t));
+	store->parents = malloc((num_entries + 1) * sizeof(uint32_t));
+	store->name_offsets = malloc((num_entries + 1) * sizeof(uint32_t));
+
+	size_t name_offset = 0;
+	for (size_t id = 0; id < num_entries; id++)
+	{
+		const VolumeEntry* entry = &tree->entries[id];
+		store->sizes[id] = entry->record.file_size;
+		store->first_clusters[id] = ops->get_cluster_number(&entry->record);
+		store->modified[id] = (uint32_t)entry->record.date << 16 | entry->record.time;
+		store->attributes[id] = get_attribute_byte(&entry->record);
+		store->parents[id] = entry->parent == SIZE_MAX ? NO_PARENT : (uint32_t)entry->parent;
+		store->name_offsets[id] = (uint32_t)name_offset;
+		name_offset += strlen(&store->names[name_offset]) + 1;
+	}
+
+	free_volume_tree(tree);
+	return store;
+}
+
+void free_column_store(ColumnStore* store)
+{
+	if (!store)
+		return;
+	free(store->sizes);
+	free(store->first_clusters);
+	free(store->modified);
+	free(store->attributes);
+	free(store->parents);
+	free(store->name_offsets);
+	free(store->names);
+	free(store);
+}
+
+static void narrow_range(const uint64_t low, const uint64_t high, uint32_t* min, uint32_t* max, bool* never_matches)
+{
+	// intersect [low, high] with the range so far, anything past the column width cannot match
+	if (low > high || low > UINT32_MAX)
+	{
+		*never_matches = true;
+		return;
+	}
+	if (low > *min)
+		*min = (uint32_t)low;
+	if (high < *max)
+		*max = (uint32_t)high;
+	if (*min > *max)
+		*never_matches = true;
+}
+
+static bool parse_size(const char* text, ColumnQuery* query)
+{
+	// [+|-]<n>[K|M|G], + for larger than and - for smaller than
+	const char sign = *text == '+' || *text == '-' ? *text++ : '\0';
+	if (!isdigit((unsigned char)*text))
+		return false;
+	char* end;
+	const unsigned long long value = strtoull(text, &end, 10);
+	uint64_t unit = 1;
+	switch (toupper((unsigned char)*end))
+	{
+	case 'K': unit = 1024; end++; break;
+	case 'M': unit = 1024 * 1024; end++; break;
+	case 'G': unit = 1024 * 1024 * 1024; end++; break;
+	default: break;
+	}
+	if (*end != '\0' || value > UINT64_MAX / unit)
+		return false;
+
+	const uint64_t size = value * unit;
+	if (sign == '+')
+		narrow_range(size + 1, UINT32_MAX, &query->min_size, &query->max_size, &query->never_matches);
+	else if (sign == '-')
+		narrow_range(0, size - 1, &query->min_size, &query->max_size, &query->never_matches);
+	else
+		narrow_range(size, size, &query->min_size, &query->max_size, &query->never_matches);
+	if (sign == '-' && size == 0)
+		query->never_matches = true;
+	return true;
+}
+
+static bool parse_date(const char* text, uint32_t* modified)
+{
+	// yyyy-mm-dd as a modified value at the start of that day
+	int year, month, day;
+	char extra;
+	if (sscanf(text, "%d-%d-%d%c", &year, &month, &day, &extra) != 3 || year < 1980 || year > 2107 ||
+		month < 1 || month > 12 || day < 1 || day > 31)
+		return false;
+	*modified = (uint32_t)((year - 1980) << 9 | month << 5 | day) << 16;
+	return true;
+}
+
+static bool parse_attributes(const char* text, uint8_t* attributes)
+{
+	for (; *text; text++)
+	{
+		switch (toupper((unsigned char)*text))
+		{
+		case 'R': *attributes |= ATTR_READONLY; break;
+		case 'H': *attributes |= ATTR_HIDDEN; break;
+		case 'S': *attributes |= ATTR_SYSTEM; break;
+		case 'A': *attributes |= ATTR_ARCHIVE; break;
+		case 'D': *attributes |= ATTR_DIRECTORY; break;
+		default: return false;
+		}
+	}
+	return true;
+}
+
+bool parse_column_query(char** tokens, const size_t num_tokens, ColumnQuery* query)
+{
+	const ColumnQuery any = { 0, UINT32_MAX, 0, UINT32_MAX, 0, 0, NULL, false };
+	*query = any;
+
+	// every predicate takes exactly one value
+	for (size_t idx = 0; idx < num_tokens; idx += 2)
+	{
+		if (idx + 1 == num_tokens)
+			return false;
+		const char* option = tokens[idx];
+		const char* value = tokens[idx + 1];
+		uint32_t modified = 0;
+		bool valid = true;
+		if (strcmp(option, "-name") == 0)
+			query->name_pattern = value;
+		else if (strcmp(option, "-size") == 0)
+			valid = parse_size(value, query);
+		else if (strcmp(option, "-newer") == 0)
+		{
+			valid = parse_date(value, &modified);
+			narrow_range(modified, UINT32_MAX, &query->min_modified, &query->max_modified, &query->never_matches);
+		}
+		else if (strcmp(option, "-older") == 0)
+		{
+			valid = parse_date(value, &modified);
+			narrow_range(0, modified - 1, &query->min_modified, &query->max_modified, &query->never_matches);
+		}
+		else if (strcmp(option, "-attr") == 0)
+			valid = parse_attributes(value, &query->attributes_set);
+		else if (strcmp(option, "-type") == 0 && strcmp(value, "d") == 0)
+			query->attributes_set |= ATTR_DIRECTORY;
+		else if (strcmp(option, "-type") == 0 && strcmp(value, "f") == 0)
+			query->attributes_clear |= ATTR_DIRECTORY;
+		else
+			valid = false;
+		if (!valid)
+			return false;
+	}
+	if (query->attributes_set & query->attributes_clear)
+		query->never_matches = true;
+	return true;
+}
+
+static void scan_range(const uint32_t* column, const uint32_t min, const uint32_t max, uint8_t* keep, const size_t count)
+{
+	// one unsigned compare checks both ends, values below min wrap around past the span
+	const uint32_t span = max - min;
+	for (size_t idx = 0; idx < count; idx++)
+		keep[idx] &= (uint32_t)(column[idx] - min) <= span;
+}
+
+static void scan_attributes(const uint8_t* column, const uint8_t set, const uint8_t clear, uint8_t* keep,
+	const size_t count)
+{
+	for (size_t idx = 0; idx < count; idx++)
+		keep[idx] &= ((column[idx] & set) == set) & ((column[idx] & clear) == 0);
+}
+
+uint32_t* run_column_query(const ColumnStore* store, const ColumnQuery* query, size_t* num_matches)
+{
+	size_t capacity = 1024;
+	uint32_t* matches = malloc(capacity * sizeof(uint32_t));
+	*num_matches = 0;
+	if (query->never_matches)
+		return matches;
+
+	// columns without a predicate are not read at all
+	const bool by_size = query->min_size != 0 || query->max_size != UINT32_MAX;
+	const bool by_modified = query->min_modified != 0 || query->max_modified != UINT32_MAX;
+	const bool by_attributes = query->attributes_set != 0 || query->attributes_clear != 0;
+
+	uint8_t keep[SCAN_BLOCK_SIZE];
+	for (size_t base = 0; base < store->num_entries; base += SCAN_BLOCK_SIZE)
+	{
+		const size_t count = store->num_entries - base < SCAN_BLOCK_SIZE ? store->num_entries - base : SCAN_BLOCK_SIZE;
+		memset(keep, 1, count);
+		if (by_size)
+			scan_range(&store->sizes[base], query->min_size, query->max_size, keep, count);
+		if (by_modified)
+			scan_range(&store->modified[base], query->min_modified, query->max_modified, keep, count);
+		if (by_attributes)
+			scan_attributes(&store->attributes[base], query->attributes_set, query->attributes_clear, keep, count);
+
+		// names are the only column that has to be looked at entry by entry
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			if (!keep[idx])
+				continue;
+			const uint32_t id = (uint32_t)(base + idx);
+			if (query->name_pattern && !match_pattern(query->name_pattern, &store->names[store->name_offsets[id]]))
+				continue;
+			if (*num_matches == capacity)
+			{
+				capacity *= 2;
+				matches = realloc(matches, capacity * sizeof(uint32_t));
+			}
+			matches[(*num_matches)++] = id;
+		}
+	}
+	return matches;
+}
+
+void print_column_path(const ColumnStore* store, const uint32_t id, FILE* out)
+{
+	// parents come before their children, so the walk up always ends at the root
+	size_t depth = 1;
+	for (uint32_t parent = store->parents[id]; parent != NO_PARENT; parent = store->parents[parent])
+		depth++;
+
+	// then print from the root down
+	uint32_t* path = malloc(depth * sizeof(uint32_t));
+	uint32_t current = id;
+	for (size_t level = depth; level > 0; level--)
+	{
+		path[level - 1] = current;
+		current = store->parents[current];
+	}
+	for (size_t level = 0; level < depth; level++)
+	{
+		if (level > 0)
+			fputc('/', out);
+		fputs(&store->names[store->name_offsets[path[level]]], out);
+	}
+	free(path);
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+
+// bits of the attribute byte of a directory entry
+#define ATTR_READONLY 0x01
+#define ATTR_HIDDEN 0x02
+#define ATTR_SYSTEM 0x04
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE 0x20
+
+// parent of the entries in the root directory
+#define NO_PARENT UINT32_MAX
+
+// every entry of a volume with one array per field, an entry id indexes all of them
+typedef struct ColumnStore
+{
+	size_t num_entries;
+	uint32_t *sizes;
+	uint32_t *first_clusters;
+	uint32_t *modified;			// date in the high half and time in the low half, so it orders like the timestamp
+	uint8_t *attributes;		// attribute byte as stored on disk
+	uint32_t *parents;			// id of the directory the entry is in, parents come before their children
+	uint32_t *name_offsets;		// into names, the long name when the entry has one
+	char *names;
+	size_t names_size;
+} ColumnStore;
+
+// predicates of a find, each one an inclusive range or mask over one column
+typedef struct ColumnQuery
+{
+	uint32_t min_size;
+	uint32_t max_size;
+	uint32_t min_modified;
+	uint32_t max_modified;
+	uint8_t attributes_set;		// bits every match has
+	uint8_t attributes_clear;	// bits no match has
+	const char *name_pattern;	// glob over the name, NULL for any
+	bool never_matches;			// the ranges contradict each other
+} ColumnQuery;
+
+/**
+ * @brief Walk every directory of the partition once and store its entries by column
+ *
+ * A directory whose first cluster was already opened is kept as an entry but not walked again.
+ *
+ * @param fp Disk image
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param part_type Partition filesystem type
+ * @param snapshot Sidecar snapshot to read directories from, may be NULL
+ * @param num_fat_entries Number of clusters in the FAT, a directory starting past it is not opened
+ * @return ColumnStore* Every file and directory on the partition, parents before children
+ */
+ColumnStore *load_column_store(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+							   const PartitionType part_type, const Snapshot *snapshot, const size_t num_fat_entries);
+/**
+ * @brief Destroy a column store
+ *
+ * @param store Store to destroy
+ */
+void free_column_store(ColumnStore *store);
+/**
+ * @brief Parse find arguments into a query
+ *
+ * Takes -name <pattern>, -size [+|-]<n>[K|M|G], -newer <yyyy-mm-dd>, -older <yyyy-mm-dd>, -attr <RHSAD>
+ * and -type <f|d>. A predicate given twice narrows the range further.
+ *
+ * @param tokens Arguments, -name keeps a pointer to its pattern
+ * @param num_tokens Number of arguments
+ * @param query Output query
+ * @return true The arguments are valid
+ */
+bool parse_column_query(char **tokens, size_t num_tokens, ColumnQuery *query);
+/**
+ * @brief Find every entry matching a query
+ *
+ * Each predicate is one branch-free pass over its column in blocks, which the compiler turns into vector
+ * compares. Only entries left after the numeric columns have their name matched against the pattern.
+ *
+ * @param store Store to search
+ * @param query Query to run
+ * @param num_matches Output for the number of matches
+ * @return uint32_t* Ids of the matching entries in id order, free it when done
+ */
+uint32_t *run_column_query(const ColumnStore *store, const ColumnQuery *query, size_t *num_matches);
+/**
+ * @brief Print the full path of an entry
+ *
+ * @param store Store the entry is in
+ * @param id Entry id
+ * @param out Stream to print to
+ */
+void print_column_path(const ColumnStore *store, uint32_t id, FILE *out);
@@ -5,11 +5,33 @@
 #include <string.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include "fatcontextfactory.h"
 #include "fatparser.h"
+#include "fatextract.h"
+#include "fatcheck.h"
+#include "fatrecover.h"
+#include "fatusage.h"
+#include "fatdiff.h"
+#include "fattrace.h"
 #include "ConsoleUtil.h"
 #include "utilties.h"
 
+#ifndef STDOUT_FILENO
+#define STDOUT_FILENO 1
+#endif
+
+// size of the buffer file data is streamed through
+#define STREAM_BUFFER_SIZE (256 * 1024)
+// most names or patterns one export command takes
+#define MAX_EXPORT_PATTERNS 64
+// most arguments one find command takes
+#define MAX_FIND_ARGUMENTS 32
+
 FileManagerContext* setup_file_manager_context(const char* filename)
 {
 	FileManagerContext* context = calloc(1, sizeof(FileManagerContext));
@@ -21,24 +43,34 @@ FileManagerContext* setup_file_manager_context(const char* filename)
 	}
 	context->pwd = calloc(128, sizeof(char));
 	context->pwd_level = 0;
+	context->interactive = true;
+	context->chain_cache = calloc(1, sizeof(ChainCache));
+
+	context->image_path = malloc(strlen(filename) + 1);
+	strcpy(context->image_path, filename);
 
 	context->file = fopen(filename, "rb");
 	if (!context->file)
 		exit_file_manager(context, "Could not open file.\n");
 
 	// read in mbr
+	const uint64_t read_time = get_trace_time();
 	if (!fread(context->mbr, sizeof(uint8_t), sizeof(MBR), context->file))
 		exit_file_manager(context, "Could not read MBR.\n");
+	trace_read(TRACE_MBR, 0, sizeof(MBR), read_time);
 
 	return context;
 }
 
 void exit_file_manager(FileManagerContext* context, char* arg)
 {
-	printf("%s\n", arg);
+	if (context->interactive || arg[0] != '\0')
+		printf("%s\n", arg);
 
 	if (context->current_dir)
 		free(context->current_dir);
+	free_dir_names(context->dir_names);
+	free_column_store(context->columns);
 
 	if (context->part_offsets)
 		free(context->part_offsets);
@@ -46,6 +78,17 @@ void exit_file_manager(FileManagerContext* context, char* arg)
 	if (context->part_info)
 		free(context->part_info);
 
+	close_snapshot(context->snapshot);
+	close_direct_reader(context->direct_reader);
+	stop_prefetcher(context->prefetcher);
+	stop_trace();
+	free(context->image_path);
+	free(context->fat_table);
+	if (context->chain_cache)
+	{
+		clear_chain_cache(context->chain_cache);
+		free(context->chain_cache);
+	}
 
 	free(context->mbr);
 	for (size_t idx = 0; idx < 64; idx++)
@@ -80,9 +123,84 @@ void pop_pwd(FileManagerContext* context)
 	calculate_pwd(context);
 }
 
+FatVolume get_volume(const FileManagerContext* context)
+{
+	const FatVolume volume = { context->file, context->part_info, context->part_offsets, context->part->type,
+		context->fat_ops, context->fat_table, context->num_fat_entries, context->direct_reader };
+	return volume;
+}
+
+bool parse_range(const size_t file_size, char* offset_arg, char* length_arg, size_t* offset, size_t* length)
+{
+	// a negative offset counts back from the end of the file
+	int64_t requested_offset = 0;
+	int64_t requested_length = 0;
+	if (string_to_long(offset_arg, &requested_offset) || string_to_long(length_arg, &requested_length) || requested_length < 0)
+		return false;
+
+	if (requested_offset < 0)
+		requested_offset = (int64_t)file_size + requested_offset < 0 ? 0 : (int64_t)file_size + requested_offset;
+	*offset = (size_t)requested_offset;
+	*length = (size_t)requested_length;
+	if (*offset > file_size)
+		*offset = file_size;
+	if (*length > file_size - *offset)
+		*length = file_size - *offset;
+	return true;
+}
+
+bool stream_range(const FileManagerContext* context, const FileRecord* record, size_t offset, size_t length, const int fd)
+{
+	if (!context->fat_table)
+	{
+		printf("Could not read FAT.\n");
+		return false;
+	}
+
+	// push the range through one fixed buffer so memory stays flat however big the file is
+	const uint32_t cluster_num = context->fat_ops->get_cluster_number(record);
+	const FatVolume volume = get_volume(context);
+	ChainIndex* index = get_chain_index(context->chain_cache, cluster_num);
+	bool huge_pages;
+	uint8_t* buffer = allocate_io_buffer(STREAM_BUFFER_SIZE, &huge_pages);
+	bool success = true;
+
+	fflush(stdout);
+	while (length > 0)
+	{
+		const size_t chunk = length < STREAM_BUFFER_SIZE ? length : STREAM_BUFFER_SIZE;
+		const size_t bytes_read = read_file_range(&volume, index, record->file_size, offset, chunk, buffer);
+		if (write_all(fd, buffer, bytes_read) || bytes_read != chunk)
+		{
+			success = false;
+			break;
+		}
+		offset += chunk;
+		length -= chunk;
+	}
+
+	free_io_buffer(buffer, STREAM_BUFFER_SIZE, huge_pages);
+	return success;
+}
+
+FileRecord* load_dir(const FileManagerContext* context, const uint64_t offset, size_t* num_entries)
+{
+	// serve directories from the sidecar snapshot when we have one, then the prefetch cache, the image otherwise
+	FileRecord* records = snapshot_get_dir(context->snapshot, offset, num_entries);
+	if (records)
+		return records;
+	records = get_prefetched_dir(context->prefetcher, offset, num_entries);
+	if (!records)
+		records = get_dir(context->file, offset, num_entries);
+
+	// start on the subdirectories while the user looks at this one
+	prefetch_children(context->prefetcher, records, *num_entries);
+	return records;
+}
+
 void list_part(const FileManagerContext* context)
 {
-	display_partition_info(context->mbr);
+	display_partition_info(context->file, context->mbr);
 }
 
 void select_part(FileManagerContext* context, char* arg)
@@ -96,11 +214,57 @@ void select_part(FileManagerContext* context, char* arg)
 
 	else
 	{
+		size_t sector_size;
+		PartitionInfo* part_info = get_part_info(context->file, &context->mbr->partitions[input], &sector_size);
+		if (!part_info)
+		{
+			printf("Could not read partition boot sector.\n\n");
+			return;
+		}
 		context->selected_part = (uint32_t)input;
 		context->part = &context->mbr->partitions[context->selected_part];
-		context->part_info = get_part_info(context->file, context->part);
-		context->part_offsets = get_part_offsets(context->part, context->part_info);
-		context->current_dir = get_dir(context->file, context->part_offsets->root_dir, &context->dir_entries);
+		context->fat_ops = get_fat_ops(context->part->type);
+		context->part_info = part_info;
+		context->part_offsets = get_part_offsets(context->part, context->part_info, sector_size);
+
+		// keep the FAT in memory so chains can be followed without touching the image
+		free(context->fat_table);
+		clear_chain_cache(context->chain_cache);
+		context->fat_table = read_fat_table(context->file, context->part_info, context->part_offsets, context->part->type,
+			0, &context->num_fat_entries);
+
+		// pick up an existing index, it is rebuilt if the image changed since
+		close_snapshot(context->snapshot);
+		context->snapshot = open_snapshot(context->file, context->image_path, context->selected_part, context->part,
+			context->part_info, context->part_offsets, context->fat_table, context->num_fat_entries, false);
+
+		// the column store is built again by the first find on the new partition
+		free_column_store(context->columns);
+		context->columns = NULL;
+
+		// cached listings belong to the old partition, keep prefetching with the same settings on the new one
+		if (context->prefetcher)
+		{
+			PrefetchStats stats;
+			get_prefetch_stats(context->prefetcher, &stats);
+			stop_prefetcher(context->prefetcher);
+			context->prefetcher = start_prefetcher(context->image_path, context->part_info, context->part_offsets,
+				context->part->type, stats.max_depth, stats.byte_budget);
+		}
+
+		// direct reads are aligned to the sector size, which can differ between partitions
+		if (context->direct_reader)
+		{
+			close_direct_reader(context->direct_reader);
+			context->direct_reader = open_direct_reader(context->image_path, context->part_info->bytes_per_sector);
+			if (!context->direct_reader)
+				printf("Direct I/O is not available for this partition, it is off.\n");
+		}
+
+		context->current_dir = load_dir(context, context->part_offsets->root_dir, &context->dir_entries);
+		context->current_dir_offset = context->part_offsets->root_dir;
+		free_dir_names(context->dir_names);
+		context->dir_names = index_dir_names(context->current_dir, context->dir_entries);
 		while (context->pwd_level != 0)
 			pop_pwd(context);
 		calculate_pwd(context);
@@ -115,7 +279,7 @@ void list_directory(const FileManagerContext* context)
 		printf("No directory selected.\n");
 		return;
 	}
-	display_records(context->current_dir, &context->dir_entries);
+	display_records(context->current_dir, context->dir_names, &context->dir_entries);
 }
 
 void change_directory(FileManagerContext* context, char* arg)
@@ -126,19 +290,23 @@ void change_directory(FileManagerContext* context, char* arg)
 		return;
 	}
 
-	const FileRecord* dir = name_to_record(context->current_dir, context->dir_entries, arg);
+	const FileRecord* dir = name_to_record(context->current_dir, context->dir_names, arg);
 	if (dir)
 	{
 		if (dir->directory)
 		{	// get dir at cluster
-			const uint32_t dir_cluster_number = get_cluster_number(dir, context->part->type);
-			const uint32_t offset = get_cluster_offset(context->part_info, context->part_offsets, dir_cluster_number);
-			context->current_dir = get_dir(context->file, offset, &context->dir_entries);
-			if (strchr(arg, '.') == NULL)
+			const uint32_t dir_cluster_number = context->fat_ops->get_cluster_number(dir);
+			const uint64_t offset = get_cluster_offset(context->part_info, context->part_offsets, dir_cluster_number);
+			context->current_dir = load_dir(context, offset, &context->dir_entries);
+			context->current_dir_offset = offset;
+			free_dir_names(context->dir_names);
+			context->dir_names = index_dir_names(context->current_dir, context->dir_entries);
+			// the record tells . and .. apart, a long name may have dots of its own
+			if (dir->filename[0] != '.')
 			{
-				append_pwd(context, dir->filename);
+				append_pwd(context, get_short_filename(dir));
 			}
-			else
+			else if (dir->filename[1] == '.')
 			{	// subtract from pwd on cd ..
 				pop_pwd(context);
 			}
@@ -154,13 +322,13 @@ void change_directory(FileManagerContext* context, char* arg)
 void nested_change_directory(FileManagerContext* context, char* arg)
 {
 	/* get the first token */
-	const char separator = get_path_separator(arg);
-	const char* token = strtok(arg, &separator);
+	const char separator[2] = { get_path_separator(arg), '\0' };
+	const char* token = strtok(arg, separator);
 
 	while (token != NULL)
 	{
 		change_directory(context, token);
-		token = strtok(NULL, &separator);
+		token = strtok(NULL, separator);
 	}
 }
 
@@ -172,19 +340,50 @@ void cat_file(const FileManagerContext* context, const char* arg)
 		return;
 	}
 
-	const FileRecord* selected_file = name_to_record(context->current_dir, context->dir_entries, arg);
+	// cat <file> [offset length]
+	char* args = malloc(strlen(arg) + 1);
+	strcpy(args, arg);
+	char* tokens[3];
+	const size_t num_tokens = split_arguments(args, tokens, 3);
+	if (num_tokens != 1 && num_tokens != 3)
+	{
+		printf("Usage: cat <file> [offset length]\n\n");
+		free(args);
+		return;
+	}
+
+	const FileRecord* selected_file = name_to_record(context->current_dir, context->dir_names, tokens[0]);
 	if (!selected_file)
 	{
 		printf("Cannot find file!\n\n");
+		free(args);
 		return;
 	}
 
-	const uint32_t cluster_num = get_cluster_number(selected_file, context->part->type);
-
+	size_t offset = 0;
+	size_t length = selected_file->file_size;
+	if (num_tokens == 3 && !parse_range(selected_file->file_size, tokens[1], tokens[2], &offset, &length))
+	{
+		printf("Not a valid range.\n\n");
+		free(args);
+		return;
+	}
+	free(args);
 
-	const uint8_t* data = read_file(context->file, cluster_num, context->part_info,
-		context->part_offsets, context->part->type, selected_file->file_size);
-	printf("%s\n\n", (const char*)data);
+	// raw bytes go straight to stdout, only pad with a blank line for someone reading a terminal
+	// windows would turn every \n of the file into \r\n in text mode, so switch to binary for the data only
+#ifdef _WIN32
+	fflush(stdout);
+	const int text_mode = _setmode(_fileno(stdout), _O_BINARY);
+#endif
+	const bool streamed = stream_range(context, selected_file, offset, length, STDOUT_FILENO);
+#ifdef _WIN32
+	_setmode(_fileno(stdout), text_mode);
+#endif
+	if (!streamed)
+		printf("Could not read the whole file.\n");
+	if (is_terminal(STDOUT_FILENO))
+		printf("\n\n");
 }
 
 void display_pwd(const FileManagerContext* context)
@@ -198,6 +397,79 @@ void display_pwd(const FileManagerContext* context)
 
 }
 
+static size_t select_matches(const FileManagerContext* context, const char* pattern, bool* selected)
+{
+	size_t num_matches = 0;
+	for (size_t idx = 0; idx < context->dir_entries; idx++)
+	{
+		// a pattern can match either name of a file
+		const FileRecord* record = &context->current_dir[idx];
+		if (record->directory || record->volume_id)
+			continue;
+		const char* long_name = get_long_filename(context->dir_names, idx);
+		if (!match_pattern(pattern, get_short_filename(record)) && !(long_name && match_pattern(pattern, long_name)))
+			continue;
+		selected[idx] = true;
+		num_matches++;
+	}
+	if (num_matches == 0)
+		printf("No files match %s.\n", pattern);
+	return num_matches;
+}
+
+static void export_matches(const FileManagerContext* context, char** patterns, const size_t num_patterns,
+	const char* list_path)
+{
+	// a file matched by more than one pattern is still only exported once
+	bool* selected = calloc(context->dir_entries + 1, sizeof(bool));
+	for (size_t idx = 0; idx < num_patterns; idx++)
+		select_matches(context, patterns[idx], selected);
+
+	if (list_path)
+	{
+		FILE* list = fopen(list_path, "r");
+		if (!list)
+		{
+			printf("Could not open %s.\n\n", list_path);
+			free(selected);
+			return;
+		}
+		char line[256];
+		while (fgets(line, sizeof(line), list))
+		{
+			line[strcspn(line, "\r\n")] = '\0';
+			char* pattern = line;
+			while (*pattern == ' ')
+				pattern++;
+			if (pattern[0] != '\0')
+				select_matches(context, pattern, selected);
+		}
+		fclose(list);
+	}
+
+	size_t num_records = 0;
+	FileRecord* records = malloc((context->dir_entries + 1) * sizeof(FileRecord));
+	const char** file_names = malloc((context->dir_entries + 1) * sizeof(char*));
+	for (size_t idx = 0; idx < context->dir_entries; idx++)
+	{
+		if (!selected[idx])
+			continue;
+		file_names[num_records] = get_long_filename(context->dir_names, idx);
+		records[num_records++] = context->current_dir[idx];
+	}
+	free(selected);
+
+	if (num_records == 0)
+		printf("No files to export.\n\n");
+	else
+	{
+		const FatVolume volume = get_volume(context);
+		export_files(&volume, context->snapshot, records, file_names, num_records, ".");
+	}
+	free(file_names);
+	free(records);
+}
+
 void export_to_file(const FileManagerContext* context, const char* arg)
 {
 	if (!context->current_dir)
@@ -206,21 +478,551 @@ void export_to_file(const FileManagerContext* context, const char* arg)
 		return;
 	}
 
-	const FileRecord* selected_file = name_to_record(context->current_dir, context->dir_entries, arg);
+	// export [--range offset length] <file>
+	// export <file or pattern>... | --from-list <list file>
+	char* args = malloc(strlen(arg) + 1);
+	strcpy(args, arg);
+	char* tokens[MAX_EXPORT_PATTERNS];
+	const size_t num_tokens = split_arguments(args, tokens, MAX_EXPORT_PATTERNS);
+	const bool ranged = num_tokens == 4 && strcmp(tokens[0], "--range") == 0;
+	const bool from_list = num_tokens > 0 && strcmp(tokens[0], "--from-list") == 0;
+	if (num_tokens == 0 || (strcmp(tokens[0], "--range") == 0 && !ranged) || (from_list && num_tokens != 2))
+	{
+		printf("Usage: export [--range offset length] <file>\n");
+		printf("       export <file or pattern>...\n");
+		printf("       export --from-list <list file>\n\n");
+		free(args);
+		return;
+	}
+
+	// anything but a single exact name goes through one batched sweep
+	if (!ranged && (num_tokens > 1 || has_wildcards(tokens[0])))
+	{
+		if (from_list)
+			export_matches(context, NULL, 0, tokens[1]);
+		else
+			export_matches(context, tokens, num_tokens, NULL);
+		free(args);
+		return;
+	}
+
+	const FileRecord* selected_file = name_to_record(context->current_dir, context->dir_names, tokens[num_tokens - 1]);
 	if (!selected_file)
 	{
 		printf("Cannot find file!\n\n");
+		free(args);
+		return;
+	}
+
+	size_t offset = 0;
+	size_t length = selected_file->file_size;
+	if (ranged && !parse_range(selected_file->file_size, tokens[1], tokens[2], &offset, &length))
+	{
+		printf("Not a valid range.\n\n");
+		free(args);
+		return;
+	}
+	free(args);
+
+	// export txt file, under its long name when it has one that is safe to write
+	char* name = get_safe_filename(get_long_filename(context->dir_names, (size_t)(selected_file - context->current_dir)),
+		get_short_filename(selected_file));
+	FILE* export_file = fopen(name, "wb");
+
+	// the range goes through the same fixed buffer as cat, so memory stays flat however big the file is
+#ifdef _WIN32
+	const int fd = export_file ? _fileno(export_file) : -1;
+#else
+	const int fd = export_file ? fileno(export_file) : -1;
+#endif
+	if (fd < 0 || !stream_range(context, selected_file, offset, length, fd))
+		printf("Could not write %s.\n\n", name);
+	if (export_file)
+		fclose(export_file);
+	free(name);
+}
+
+void extract_all(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	// default to the working directory
+	while (*arg == ' ')
+		arg++;
+	const char* destination = arg[0] != '\0' ? arg : ".";
+
+	extract_volume(context->file, context->part_info, context->part_offsets, context->part->type, context->snapshot,
+		context->direct_reader, destination, stdout);
+}
+
+void build_index(FileManagerContext* context, char* arg)
+{
+	(void)arg;
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	close_snapshot(context->snapshot);
+	context->snapshot = open_snapshot(context->file, context->image_path, context->selected_part, context->part,
+		context->part_info, context->part_offsets, context->fat_table, context->num_fat_entries, true);
+	if (!context->snapshot)
+		return;
+
+	const SnapshotHeader* header = context->snapshot->header;
+	printf("Indexed %llu directories, %llu entries, %llu files in %llu extents.\n",
+		(unsigned long long)header->num_dirs, (unsigned long long)header->num_records,
+		(unsigned long long)header->num_files, (unsigned long long)header->num_extents);
+	printf("%llu of %llu clusters free, %llu bad.\n\n", (unsigned long long)header->free_clusters,
+		(unsigned long long)header->total_clusters, (unsigned long long)header->bad_clusters);
+}
+
+void check_partition(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	// check [threads], one per processor by default
+	while (*arg == ' ')
+		arg++;
+	int32_t num_threads = (int32_t)get_cpu_count();
+	if (arg[0] != '\0' && (string_to_int(arg, &num_threads) || num_threads < 1))
+	{
+		printf("Usage: check [threads]\n\n");
+		return;
+	}
+	// every thread holds two cluster bitmaps, more threads than processors only cost memory
+	if ((size_t)num_threads > get_cpu_count())
+		num_threads = (int32_t)get_cpu_count();
+
+	CheckReport report;
+	check_volume(context->file, context->part_info, context->part_offsets, context->part->type, context->snapshot,
+		(size_t)num_threads, stdout, &report);
+}
+
+static bool find_directory(const FileManagerContext* context, const char* path, uint64_t* offset, uint32_t* cluster)
+{
+	// paths start from the current directory, or from the root when they start with a separator
+	const uint32_t root_cluster = is_fat32(context->part->type) ? context->part_info->root_dir_first_cluster : 0;
+	const char separator[2] = { get_path_separator(path), '\0' };
+	const FileRecord* current = name_to_record(context->current_dir, context->dir_names, ".");
+	*offset = context->current_dir_offset;
+	*cluster = current ? context->fat_ops->get_cluster_number(current) : root_cluster;
+	if (path[0] == separator[0] || *cluster < 2)
+	{
+		*offset = context->part_offsets->root_dir;
+		*cluster = root_cluster;
+	}
+
+	char* tokens = malloc(strlen(path) + 1);
+	strcpy(tokens, path);
+	bool found = true;
+	for (const char* token = strtok(tokens, separator); token && found; token = strtok(NULL, separator))
+	{
+		if (strcmp(token, ".") == 0)
+			continue;
+
+		size_t num_entries = 0;
+		FileRecord* records = load_dir(context, *offset, &num_entries);
+		DirNames* names = index_dir_names(records, num_entries);
+		const FileRecord* dir = name_to_record(records, names, token);
+		found = dir && dir->directory;
+		if (found)
+		{
+			// .. in a top level directory points at cluster 0, the root
+			*cluster = context->fat_ops->get_cluster_number(dir);
+			*offset = *cluster < 2 ? context->part_offsets->root_dir :
+				get_cluster_offset(context->part_info, context->part_offsets, *cluster);
+			if (*cluster < 2)
+				*cluster = root_cluster;
+		}
+		free_dir_names(names);
+		free(records);
+	}
+	free(tokens);
+	return found;
+}
+
+static UsageTree* load_usage(const FileManagerContext* context, const char* path)
+{
+	if (!context->fat_table)
+	{
+		printf("Could not read FAT.\n\n");
+		return NULL;
+	}
+
+	uint64_t offset;
+	uint32_t cluster;
+	if (!find_directory(context, path, &offset, &cluster))
+	{
+		printf("Invalid directory.\n\n");
+		return NULL;
+	}
+
+	const FatVolume volume = get_volume(context);
+	UsageTree* tree = load_usage_tree(&volume, context->image_path, context->snapshot, offset, cluster, get_cpu_count());
+	if (!tree)
+		printf("Could not open %s.\n\n", context->image_path);
+	return tree;
+}
+
+void disk_usage(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	// du [-d depth] [path]
+	char* args = malloc(strlen(arg) + 1);
+	strcpy(args, arg);
+	char* tokens[4];
+	const size_t num_tokens = split_arguments(args, tokens, 4);
+	size_t max_depth = SIZE_MAX;
+	const char* path = "";
+	bool valid = true;
+	for (size_t idx = 0; idx < num_tokens && valid; idx++)
+	{
+		int32_t depth;
+		if (strcmp(tokens[idx], "-d") == 0)
+		{
+			valid = idx + 1 < num_tokens && !string_to_int(tokens[idx + 1], &depth) && depth >= 0;
+			max_depth = (size_t)depth;
+			idx++;
+		}
+		else if (path[0] == '\0')
+			path = tokens[idx];
+		else
+			valid = false;
+	}
+	if (!valid)
+	{
+		printf("Usage: du [-d depth] [path]\n\n");
+		free(args);
+		return;
+	}
+
+	UsageTree* tree = load_usage(context, path);
+	if (tree)
+		print_disk_usage(tree, max_depth, path[0] != '\0' ? path : ".", stdout);
+	free_usage_tree(tree);
+	free(args);
+}
+
+void display_tree(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	// tree [path]
+	while (*arg == ' ')
+		arg++;
+	if (strchr(arg, ' '))
+	{
+		printf("Usage: tree [path]\n\n");
+		return;
+	}
+
+	UsageTree* tree = load_usage(context, arg);
+	if (tree)
+		print_usage_tree(tree, arg[0] != '\0' ? arg : ".", stdout);
+	free_usage_tree(tree);
+}
+
+void find_files(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+
+	// find [-name pattern] [-size [+|-]n[K|M|G]] [-newer date] [-older date] [-attr RHSAD] [-type f|d]
+	char* args = malloc(strlen(arg) + 1);
+	strcpy(args, arg);
+	char* tokens[MAX_FIND_ARGUMENTS + 1];
+	const size_t num_tokens = split_arguments(args, tokens, MAX_FIND_ARGUMENTS + 1);
+	ColumnQuery query;
+	if (num_tokens > MAX_FIND_ARGUMENTS || !parse_column_query(tokens, num_tokens, &query))
+	{
+		printf("Usage: find [-name pattern] [-size [+|-]n[K|M|G]] [-newer yyyy-mm-dd] [-older yyyy-mm-dd] "
+			"[-attr RHSAD] [-type f|d]\n\n");
+		free(args);
+		return;
+	}
+
+	// walk the partition once, every later find only scans the columns
+	if (!context->columns)
+	{
+		const double start = get_time_ms();
+		context->columns = load_column_store(context->file, context->part_info, context->part_offsets,
+			context->part->type, context->snapshot, context->num_fat_entries);
+		printf("Loaded %zu entries in %.1f ms.\n", context->columns->num_entries, get_time_ms() - start);
+	}
+
+	const double start = get_time_ms();
+	size_t num_matches;
+	uint32_t* matches = run_column_query(context->columns, &query, &num_matches);
+	const double elapsed = get_time_ms() - start;
+	for (size_t idx = 0; idx < num_matches; idx++)
+	{
+		print_column_path(context->columns, matches[idx], stdout);
+		printf("\n");
+	}
+	printf("%zu of %zu entries matched in %.2f ms.\n\n", num_matches, context->columns->num_entries, elapsed);
+	free(matches);
+	free(args);
+}
+
+void diff_images(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+	if (!context->fat_table)
+	{
+		printf("Could not read FAT.\n\n");
+		return;
+	}
+
+	// diff <other image> [part num], the selected partition number by default
+	char* args = malloc(strlen(arg) + 1);
+	strcpy(args, arg);
+	char* tokens[3];
+	const size_t num_tokens = split_arguments(args, tokens, 3);
+	int32_t part_index = (int32_t)context->selected_part;
+	if (num_tokens < 1 || num_tokens > 2 ||
+		(num_tokens == 2 && (string_to_int(tokens[1], &part_index) || part_index < 0 || part_index > 3)))
+	{
+		printf("Usage: diff <other image> [part num]\n\n");
+		free(args);
+		return;
+	}
+
+	const FatVolume volume = get_volume(context);
+	DiffReport report;
+	diff_image(&volume, context->snapshot, tokens[0], (size_t)part_index, stdout, &report);
+	free(args);
+}
+
+RecoveryVolume get_recovery_volume(const FileManagerContext* context)
+{
+	// a partition larger than its filesystem has clusters past the end of the FAT, those are never looked up
+	uint32_t cluster_limit = get_cluster_limit(context->part, context->part_info, context->part_offsets);
+	if (cluster_limit > context->num_fat_entries)
+		cluster_limit = (uint32_t)context->num_fat_entries;
+	const RecoveryVolume volume = { context->file, context->image_path, context->part_info, context->part_offsets,
+		context->part->type, context->fat_ops, context->fat_table, cluster_limit };
+	return volume;
+}
+
+void undelete_file(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+	if (!context->fat_table)
+	{
+		printf("Could not read FAT.\n\n");
+		return;
+	}
+
+	// the live listing skips deleted entries, so read the directory again for them
+	size_t num_deleted = 0;
+	FileRecord* deleted = get_deleted_dir(context->file, context->current_dir_offset, &num_deleted);
+	const RecoveryVolume volume = get_recovery_volume(context);
+
+	// undelete with no name lists what can be recovered
+	while (*arg == ' ')
+		arg++;
+	if (arg[0] == '\0')
+	{
+		display_deleted_records(&volume, deleted, num_deleted);
+		printf("\n");
+		free(deleted);
+		return;
+	}
+
+	for (size_t idx = 0; idx < num_deleted; idx++)
+	{
+		if (!deleted[idx].volume_id && !deleted[idx].directory && strcmp(arg, get_deleted_filename(&deleted[idx])) == 0)
+		{
+			char* output_path = get_safe_filename(get_deleted_filename(&deleted[idx]), NULL);
+			if (recover_deleted(&volume, &deleted[idx], output_path))
+				printf("Recovered %s.\n\n", output_path);
+			free(output_path);
+			free(deleted);
+			return;
+		}
+	}
+	printf("Cannot find deleted file!\n\n");
+	free(deleted);
+}
+
+void carve_files(FileManagerContext* context, char* arg)
+{
+	if (!context->current_dir)
+	{
+		printf("No directory selected.\n\n");
+		return;
+	}
+	if (!context->fat_table)
+	{
+		printf("Could not read FAT.\n\n");
+		return;
+	}
+
+	// carve [dir] [threads]
+	char* tokens[2];
+	const size_t num_tokens = split_arguments(arg, tokens, 2);
+	int32_t num_threads = (int32_t)get_cpu_count();
+	if (num_tokens == 2 && (string_to_int(tokens[1], &num_threads) || num_threads < 1))
+	{
+		printf("Usage: carve [dir] [threads]\n\n");
+		return;
+	}
+	if ((size_t)num_threads > get_cpu_count())
+		num_threads = (int32_t)get_cpu_count();
+
+	const RecoveryVolume volume = get_recovery_volume(context);
+	carve_volume(&volume, (size_t)num_threads, num_tokens > 0 ? tokens[0] : "carved");
+}
+
+void set_direct_io(FileManagerContext* context, char* arg)
+{
+	if (arg[0] == ' ')
+		arg++;
+	if (arg[0] == '\0')
+	{
+		printf("Direct I/O is %s.\n\n", context->direct_reader ? "on" : "off");
+		return;
+	}
+	if (strcmp(arg, "off") == 0)
+	{
+		close_direct_reader(context->direct_reader);
+		context->direct_reader = NULL;
+		printf("Direct I/O is off.\n\n");
 		return;
 	}
-	const uint32_t cluster_num = get_cluster_number(selected_file, context->part->type);
+	if (strcmp(arg, "on") != 0)
+	{
+		printf("Usage: direct [on|off]\n\n");
+		return;
+	}
+	if (!context->part_info)
+	{
+		printf("No partition selected.\n\n");
+		return;
+	}
+
+	// sector size from the boot sector is where alignment starts, the reader widens it if the host needs more
+	if (!context->direct_reader)
+		context->direct_reader = open_direct_reader(context->image_path, context->part_info->bytes_per_sector);
+	if (context->direct_reader)
+		printf("Direct I/O is on, %zu byte alignment%s.\n\n", context->direct_reader->alignment,
+			context->direct_reader->huge_pages ? ", huge page buffers" : "");
+	else
+		printf("Direct I/O is off.\n\n");
+}
 
+void set_trace(FileManagerContext* context, char* arg)
+{
+	// trace [<file> | off]
+	// there is one trace per process, the context is only here because every command is handed one
+	(void)context;
+	while (*arg == ' ')
+		arg++;
+	if (arg[0] == '\0')
+		printf("Tracing is %s.\n\n", is_tracing() ? "on" : "off");
+	else if (strcmp(arg, "off") == 0)
+	{
+		if (is_tracing())
+			stop_trace();
+		else
+			printf("Tracing is off.\n");
+		printf("\n");
+	}
+	else if (strchr(arg, ' '))
+		printf("Usage: trace [<file> | off]\n\n");
+	else if (start_trace(arg))
+		printf("Tracing image reads to %s.\n\n", arg);
+	else
+		printf("\n");
+}
 
-	const uint8_t* data = read_file(context->file, cluster_num, context->part_info,
-		context->part_offsets, context->part->type, selected_file->file_size);
+void set_prefetch(FileManagerContext* context, char* arg)
+{
+	if (arg[0] == ' ')
+		arg++;
+	if (arg[0] == '\0')
+	{
+		if (!context->prefetcher)
+		{
+			printf("Prefetch is off.\n\n");
+			return;
+		}
+		PrefetchStats stats;
+		get_prefetch_stats(context->prefetcher, &stats);
+		const char* readable_size = get_human_readable_size(stats.cached_bytes);
+		printf("Prefetch is on, depth %zu, %zu directories (%s) cached, %zu hits, %zu misses.\n\n", stats.max_depth,
+			stats.num_cached, readable_size, stats.hits, stats.misses);
+		free((void*)readable_size);
+		return;
+	}
+	if (strcmp(arg, "off") == 0)
+	{
+		stop_prefetcher(context->prefetcher);
+		context->prefetcher = NULL;
+		printf("Prefetch is off.\n\n");
+		return;
+	}
+
+	// prefetch on | <depth> [budget KB]
+	char* tokens[3];
+	const size_t num_tokens = split_arguments(arg, tokens, 3);
+	int32_t max_depth = DEFAULT_PREFETCH_DEPTH;
+	int32_t budget_kb = DEFAULT_PREFETCH_BUDGET / 1024;
+	if (num_tokens > 2 || (strcmp(tokens[0], "on") != 0 && (string_to_int(tokens[0], &max_depth) || max_depth <= 0)) ||
+		(num_tokens == 2 && (string_to_int(tokens[1], &budget_kb) || budget_kb <= 0)))
+	{
+		printf("Usage: prefetch [on | off | <depth> [budget KB]]\n\n");
+		return;
+	}
+	if (!context->part_info)
+	{
+		printf("No partition selected.\n\n");
+		return;
+	}
+	if (context->snapshot)
+		printf("An index is loaded, directories already come from memory.\n");
+
+	stop_prefetcher(context->prefetcher);
+	context->prefetcher = start_prefetcher(context->image_path, context->part_info, context->part_offsets,
+		context->part->type, (size_t)max_depth, (size_t)budget_kb * 1024);
+	if (!context->prefetcher)
+	{
+		printf("Could not start prefetch.\n\n");
+		return;
+	}
+	printf("Prefetch is on, depth %d, %d KB budget.\n\n", max_depth, budget_kb);
 
-	// export txt file
-	FILE* export_file = fopen(get_short_filename(selected_file), "wb");
-	assert(export_file);
-	assert(fwrite(data, selected_file->file_size, 1, export_file));
-	assert(!fclose(export_file));
+	// get going on the directory we are already in
+	if (context->current_dir && !context->snapshot)
+		prefetch_children(context->prefetcher, context->current_dir, context->dir_entries);
 }
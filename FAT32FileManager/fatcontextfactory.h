@@ -1,19 +1,35 @@
 #pragma once
 #include "fatparser.h"
+#include "fatsnapshot.h"
+#include "fatchain.h"
+#include "fatprefetch.h"
+#include "fatcolumns.h"
 
 typedef struct FileManagerContext
 {
 	FILE *file;
+	char *image_path;
 	MBR *mbr;
 	Partition *part;
 	PartitionInfo *part_info;
 	PartitionLocations *part_offsets;
+	Snapshot *snapshot;
+	const FatOps *fat_ops;
+	uint8_t *fat_table;
+	size_t num_fat_entries;
+	ChainCache *chain_cache;
+	DirectReader *direct_reader;
+	Prefetcher *prefetcher;
 	FileRecord *current_dir;
+	DirNames *dir_names;
+	ColumnStore *columns;
+	uint64_t current_dir_offset;
 	uint32_t selected_part;
 	size_t dir_entries;
 	char *pwd;
 	char *pwd_chain[64];
 	size_t pwd_level;
+	bool interactive;
 } FileManagerContext;
 
 /**
@@ -63,3 +79,51 @@ void display_pwd(const FileManagerContext *context);
  * @brief Exportsss handler
  */
 void export_to_file(const FileManagerContext *context, const char *arg);
+/**
+ * @brief Extract-all handler
+ */
+void extract_all(FileManagerContext *context, char *arg);
+/**
+ * @brief Check handler
+ */
+void check_partition(FileManagerContext *context, char *arg);
+/**
+ * @brief Du handler
+ */
+void disk_usage(FileManagerContext *context, char *arg);
+/**
+ * @brief Tree handler
+ */
+void display_tree(FileManagerContext *context, char *arg);
+/**
+ * @brief Find handler
+ */
+void find_files(FileManagerContext *context, char *arg);
+/**
+ * @brief Diff handler
+ */
+void diff_images(FileManagerContext *context, char *arg);
+/**
+ * @brief Undelete handler
+ */
+void undelete_file(FileManagerContext *context, char *arg);
+/**
+ * @brief Carve handler
+ */
+void carve_files(FileManagerContext *context, char *arg);
+/**
+ * @brief Direct I/O handler
+ */
+void set_direct_io(FileManagerContext *context, char *arg);
+/**
+ * @brief Trace handler
+ */
+void set_trace(FileManagerContext *context, char *arg);
+/**
+ * @brief Prefetch handler
+ */
+void set_prefetch(FileManagerContext *context, char *arg);
+/**
+ * @brief Index handler
+ */
+void build_index(FileManagerContext *context, char *arg);
@@ -0,0 +1,149 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatdiff.h"
+#include "fatmount.h"
+#include "fatwalk.h"
+#include "fatwidth.h"
+#include "utilties.h"
+
+// size of the chunks both copies of a file are compared in
+#define COMPARE_CHUNK_SIZE (1024 * 1024)
+
+static bool same_chain(const FatVolume* volume, uint32_t cluster, const FatVolume* other, uint32_t other_cluster)
+{
+	// both chains have to visit the same clusters in the same order, a looped chain is cut off at the table size
+	for (size_t step = 0; step <= volume->num_fat_entries; step++)
+	{
+		if (cluster != other_cluster)
+			return false;
+		if (cluster < 2)
+			return true;
+		cluster = volume->ops->next_cluster(volume->fat_table, volume->num_fat_entries, cluster);
+		other_cluster = other->ops->next_cluster(other->fat_table, other->num_fat_entries, other_cluster);
+	}
+	return true;
+}
+
+static bool same_contents(const FatVolume* volume, ChainCache* cache, const FileRecord* record,
+	const FatVolume* other, ChainCache* other_cache, const FileRecord* other_record, uint8_t* buffers,
+	uint64_t* bytes_compared)
+{
+	ChainIndex* index = get_chain_index(cache, volume->ops->get_cluster_number(record));
+	ChainIndex* other_index = get_chain_index(other_cache, other->ops->get_cluster_number(other_record));
+
+	// stop at the first chunk that differs, a chunk either side cannot read counts as different
+	for (size_t offset = 0; offset < record->file_size; offset += COMPARE_CHUNK_SIZE)
+	{
+		size_t length = record->file_size - offset;
+		if (length > COMPARE_CHUNK_SIZE)
+			length = COMPARE_CHUNK_SIZE;
+		if (read_file_range(volume, index, record->file_size, offset, length, buffers) != length ||
+			read_file_range(other, other_index, other_record->file_size, offset, length, &buffers[COMPARE_CHUNK_SIZE]) != length)
+			return false;
+		*bytes_compared += length;
+		if (memcmp(buffers, &buffers[COMPARE_CHUNK_SIZE], length) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool same_attributes(const FileRecord* record, const FileRecord* other_record)
+{
+	return record->readonly == other_record->readonly && record->hidden == other_record->hidden &&
+		record->system == other_record->system && record->archive == other_record->archive;
+}
+
+bool diff_image(const FatVolume* volume, const Snapshot* snapshot, const char* other_path, const size_t part_index,
+	FILE* out, DiffReport* report)
+{
+	memset(report, 0, sizeof(DiffReport));
+	MountedImage other;
+	if (!mount_image(&other, other_path, part_index, out))
+		return false;
+
+	VolumeTree* tree = load_volume_tree(volume->fp, volume->part_info, volume->part_offsets, volume->part_type, snapshot,
+		volume->num_fat_entries, out);
+	VolumeTree* other_tree = load_volume_tree(other.fp, other.part_info, other.part_offsets, other.volume.part_type,
+		other.snapshot, other.volume.num_fat_entries, out);
+	const VolumeEntry** entries = sort_by_path(tree);
+	const VolumeEntry** other_entries = sort_by_path(other_tree);
+
+	ChainCache* cache = calloc(1, sizeof(ChainCache));
+	ChainCache* other_cache = calloc(1, sizeof(ChainCache));
+	uint8_t* buffers = malloc(2 * COMPARE_CHUNK_SIZE);
+
+	// walk both sorted lists side by side, a path only one side has was added or removed
+	size_t idx = 0;
+	size_t other_idx = 0;
+	while (idx < tree->num_entries || other_idx < other_tree->num_entries)
+	{
+		const int order = idx == tree->num_entries ? 1 : other_idx == other_tree->num_entries ? -1 :
+			strcmp(entries[idx]->path, other_entries[other_idx]->path);
+		if (order < 0)
+		{
+			fprintf(out, "removed   %s\n", entries[idx++]->path);
+			report->removed++;
+			continue;
+		}
+		if (order > 0)
+		{
+			fprintf(out, "added     %s\n", other_entries[other_idx++]->path);
+			report->added++;
+			continue;
+		}
+
+		const VolumeEntry* entry = entries[idx++];
+		const FileRecord* record = &entry->record;
+		const FileRecord* other_record = &other_entries[other_idx++]->record;
+
+		// the metadata settles most entries, contents are only read when it cannot
+		const char* reason = NULL;
+		if (record->directory != other_record->directory)
+			reason = "type";
+		else if (record->directory)
+			reason = NULL;
+		else if (record->file_size != other_record->file_size)
+			reason = "size";
+		else if (!same_attributes(record, other_record))
+			reason = "attributes";
+		else if (record->file_size != 0 && (record->time != other_record->time || record->date != other_record->date ||
+			!same_chain(volume, volume->ops->get_cluster_number(record),
+				&other.volume, other.volume.ops->get_cluster_number(other_record))))
+		{
+			report->compared++;
+			if (!same_contents(volume, cache, record, &other.volume, other_cache, other_record, buffers,
+				&report->bytes_compared))
+				reason = "contents";
+		}
+
+		if (reason)
+		{
+			fprintf(out, "modified  %s (%s)\n", entry->path, reason);
+			report->modified++;
+		}
+		else
+			report->unchanged++;
+	}
+
+	const char* readable_size = get_human_readable_size(report->bytes_compared);
+	fprintf(out, "%zu unchanged, %zu modified, %zu added, %zu removed.\n", report->unchanged, report->modified,
+		report->added, report->removed);
+	fprintf(out, "Read the contents of %zu files (%s) to tell.\n\n", report->compared, readable_size);
+	free((void*)readable_size);
+
+	free(buffers);
+	clear_chain_cache(cache);
+	clear_chain_cache(other_cache);
+	free(cache);
+	free(other_cache);
+	free(entries);
+	free(other_entries);
+	free_volume_tree(tree);
+	free_volume_tree(other_tree);
+	unmount_image(&other);
+	return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+#include "fatchain.h"
+
+typedef struct DiffReport
+{
+	size_t unchanged;
+	size_t modified;
+	size_t added;
+	size_t removed;
+	size_t compared;			// files whose contents had to be read to tell
+	uint64_t bytes_compared;
+} DiffReport;
+
+/**
+ * @brief Compare a volume with the same partition of another image, printing every entry that changed
+ *
+ * Entries are matched by path. Size, attributes, timestamps and the cluster chains in both FATs decide
+ * first, contents are only read from both images when the metadata is not enough to tell,
+ * like a rewritten file of the same size or one that was moved to other clusters.
+ *
+ * @param volume Volume to compare from, needs the FAT in memory
+ * @param snapshot Sidecar snapshot of the volume, may be NULL
+ * @param other_path Disk image to compare with, its own sidecar snapshot is used if it has one
+ * @param part_index Partition of the other image to compare with
+ * @param out Stream to print changes to
+ * @param report Totals of every class of entry
+ * @return true Both volumes were read
+ */
+bool diff_image(const FatVolume *volume, const Snapshot *snapshot, const char *other_path, const size_t part_index,
+				FILE *out, DiffReport *report);
@@ -0,0 +1,148 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatdirect.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// explicit huge pages are this size on every platform we run on
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+uint8_t* allocate_io_buffer(const size_t size, bool* huge_pages)
+{
+	// reserved huge pages first, they are often not configured so fall back to normal pages
+	*huge_pages = false;
+	const size_t huge_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	void* buffer = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buffer != MAP_FAILED)
+	{
+		*huge_pages = true;
+		return buffer;
+	}
+
+	buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		return NULL;
+	// transparent huge pages still save tlb misses on big buffers
+	madvise(buffer, size, MADV_HUGEPAGE);
+	return buffer;
+}
+
+void free_io_buffer(uint8_t* buffer, const size_t size, const bool huge_pages)
+{
+	if (!buffer)
+		return;
+	munmap(buffer, huge_pages ? (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE : size);
+}
+
+DirectReader* open_direct_reader(const char* path, const size_t sector_size)
+{
+	const int fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+	{
+		printf("Could not open %s for direct I/O: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	DirectReader* reader = calloc(1, sizeof(DirectReader));
+	reader->fd = fd;
+	reader->alignment = sector_size >= 512 ? sector_size : 512;
+	reader->buffer = allocate_io_buffer(DIRECT_BUFFER_SIZE, &reader->huge_pages);
+	if (!reader->buffer)
+	{
+		close(fd);
+		free(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+void close_direct_reader(DirectReader* reader)
+{
+	if (!reader)
+		return;
+	free_io_buffer(reader->buffer, DIRECT_BUFFER_SIZE, reader->huge_pages);
+	close(reader->fd);
+	free(reader);
+}
+
+bool direct_read(DirectReader* reader, uint64_t offset, size_t length, uint8_t* destination)
+{
+	while (length > 0)
+	{
+		const size_t alignment = reader->alignment;
+		ssize_t bytes_read;
+		size_t bytes_copied;
+
+		if ((uintptr_t)destination % alignment == 0 && offset % alignment == 0 && length >= alignment)
+		{
+			// whole sectors go straight into the caller's buffer
+			bytes_read = pread(reader->fd, destination, length - length % alignment, (off_t)offset);
+			bytes_copied = bytes_read > 0 ? (size_t)bytes_read : 0;
+		}
+		else
+		{
+			// widen to sector boundaries in the bounce buffer and copy out the part that was asked for
+			const size_t head = offset % alignment;
+			size_t span = (head + length + alignment - 1) / alignment * alignment;
+			if (span > DIRECT_BUFFER_SIZE)
+				span = DIRECT_BUFFER_SIZE;
+			bytes_read = pread(reader->fd, reader->buffer, span, (off_t)(offset - head));
+			bytes_copied = bytes_read > (ssize_t)head ? (size_t)bytes_read - head : 0;
+			if (bytes_copied > length)
+				bytes_copied = length;
+			memcpy(destination, &reader->buffer[head], bytes_copied);
+		}
+
+		if (bytes_read < 0 && errno == EINVAL && alignment < MAX_DIRECT_ALIGNMENT)
+		{
+			// the image sits on a filesystem with bigger blocks than the partition's sectors
+			reader->alignment *= 2;
+			continue;
+		}
+		if (bytes_copied == 0)
+			return false;
+
+		offset += bytes_copied;
+		length -= bytes_copied;
+		destination += bytes_copied;
+	}
+	return true;
+}
+
+#else
+
+uint8_t* allocate_io_buffer(const size_t size, bool* huge_pages)
+{
+	*huge_pages = false;
+	return malloc(size);
+}
+
+void free_io_buffer(uint8_t* buffer, const size_t size, const bool huge_pages)
+{
+	free(buffer);
+}
+
+DirectReader* open_direct_reader(const char* path, const size_t sector_size)
+{
+	printf("Direct I/O is not supported on this platform.\n");
+	return NULL;
+}
+
+void close_direct_reader(DirectReader* reader)
+{
+}
+
+bool direct_read(DirectReader* reader, uint64_t offset, size_t length, uint8_t* destination)
+{
+	return false;
+}
+
+#endif
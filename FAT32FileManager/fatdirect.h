@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// aligned bounce buffer used for reads that do not start or end on a sector, one huge page
+#define DIRECT_BUFFER_SIZE (2 * 1024 * 1024)
+// largest alignment tried when the filesystem holding the image rejects the sector size
+#define MAX_DIRECT_ALIGNMENT 4096
+
+/*
+ * Reads that bypass the page cache. O_DIRECT only accepts transfers whose offset, length and memory
+ * address are all multiples of the logical block size, so anything else is read whole-sector through
+ * the bounce buffer and copied out. Cluster runs start on a sector, which means in practice only the
+ * head of a ranged read and the tail of a file take that path.
+ */
+typedef struct DirectReader
+{
+	int fd;
+	size_t alignment;
+	uint8_t *buffer;
+	bool huge_pages;
+} DirectReader;
+
+/**
+ * @brief Open an image for direct reads
+ *
+ * @param path Disk image
+ * @param sector_size Bytes per sector from the boot sector, the starting alignment
+ * @return DirectReader* Reader, NULL if direct I/O is unavailable
+ */
+DirectReader *open_direct_reader(const char *path, size_t sector_size);
+/**
+ * @brief Close a direct reader
+ *
+ * @param reader Reader to close, may be NULL
+ */
+void close_direct_reader(DirectReader *reader);
+/**
+ * @brief Read bytes from the image without going through the page cache
+ *
+ * @param reader Direct reader
+ * @param offset Byte offset in the image
+ * @param length Number of bytes
+ * @param destination Where to put them, aligned memory lets whole sectors skip the bounce buffer
+ * @return bool False if the range could not be read
+ */
+bool direct_read(DirectReader *reader, uint64_t offset, size_t length, uint8_t *destination);
+/**
+ * @brief Allocate a page-aligned buffer for bulk reads, backed by huge pages where the system allows
+ *
+ * @param size Number of bytes
+ * @param huge_pages Set if the buffer got explicit huge pages
+ * @return uint8_t* Buffer, free with free_io_buffer
+ */
+uint8_t *allocate_io_buffer(size_t size, bool *huge_pages);
+/**
+ * @brief Free a buffer from allocate_io_buffer
+ *
+ * @param buffer Buffer to free, may be NULL
+ * @param size Size it was allocated with
+ * @param huge_pages Value allocate_io_buffer reported
+ */
+void free_io_buffer(uint8_t *buffer, size_t size, bool huge_pages);
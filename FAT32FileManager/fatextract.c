@@ -0,0 +1,514 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "fatextract.h"
+#include "fatwalk.h"
+#include "fatwidth.h"
+#include "utilties.h"
+#include "fattrace.h"
+
+// size of each of the two read windows used while sweeping the image
+#define SWEEP_WINDOW_SIZE (4 * 1024 * 1024)
+// gaps between extents up to this size are read through rather than seeked over
+#define MAX_READ_GAP (256 * 1024)
+// most output files we keep open at once
+#define MAX_OPEN_OUTPUTS 128
+
+typedef enum OutputState
+{
+	OUTPUT_NOT_CREATED = 0,
+	OUTPUT_OPEN,
+	OUTPUT_CLOSED
+} OutputState;
+
+typedef struct OutputFile
+{
+	FILE *file;
+	char *path;
+	OutputState state;
+	size_t bytes_left;
+} OutputFile;
+
+typedef struct WindowPiece
+{
+	size_t entry_idx;
+	size_t file_offset;
+	size_t window_offset;
+	size_t length;
+} WindowPiece;
+
+typedef struct SweepWindow
+{
+	uint8_t *buffer;
+	bool huge_pages;
+	WindowPiece *pieces;	// where each part of the window goes
+	size_t num_pieces;
+	size_t capacity;
+	bool full;				// read and waiting for the writer
+} SweepWindow;
+
+/*
+ * The image is swept with two windows: while the writer scatters one into the output files the reader
+ * fills the other. Only the writer touches the outputs, the windows are handed back and forth in turn.
+ */
+typedef struct SweepWriter
+{
+	mtx_t lock;
+	cnd_t changed;
+	SweepWindow windows[2];
+	bool done;				// the reader has no more windows to hand over
+	bool failed;			// an output could not be written, the reader stops
+	OutputFile *outputs;
+	FILE *out;				// where problems are reported
+	size_t open_ring[MAX_OPEN_OUTPUTS];
+	size_t num_open;
+	size_t ring_head;
+} SweepWriter;
+
+static int compare_extents(const void* a, const void* b)
+{
+	const FileExtent* lhs = a;
+	const FileExtent* rhs = b;
+	if (lhs->disk_offset < rhs->disk_offset) return -1;
+	if (lhs->disk_offset > rhs->disk_offset) return 1;
+	return 0;
+}
+
+static void append_extent(FileExtent** extents, size_t* num_extents, size_t* capacity, const size_t entry_idx,
+	const uint64_t disk_offset, const size_t file_offset, const size_t length)
+{
+	// merge with the previous extent when the data continues on disk
+	FileExtent* last = *num_extents ? &(*extents)[*num_extents - 1] : NULL;
+	if (last && last->entry_idx == entry_idx && last->disk_offset + last->length == disk_offset)
+	{
+		last->length += length;
+		return;
+	}
+
+	if (*num_extents == *capacity)
+	{
+		*capacity *= 2;
+		*extents = realloc(*extents, *capacity * sizeof(FileExtent));
+	}
+	FileExtent* extent = &(*extents)[*num_extents];
+	extent->disk_offset = disk_offset;
+	extent->file_offset = file_offset;
+	extent->length = length;
+	extent->entry_idx = entry_idx;
+	*num_extents += 1;
+}
+
+static size_t collect_extents(const VolumeTree* tree, const uint8_t* fat_table, const size_t num_fat_entries,
+	const PartitionInfo* part_info, const PartitionLocations* part_offsets, const PartitionType part_type,
+	const Snapshot* snapshot, FILE* out, FileExtent** extents_out)
+{
+	const FatOps* ops = get_fat_ops(part_type);
+	const size_t cluster_size = get_cluster_size(part_info);
+	size_t capacity = 256;
+	size_t num_extents = 0;
+	FileExtent* extents = malloc(capacity * sizeof(FileExtent));
+
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		const FileRecord* record = &tree->entries[idx].record;
+		if (record->directory || record->file_size == 0)
+			continue;
+
+		const uint32_t first_cluster = ops->get_cluster_number(record);
+		size_t file_offset = 0;
+
+		// the snapshot already has the chain as runs of clusters
+		size_t num_runs = 0;
+		const SnapshotExtent* runs = snapshot_get_extents(snapshot, first_cluster, &num_runs);
+		if (runs)
+		{
+			for (size_t run = 0; run < num_runs && file_offset < record->file_size; run++)
+			{
+				size_t length = (size_t)runs[run].num_clusters * cluster_size;
+				if (file_offset + length > record->file_size)
+					length = record->file_size - file_offset;
+				append_extent(&extents, &num_extents, &capacity, idx,
+					get_cluster_offset(part_info, part_offsets, runs[run].cluster), file_offset, length);
+				file_offset += length;
+			}
+		}
+		else if (fat_table)
+		{
+			// walk the chain, merging clusters that sit next to each other on disk into one extent
+			uint32_t cluster = first_cluster;
+			size_t steps = 0;
+			while (file_offset < record->file_size && cluster >= 2 && cluster < num_fat_entries && steps++ < num_fat_entries)
+			{
+				size_t length = cluster_size;
+				if (file_offset + length > record->file_size)
+					length = record->file_size - file_offset;
+				append_extent(&extents, &num_extents, &capacity, idx,
+					get_cluster_offset(part_info, part_offsets, cluster), file_offset, length);
+				file_offset += length;
+
+				cluster = ops->next_cluster(fat_table, num_fat_entries, cluster);
+			}
+		}
+
+		if (file_offset < record->file_size)
+			fprintf(out, "Warning: cluster chain of %s is shorter than its size.\n", tree->entries[idx].path);
+	}
+
+	*extents_out = extents;
+	return num_extents;
+}
+
+static FILE* get_output(SweepWriter* writer, const size_t idx)
+{
+	OutputFile* output = &writer->outputs[idx];
+	if (output->state == OUTPUT_OPEN)
+		return output->file;
+
+	// close the oldest handle if we are at the limit
+	if (writer->num_open == MAX_OPEN_OUTPUTS)
+	{
+		OutputFile* oldest = &writer->outputs[writer->open_ring[writer->ring_head]];
+		if (oldest->state == OUTPUT_OPEN)
+		{
+			fclose(oldest->file);
+			oldest->file = NULL;
+			oldest->state = OUTPUT_CLOSED;
+		}
+		writer->num_open -= 1;
+		writer->ring_head = (writer->ring_head + 1) % MAX_OPEN_OUTPUTS;
+	}
+
+	// reopening a file must not truncate what we already wrote
+	output->file = fopen(output->path, output->state == OUTPUT_NOT_CREATED ? "wb" : "r+b");
+	if (!output->file)
+		return NULL;
+	output->state = OUTPUT_OPEN;
+	writer->open_ring[(writer->ring_head + writer->num_open) % MAX_OPEN_OUTPUTS] = idx;
+	writer->num_open += 1;
+	return output->file;
+}
+
+static bool write_window(SweepWriter* writer, const SweepWindow* window)
+{
+	for (size_t idx = 0; idx < window->num_pieces; idx++)
+	{
+		const WindowPiece* piece = &window->pieces[idx];
+		OutputFile* output = &writer->outputs[piece->entry_idx];
+		FILE* file = get_output(writer, piece->entry_idx);
+		if (!file ||
+			seek_file(file, piece->file_offset) ||
+			fwrite(&window->buffer[piece->window_offset], 1, piece->length, file) != piece->length)
+		{
+			fprintf(writer->out, "Could not write %s.\n", output->path);
+			return false;
+		}
+
+		// close files as soon as their last byte is written
+		output->bytes_left -= piece->length;
+		if (output->bytes_left == 0)
+		{
+			fclose(output->file);
+			output->file = NULL;
+			output->state = OUTPUT_CLOSED;
+		}
+	}
+	return true;
+}
+
+static void finish_window(SweepWriter* writer, SweepWindow* window, const bool written)
+{
+	mtx_lock(&writer->lock);
+	window->full = false;
+	window->num_pieces = 0;
+	writer->failed |= !written;
+	cnd_broadcast(&writer->changed);
+	mtx_unlock(&writer->lock);
+}
+
+static int write_windows(void* arg)
+{
+	SweepWriter* writer = arg;
+	for (size_t turn = 0; ; turn ^= 1)
+	{
+		SweepWindow* window = &writer->windows[turn];
+		mtx_lock(&writer->lock);
+		while (!window->full && !writer->done)
+			cnd_wait(&writer->changed, &writer->lock);
+		const bool has_work = window->full;
+		mtx_unlock(&writer->lock);
+		if (!has_work)
+			return 0;
+
+		const bool written = write_window(writer, window);
+		finish_window(writer, window, written);
+		if (!written)
+			return 1;
+	}
+}
+
+static void add_piece(SweepWindow* window, const size_t entry_idx, const size_t file_offset, const size_t window_offset,
+	const size_t length)
+{
+	if (window->num_pieces == window->capacity)
+	{
+		window->capacity *= 2;
+		window->pieces = realloc(window->pieces, window->capacity * sizeof(WindowPiece));
+	}
+	WindowPiece* piece = &window->pieces[window->num_pieces++];
+	piece->entry_idx = entry_idx;
+	piece->file_offset = file_offset;
+	piece->window_offset = window_offset;
+	piece->length = length;
+}
+
+static bool sweep_extents(FILE* fp, DirectReader* direct, const FileExtent* extents, const size_t num_extents,
+	OutputFile* outputs, FILE* out, size_t* bytes_extracted)
+{
+	SweepWriter writer;
+	memset(&writer, 0, sizeof(SweepWriter));
+	writer.outputs = outputs;
+	writer.out = out;
+	mtx_init(&writer.lock, mtx_plain);
+	cnd_init(&writer.changed);
+	for (size_t idx = 0; idx < 2; idx++)
+	{
+		writer.windows[idx].buffer = allocate_io_buffer(SWEEP_WINDOW_SIZE, &writer.windows[idx].huge_pages);
+		writer.windows[idx].capacity = 64;
+		writer.windows[idx].pieces = malloc(writer.windows[idx].capacity * sizeof(WindowPiece));
+	}
+	// without a writer thread every window is written as soon as it is read
+	thrd_t thread;
+	const bool threaded = thrd_create(&thread, write_windows, &writer) == thrd_success;
+
+	// sweep the image once from front to back, scattering each window into the files it belongs to
+	bool success = true;
+	size_t ext_idx = 0;
+	size_t extent_done = 0;
+	uint64_t last_read_end = UINT64_MAX;
+	for (size_t turn = 0; ext_idx < num_extents; turn ^= 1)
+	{
+		SweepWindow* window = &writer.windows[turn];
+		mtx_lock(&writer.lock);
+		while (window->full && !writer.failed)
+			cnd_wait(&writer.changed, &writer.lock);
+		success = !writer.failed;
+		mtx_unlock(&writer.lock);
+		if (!success)
+			break;
+
+		// start at the next byte anybody wants, reading through small gaps until the window is full
+		const uint64_t window_start = extents[ext_idx].disk_offset + extent_done;
+		uint64_t window_end = window_start;
+		for (size_t idx = ext_idx; idx < num_extents && extents[idx].disk_offset <= window_end + MAX_READ_GAP; idx++)
+		{
+			const uint64_t extent_end = extents[idx].disk_offset + extents[idx].length;
+			if (extent_end > window_end)
+				window_end = extent_end;
+			if (window_end - window_start >= SWEEP_WINDOW_SIZE)
+			{
+				window_end = window_start + SWEEP_WINDOW_SIZE;
+				break;
+			}
+		}
+
+		const size_t read_size = (size_t)(window_end - window_start);
+		const uint64_t read_time = get_trace_time();
+		const bool read_failed = direct ? !direct_read(direct, window_start, read_size, window->buffer) :
+			(window_start != last_read_end && seek_file(fp, window_start)) ||
+			fread(window->buffer, 1, read_size, fp) != read_size;
+		if (read_failed)
+		{
+			fprintf(out, "Could not read image at offset %llu.\n", (unsigned long long)window_start);
+			success = false;
+			break;
+		}
+		trace_read(TRACE_SWEEP, window_start, read_size, read_time);
+		last_read_end = window_end;
+
+		// cross-linked extents can start before the window, they get a window of their own
+		while (ext_idx < num_extents)
+		{
+			const FileExtent* extent = &extents[ext_idx];
+			const uint64_t piece_start = extent->disk_offset + extent_done;
+			if (piece_start < window_start || piece_start >= window_end)
+				break;
+
+			const uint64_t window_left = window_end - piece_start;
+			const size_t length = extent->length - extent_done < window_left ? extent->length - extent_done : (size_t)window_left;
+			add_piece(window, extent->entry_idx, extent->file_offset + extent_done, (size_t)(piece_start - window_start), length);
+			*bytes_extracted += length;
+			extent_done += length;
+			if (extent_done < extent->length)
+				break;
+			ext_idx++;
+			extent_done = 0;
+		}
+
+		if (threaded)
+		{
+			mtx_lock(&writer.lock);
+			window->full = true;
+			cnd_broadcast(&writer.changed);
+			mtx_unlock(&writer.lock);
+		}
+		else
+		{
+			success = write_window(&writer, window);
+			finish_window(&writer, window, success);
+			if (!success)
+				break;
+		}
+	}
+
+	mtx_lock(&writer.lock);
+	writer.done = true;
+	cnd_broadcast(&writer.changed);
+	mtx_unlock(&writer.lock);
+	if (threaded)
+		thrd_join(thread, NULL);
+	success &= !writer.failed;
+
+	for (size_t idx = 0; idx < 2; idx++)
+	{
+		free_io_buffer(writer.windows[idx].buffer, SWEEP_WINDOW_SIZE, writer.windows[idx].huge_pages);
+		free(writer.windows[idx].pieces);
+	}
+	cnd_destroy(&writer.changed);
+	mtx_destroy(&writer.lock);
+	return success;
+}
+
+bool extract_volume(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, DirectReader* direct, const char* destination, FILE* out)
+{
+	// with a snapshot we already know every chain and can skip the FAT
+	size_t num_fat_entries = 0;
+	uint8_t* fat_table = NULL;
+	if (!snapshot)
+	{
+		fat_table = read_fat_table(fp, part_info, part_offsets, part_type, 0, &num_fat_entries);
+		if (!fat_table)
+		{
+			fprintf(out, "Could not read FAT.\n");
+			return false;
+		}
+	}
+
+	// the snapshot records how many clusters the FAT it was built from has
+	const size_t num_clusters = snapshot ? (size_t)snapshot->header->total_clusters + 2 : num_fat_entries;
+	VolumeTree* tree = load_volume_tree(fp, part_info, part_offsets, part_type, snapshot, num_clusters, out);
+	OutputFile* outputs = calloc(tree->num_entries + 1, sizeof(OutputFile));
+	bool success = true;
+
+	// recreate the directory layout first, empty files are created here too
+	make_directory(destination);
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		// parents come first, so each path is its parent's output path and this entry's name made safe to write
+		const VolumeEntry* entry = &tree->entries[idx];
+		const char* parent_path = entry->parent == SIZE_MAX ? destination : outputs[entry->parent].path;
+		char* name = get_safe_filename(get_short_filename(&entry->record), NULL);
+		outputs[idx].path = malloc(strlen(parent_path) + strlen(name) + 2);
+		sprintf(outputs[idx].path, "%s/%s", parent_path, name);
+		free(name);
+		outputs[idx].bytes_left = entry->record.directory ? 0 : entry->record.file_size;
+
+		if (entry->record.directory)
+		{
+			make_directory(outputs[idx].path);
+		}
+		else if (entry->record.file_size == 0)
+		{
+			FILE* empty_file = fopen(outputs[idx].path, "wb");
+			if (empty_file)
+				fclose(empty_file);
+			else
+				success = false;
+		}
+	}
+
+	FileExtent* extents = NULL;
+	const size_t num_extents = collect_extents(tree, fat_table, num_fat_entries, part_info, part_offsets, part_type, snapshot, out, &extents);
+	qsort(extents, num_extents, sizeof(FileExtent), compare_extents);
+
+	size_t bytes_extracted = 0;
+	success &= sweep_extents(fp, direct, extents, num_extents, outputs, out, &bytes_extracted);
+
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		if (outputs[idx].state == OUTPUT_OPEN)
+			fclose(outputs[idx].file);
+		free(outputs[idx].path);
+	}
+
+	const char* readable_size = get_human_readable_size(bytes_extracted);
+	fprintf(out, "Extracted %zu entries (%s in %zu extents) to %s\n\n", tree->num_entries, readable_size, num_extents, destination);
+	free((void*)readable_size);
+
+	free(extents);
+	free(outputs);
+	free_volume_tree(tree);
+	free(fat_table);
+	return success;
+}
+
+bool export_files(const FatVolume* volume, const Snapshot* snapshot, const FileRecord* records, const char** file_names,
+	const size_t num_records, const char* destination)
+{
+	// the files share one sweep, as if they were a volume of their own without directories
+	VolumeTree tree;
+	tree.num_entries = num_records;
+	tree.entries = calloc(num_records + 1, sizeof(VolumeEntry));
+	OutputFile* outputs = calloc(num_records + 1, sizeof(OutputFile));
+	bool success = true;
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		VolumeEntry* entry = &tree.entries[idx];
+		memcpy(&entry->record, &records[idx], sizeof(FileRecord));
+		entry->parent = SIZE_MAX;
+		// long names are used when they are safe to write, anything else falls back to the short name
+		char* name = get_safe_filename(file_names ? file_names[idx] : NULL, get_short_filename(&records[idx]));
+		entry->path = name;
+
+		outputs[idx].path = malloc(strlen(destination) + strlen(name) + 2);
+		sprintf(outputs[idx].path, "%s/%s", destination, name);
+		outputs[idx].bytes_left = records[idx].file_size;
+		if (records[idx].file_size == 0)
+		{
+			FILE* empty_file = fopen(outputs[idx].path, "wb");
+			if (empty_file)
+				fclose(empty_file);
+			else
+				success = false;
+		}
+	}
+
+	FileExtent* extents = NULL;
+	const size_t num_extents = collect_extents(&tree, volume->fat_table, volume->num_fat_entries, volume->part_info,
+		volume->part_offsets, volume->part_type, snapshot, stdout, &extents);
+	qsort(extents, num_extents, sizeof(FileExtent), compare_extents);
+
+	size_t bytes_exported = 0;
+	success &= sweep_extents(volume->fp, volume->direct, extents, num_extents, outputs, stdout, &bytes_exported);
+
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		if (outputs[idx].state == OUTPUT_OPEN)
+			fclose(outputs[idx].file);
+		free(outputs[idx].path);
+		free(tree.entries[idx].path);
+	}
+
+	const char* readable_size = get_human_readable_size(bytes_exported);
+	printf("Exported %zu files (%s in %zu extents) to %s\n\n", num_records, readable_size, num_extents, destination);
+	free((void*)readable_size);
+
+	free(extents);
+	free(outputs);
+	free(tree.entries);
+	return success;
+}
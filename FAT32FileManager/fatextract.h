@@ -0,0 +1,46 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+#include "fatdirect.h"
+#include "fatchain.h"
+
+typedef struct FileExtent
+{
+	uint64_t disk_offset;
+	size_t file_offset;
+	size_t length;
+	size_t entry_idx;
+} FileExtent;
+
+/**
+ * @brief Extract every file on the partition to a local directory in a single forward pass over the image
+ *
+ * @param fp Disk image
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param part_type Partition filesystem type
+ * @param snapshot Sidecar snapshot to take directories and extents from, may be NULL
+ * @param direct Read file data with direct I/O, may be NULL
+ * @param destination Local directory to extract into
+ * @param out Stream to print progress and problems to
+ * @return true All files were written
+ */
+bool extract_volume(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+					const PartitionType part_type, const Snapshot *snapshot, DirectReader *direct,
+					const char *destination, FILE *out);
+/**
+ * @brief Export a batch of files with the same single sweep as extract-all, reads ordered by disk offset
+ *
+ * @param volume Volume the files are on, its in-memory FAT is used for chains the snapshot does not have
+ * @param snapshot Sidecar snapshot to take extents from, may be NULL
+ * @param records Files to export, directories must not be included
+ * @param file_names Name to write each file under, may be NULL or hold NULL for the short name
+ * @param num_records Number of files
+ * @param destination Local directory to write the files into
+ * @return true All files were written
+ */
+bool export_files(const FatVolume *volume, const Snapshot *snapshot, const FileRecord *records, const char **file_names,
+				  size_t num_records, const char *destination);
@@ -0,0 +1,461 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fatfleet.h"
+#include "fatmount.h"
+#include "fatwalk.h"
+#include "fatcheck.h"
+#include "fatextract.h"
+#include "fattrace.h"
+#include "utilties.h"
+#include "workpool.h"
+
+// size of the chunks files are hashed in
+#define HASH_CHUNK_SIZE (1024 * 1024)
+// longest line of the image list
+#define MAX_LIST_LINE 4096
+
+static const char* command_names[] = { "ls", "hash", "check", "export" };
+
+typedef struct FleetJob
+{
+	char *image_path;
+	size_t list_idx;		// position of the image in the list, blank lines are not counted
+	size_t disk;			// into FleetShared.disk_jobs
+	bool started;
+	bool success;
+	uint64_t bytes_read;
+	double elapsed_ms;
+} FleetJob;
+
+typedef struct FleetShared
+{
+	size_t part_index;
+	FleetCommand command;
+	bool recursive;
+	const char *destination;
+	size_t per_disk;
+
+	mtx_t lock;
+	mtx_t print_lock;	// held while a finished image is copied to stdout, apart from the scheduler
+	cnd_t wake;
+	FleetJob *jobs;
+	size_t num_jobs;
+	size_t next_job;		// every job before this one has started
+	size_t *disk_jobs;		// jobs running on each disk
+	size_t num_failed;
+	uint64_t bytes_read;
+} FleetShared;
+
+typedef struct FleetWorker
+{
+	WorkRange range;
+	FleetShared *shared;
+} FleetWorker;
+
+typedef struct FileOrder
+{
+	uint32_t cluster;
+	size_t entry_idx;
+} FileOrder;
+
+static int compare_clusters(const void* a, const void* b)
+{
+	const FileOrder* order_a = a;
+	const FileOrder* order_b = b;
+	return (order_a->cluster > order_b->cluster) - (order_a->cluster < order_b->cluster);
+}
+
+static VolumeTree* load_root_listing(const MountedImage* image)
+{
+	// only the root directory, with the same entries the full walk would give it
+	VolumeTree* tree = calloc(1, sizeof(VolumeTree));
+	size_t capacity = 64;
+	tree->entries = malloc(capacity * sizeof(VolumeEntry));
+
+	size_t num_records = 0;
+	FileRecord* records = snapshot_get_dir(image->snapshot, image->part_offsets->root_dir, &num_records);
+	if (!records)
+		records = get_dir(image->fp, image->part_offsets->root_dir, &num_records);
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		if (records[idx].volume_id)
+			continue;
+		if (records[idx].directory && records[idx].filename[0] == '.')
+			continue;
+		append_volume_entry(tree, &capacity, &records[idx], SIZE_MAX);
+	}
+	free(records);
+	return tree;
+}
+
+static bool list_image(const FleetShared* shared, const MountedImage* image, FILE* out)
+{
+	VolumeTree* tree = shared->recursive ? load_volume_tree(image->fp, image->part_info, image->part_offsets,
+		image->volume.part_type, image->snapshot, image->volume.num_fat_entries, out) : load_root_listing(image);
+	const VolumeEntry** sorted = sort_by_path(tree);
+
+	fprintf(out, "%-8s%-9s%15s%22s  %s\n", "Type", "Attrib", "Size", "Date Modified", "Path");
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		const FileRecord* record = &sorted[idx]->record;
+		const char* readable_size = record->directory ? NULL : get_human_readable_size(record->file_size);
+		char* date_time_string = get_date_time(record);
+		fprintf(out, "%-8s%-9s%15s%22s  %s\n", record->directory ? "<DIR>" : "", get_file_attributes(record),
+			readable_size ? readable_size : "", date_time_string, sorted[idx]->path);
+		free(date_time_string);
+		free((void*)readable_size);
+	}
+	fprintf(out, "%zu entries.\n", tree->num_entries);
+
+	free(sorted);
+	free_volume_tree(tree);
+	return true;
+}
+
+static bool hash_image(const MountedImage* image, FILE* out)
+{
+	VolumeTree* tree = load_volume_tree(image->fp, image->part_info, image->part_offsets, image->volume.part_type,
+		image->snapshot, image->volume.num_fat_entries, out);
+
+	// hash the files in the order their data starts on disk so the image is read mostly forward
+	FileOrder* order = malloc((tree->num_entries + 1) * sizeof(FileOrder));
+	size_t num_files = 0;
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		if (tree->entries[idx].record.directory)
+			continue;
+		order[num_files].cluster = image->volume.ops->get_cluster_number(&tree->entries[idx].record);
+		order[num_files].entry_idx = idx;
+		num_files++;
+	}
+	qsort(order, num_files, sizeof(FileOrder), compare_clusters);
+
+	ChainCache* cache = calloc(1, sizeof(ChainCache));
+	uint8_t* buffer = malloc(HASH_CHUNK_SIZE);
+	uint64_t* hashes = calloc(tree->num_entries + 1, sizeof(uint64_t));
+	bool success = true;
+	for (size_t idx = 0; idx < num_files; idx++)
+	{
+		const VolumeEntry* entry = &tree->entries[order[idx].entry_idx];
+		ChainIndex* index = get_chain_index(cache, order[idx].cluster);
+		uint64_t hash = 0;
+		for (size_t offset = 0; offset < entry->record.file_size; offset += HASH_CHUNK_SIZE)
+		{
+			size_t length = entry->record.file_size - offset;
+			if (length > HASH_CHUNK_SIZE)
+				length = HASH_CHUNK_SIZE;
+			if (read_file_range(&image->volume, index, entry->record.file_size, offset, length, buffer) != length)
+			{
+				fprintf(out, "Could not read %s.\n", entry->path);
+				success = false;
+				break;
+			}
+			hash = hash_buffer(buffer, length, hash);
+		}
+		hashes[order[idx].entry_idx] = hash;
+	}
+
+	// print them by path so the same volume always hashes to the same output
+	const VolumeEntry** sorted = sort_by_path(tree);
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+	{
+		if (!sorted[idx]->record.directory)
+			fprintf(out, "%016llx  %s\n", (unsigned long long)hashes[sorted[idx] - tree->entries], sorted[idx]->path);
+	}
+	fprintf(out, "%zu files.\n", num_files);
+
+	free(sorted);
+	free(hashes);
+	free(buffer);
+	clear_chain_cache(cache);
+	free(cache);
+	free(order);
+	free_volume_tree(tree);
+	return success;
+}
+
+static bool export_image(const FleetShared* shared, const MountedImage* image, const FleetJob* job, FILE* out)
+{
+	// every image gets a directory named after its place in the list and its file name,
+	// images of the same name in different directories would otherwise share one
+	const char* name = job->image_path;
+	for (const char* cursor = job->image_path; *cursor; cursor++)
+	{
+		if (*cursor == '/' || *cursor == '\\')
+			name = cursor + 1;
+	}
+	char* destination = malloc(strlen(shared->destination) + strlen(name) + 32);
+	sprintf(destination, "%s/%zu-%s", shared->destination, job->list_idx, name);
+
+	const bool success = extract_volume(image->fp, image->part_info, image->part_offsets, image->volume.part_type,
+		image->snapshot, NULL, destination, out);
+	free(destination);
+	return success;
+}
+
+static void run_job(const FleetShared* shared, FleetJob* job, FILE* out)
+{
+	const double start = get_time_ms();
+	const uint64_t bytes_before = get_thread_read_bytes();
+
+	MountedImage image;
+	job->success = mount_image(&image, job->image_path, shared->part_index, out);
+	if (job->success)
+	{
+		CheckReport report;
+		switch (shared->command)
+		{
+		case FLEET_LS:
+			job->success = list_image(shared, &image, out);
+			break;
+		case FLEET_HASH:
+			job->success = hash_image(&image, out);
+			break;
+		case FLEET_CHECK:
+			job->success = check_volume(image.fp, image.part_info, image.part_offsets, image.volume.part_type,
+				image.snapshot, 1, out, &report);
+			break;
+		case FLEET_EXPORT:
+			job->success = export_image(shared, &image, job, out);
+			break;
+		}
+		unmount_image(&image);
+	}
+
+	// every read of the job happened on this thread
+	job->bytes_read = get_thread_read_bytes() - bytes_before;
+	job->elapsed_ms = get_time_ms() - start;
+}
+
+static void print_job(const FleetJob* job, FILE* out)
+{
+	printf("==> %s <==\n", job->image_path);
+	if (out != stdout)
+	{
+		char buffer[64 * 1024];
+		size_t length;
+		rewind(out);
+		while ((length = fread(buffer, 1, sizeof(buffer), out)) > 0)
+			fwrite(buffer, 1, length, stdout);
+	}
+
+	const char* readable_size = get_human_readable_size(job->bytes_read);
+	printf("%s: %s, read %s in %.2f s\n\n", job->image_path, job->success ? "done" : "failed", readable_size,
+		job->elapsed_ms / 1000.0);
+	free((void*)readable_size);
+	fflush(stdout);
+}
+
+static size_t pick_job(FleetShared* shared)
+{
+	// the job on the least busy disk wins, list order breaks ties
+	size_t best = SIZE_MAX;
+	for (size_t idx = shared->next_job; idx < shared->num_jobs; idx++)
+	{
+		const FleetJob* job = &shared->jobs[idx];
+		if (job->started || shared->disk_jobs[job->disk] >= shared->per_disk)
+			continue;
+		if (best == SIZE_MAX || shared->disk_jobs[job->disk] < shared->disk_jobs[shared->jobs[best].disk])
+			best = idx;
+		if (shared->disk_jobs[job->disk] == 0)
+			break;
+	}
+	return best;
+}
+
+static int run_jobs(void* arg)
+{
+	FleetWorker* worker = arg;
+	FleetShared* shared = worker->shared;
+
+	mtx_lock(&shared->lock);
+	while (shared->next_job < shared->num_jobs)
+	{
+		// every job left is on a disk that is already busy enough, wait for one to finish
+		const size_t job_idx = pick_job(shared);
+		if (job_idx == SIZE_MAX)
+		{
+			cnd_wait(&shared->wake, &shared->lock);
+			continue;
+		}
+		FleetJob* job = &shared->jobs[job_idx];
+		job->started = true;
+		shared->disk_jobs[job->disk]++;
+		while (shared->next_job < shared->num_jobs && shared->jobs[shared->next_job].started)
+			shared->next_job++;
+		mtx_unlock(&shared->lock);
+
+		// without a temporary file the output goes straight to stdout and may mix with other images
+		FILE* out = tmpfile();
+		run_job(shared, job, out ? out : stdout);
+
+		mtx_lock(&shared->lock);
+		shared->disk_jobs[job->disk]--;
+		shared->bytes_read += job->bytes_read;
+		if (!job->success)
+			shared->num_failed++;
+		cnd_broadcast(&shared->wake);
+		mtx_unlock(&shared->lock);
+
+		// a long listing takes a while to copy, only the print lock keeps two images from interleaving
+		// so other workers can pick their next image meanwhile
+		mtx_lock(&shared->print_lock);
+		print_job(job, out ? out : stdout);
+		mtx_unlock(&shared->print_lock);
+		if (out)
+			fclose(out);
+		mtx_lock(&shared->lock);
+	}
+	mtx_unlock(&shared->lock);
+	return 0;
+}
+
+static FleetJob* read_image_list(const char* list_path, size_t* num_jobs)
+{
+	FILE* list = fopen(list_path, "r");
+	if (!list)
+	{
+		printf("Could not open %s.\n", list_path);
+		return NULL;
+	}
+
+	size_t capacity = 64;
+	FleetJob* jobs = malloc(capacity * sizeof(FleetJob));
+	*num_jobs = 0;
+	char line[MAX_LIST_LINE];
+	while (fgets(line, sizeof(line), list))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		char* path = line;
+		while (*path == ' ')
+			path++;
+		if (path[0] == '\0')
+			continue;
+
+		if (*num_jobs == MAX_FLEET_IMAGES)
+		{
+			printf("%s lists more than %d images.\n", list_path, MAX_FLEET_IMAGES);
+			for (size_t idx = 0; idx < *num_jobs; idx++)
+				free(jobs[idx].image_path);
+			free(jobs);
+			fclose(list);
+			return NULL;
+		}
+		if (*num_jobs == capacity)
+		{
+			capacity *= 2;
+			jobs = realloc(jobs, capacity * sizeof(FleetJob));
+		}
+		FleetJob* job = &jobs[*num_jobs];
+		memset(job, 0, sizeof(FleetJob));
+		job->image_path = malloc(strlen(path) + 1);
+		strcpy(job->image_path, path);
+		job->list_idx = *num_jobs;
+		*num_jobs += 1;
+	}
+	fclose(list);
+	return jobs;
+}
+
+static size_t assign_disks(FleetJob* jobs, const size_t num_jobs)
+{
+	// images on the same device share a disk, one we cannot stat gets a disk of its own
+	uint64_t* devices = malloc((num_jobs + 1) * sizeof(uint64_t));
+	bool* known = malloc((num_jobs + 1) * sizeof(bool));
+	size_t num_disks = 0;
+	for (size_t idx = 0; idx < num_jobs; idx++)
+	{
+		struct stat info;
+		const bool found = stat(jobs[idx].image_path, &info) == 0;
+		const uint64_t device = found ? (uint64_t)info.st_dev : 0;
+		size_t disk = 0;
+		while (disk < num_disks && !(found && known[disk] && devices[disk] == device))
+			disk++;
+		if (disk == num_disks)
+		{
+			devices[num_disks] = device;
+			known[num_disks] = found;
+			num_disks++;
+		}
+		jobs[idx].disk = disk;
+	}
+	free(known);
+	free(devices);
+	return num_disks;
+}
+
+bool parse_fleet_command(const char* name, FleetCommand* command)
+{
+	for (size_t idx = 0; idx < sizeof(command_names) / sizeof(command_names[0]); idx++)
+	{
+		if (strcmp(name, command_names[idx]) == 0)
+		{
+			*command = (FleetCommand)idx;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool run_fleet(const char* list_path, const size_t part_index, const FleetCommand command, const bool recursive,
+	const char* destination, size_t num_threads, const size_t per_disk)
+{
+	FleetShared shared;
+	memset(&shared, 0, sizeof(FleetShared));
+	shared.jobs = read_image_list(list_path, &shared.num_jobs);
+	if (!shared.jobs)
+		return false;
+	if (shared.num_jobs == 0)
+	{
+		printf("No images in %s.\n", list_path);
+		free(shared.jobs);
+		return false;
+	}
+
+	shared.part_index = part_index;
+	shared.command = command;
+	shared.recursive = recursive;
+	shared.destination = destination;
+	shared.per_disk = per_disk;
+	shared.disk_jobs = calloc(assign_disks(shared.jobs, shared.num_jobs) + 1, sizeof(size_t));
+	mtx_init(&shared.lock, mtx_plain);
+	mtx_init(&shared.print_lock, mtx_plain);
+	cnd_init(&shared.wake);
+	if (command == FLEET_EXPORT)
+		make_directory(destination);
+
+	if (num_threads > shared.num_jobs)
+		num_threads = shared.num_jobs;
+	FleetWorker* workers = calloc(num_threads, sizeof(FleetWorker));
+	for (size_t idx = 0; idx < num_threads; idx++)
+		workers[idx].shared = &shared;
+
+	const double start = get_time_ms();
+	run_parallel(workers, sizeof(FleetWorker), num_threads, run_jobs, 0, num_threads);
+	const double elapsed = get_time_ms() - start;
+
+	const char* readable_size = get_human_readable_size(shared.bytes_read);
+	printf("Ran %s on %zu images (%zu failed) with %zu threads, at most %zu per disk, in %.2f s\n",
+		command_names[command], shared.num_jobs, shared.num_failed, num_threads, per_disk, elapsed / 1000.0);
+	printf("Read %s at %.1f MB/s, %.1f images/s\n", readable_size,
+		(double)shared.bytes_read / (1024.0 * 1024.0) / (elapsed / 1000.0), (double)shared.num_jobs * 1000.0 / elapsed);
+	free((void*)readable_size);
+
+	const bool success = shared.num_failed == 0;
+	for (size_t idx = 0; idx < shared.num_jobs; idx++)
+		free(shared.jobs[idx].image_path);
+	free(workers);
+	free(shared.disk_jobs);
+	free(shared.jobs);
+	cnd_destroy(&shared.wake);
+	mtx_destroy(&shared.print_lock);
+	mtx_destroy(&shared.lock);
+	return success;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+// most images one fleet run takes from its list, a longer list is refused
+#define MAX_FLEET_IMAGES 65536
+
+typedef enum FleetCommand
+{
+	FLEET_LS = 0,		// every entry of the partition with its attributes, size and date
+	FLEET_HASH,			// a content hash of every file
+	FLEET_CHECK,		// the consistency check
+	FLEET_EXPORT		// extract every file into a directory per image
+} FleetCommand;
+
+/**
+ * @brief Look up a fleet command by name
+ *
+ * @param name ls, hash, check or export
+ * @param command Output for the command
+ * @return true The name is a command
+ */
+bool parse_fleet_command(const char *name, FleetCommand *command);
+/**
+ * @brief Run one command over every image of a list on a bounded pool of threads
+ *
+ * Images are mounted by the worker that runs them and write to an output of their own, which is printed
+ * in one piece when the image is done. A shared scheduler hands the next image to whichever worker is free,
+ * preferring images on the disk with the fewest jobs running and never running more than a set number of
+ * jobs on one disk. The run ends with totals and the aggregate read throughput.
+ *
+ * @param list_path File listing one image per line
+ * @param part_index Partition to mount in every image
+ * @param command Command to run on each image
+ * @param recursive List every directory of the partition for ls instead of only the root
+ * @param destination Directory the export command writes a directory per image into, named by list position and
+ * image file name
+ * @param num_threads Number of worker threads
+ * @param per_disk Most images read from one disk at a time
+ * @return true The command succeeded on every image
+ */
+bool run_fleet(const char *list_path, const size_t part_index, const FleetCommand command, const bool recursive,
+			   const char *destination, const size_t num_threads, const size_t per_disk);
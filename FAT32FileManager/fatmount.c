@@ -0,0 +1,69 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatmount.h"
+#include "fatwidth.h"
+#include "fattrace.h"
+
+bool mount_image(MountedImage* image, const char* path, const size_t part_index, FILE* out)
+{
+	memset(image, 0, sizeof(MountedImage));
+	image->fp = fopen(path, "rb");
+	if (!image->fp)
+	{
+		fprintf(out, "Could not open %s.\n\n", path);
+		return false;
+	}
+	const uint64_t read_time = get_trace_time();
+	if (fread(&image->mbr, sizeof(MBR), 1, image->fp) != 1 || !check_valid_part_index(&image->mbr, part_index))
+	{
+		fprintf(out, "%s has no partition %zu.\n\n", path, part_index);
+		unmount_image(image);
+		return false;
+	}
+	trace_read(TRACE_MBR, 0, sizeof(MBR), read_time);
+
+	const Partition* part = &image->mbr.partitions[part_index];
+	const FatOps* ops = get_fat_ops(part->type);
+	size_t sector_size;
+	image->part_info = get_part_info(image->fp, part, &sector_size);
+	if (!ops || !image->part_info)
+	{
+		fprintf(out, "Could not read partition boot sector of %s.\n\n", path);
+		unmount_image(image);
+		return false;
+	}
+	image->part_offsets = get_part_offsets(part, image->part_info, sector_size);
+
+	size_t num_fat_entries = 0;
+	image->fat_table = read_fat_table(image->fp, image->part_info, image->part_offsets, part->type, 0, &num_fat_entries);
+	if (!image->fat_table)
+	{
+		fprintf(out, "Could not read FAT of %s.\n\n", path);
+		unmount_image(image);
+		return false;
+	}
+
+	// directories come from the image's own index when it has a current one
+	image->snapshot = open_snapshot(image->fp, path, part_index, part, image->part_info, image->part_offsets,
+		image->fat_table, num_fat_entries, false);
+
+	const FatVolume volume = { image->fp, image->part_info, image->part_offsets, part->type, ops, image->fat_table,
+		num_fat_entries, NULL };
+	image->volume = volume;
+	return true;
+}
+
+void unmount_image(MountedImage* image)
+{
+	close_snapshot(image->snapshot);
+	free(image->fat_table);
+	free(image->part_offsets);
+	free(image->part_info);
+	if (image->fp)
+		fclose(image->fp);
+	memset(image, 0, sizeof(MountedImage));
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+#include "fatchain.h"
+
+// an image opened and mounted outside of the interactive context
+typedef struct MountedImage
+{
+	FILE *fp;
+	MBR mbr;
+	PartitionInfo *part_info;
+	PartitionLocations *part_offsets;
+	uint8_t *fat_table;
+	Snapshot *snapshot;
+	FatVolume volume;
+} MountedImage;
+
+/**
+ * @brief Open an image and mount one of its partitions with the FAT in memory
+ *
+ * The sidecar snapshot of the partition is picked up if the image has a current one.
+ *
+ * @param image Image to fill in
+ * @param path Disk image to open
+ * @param part_index Partition to mount
+ * @param out Stream to report why the image could not be mounted to
+ * @return true The partition is mounted, nothing is left open otherwise
+ */
+bool mount_image(MountedImage *image, const char *path, const size_t part_index, FILE *out);
+/**
+ * @brief Release everything a mounted image holds
+ *
+ * @param image Image to release
+ */
+void unmount_image(MountedImage *image);
@@ -7,14 +7,16 @@
 #include <string.h>
 
 #include "fatparser.h"
+#include "fatwidth.h"
 #include "utilties.h"
+#include "fattrace.h"
 
 
 const char* get_file_attributes(const FileRecord* record)
 {
 	// check if file is (D)ir, (A)rch, (V)ol ID, (S)ystem, (H)idden, (R)ead-only, or LFN
 	// return human readable string
-	static char description[7] = { 0 };
+	static _Thread_local char description[7] = { 0 };
 	strcpy(description, "------");
 
 	if (record->directory) description[1] = 'D';
@@ -44,21 +46,20 @@ const char* get_file_attributes(const FileRecord* record)
 
 const char* get_short_filename(const FileRecord* record)
 {
-	// make sure there are no trailing spaces, and string is null terminated
-	// then return short filename
-	static char full_filename[13];
-	memset(full_filename, 0, sizeof(full_filename));
-
-	remove_trailing_spaces(record->filename);
-	strncat(full_filename, record->filename, 8);
-
-	remove_trailing_spaces(record->extension);
-
-	if (record->extension[0] != '\0')
+	// stop each part at its first space or null character, the record itself is left alone
+	// then return short filename, every thread has its own buffer so volumes can be walked side by side
+	static _Thread_local char full_filename[13];
+	size_t length = 0;
+	for (size_t idx = 0; idx < sizeof(record->filename) && record->filename[idx] != '\0' && record->filename[idx] != ' '; idx++)
+		full_filename[length++] = (char)record->filename[idx];
+
+	if (record->extension[0] != '\0' && record->extension[0] != ' ')
 	{
-		strcat(full_filename, ".");
-		strncat(full_filename, (const char*)record->extension, 3);
+		full_filename[length++] = '.';
+		for (size_t idx = 0; idx < sizeof(record->extension) && record->extension[idx] != '\0' && record->extension[idx] != ' '; idx++)
+			full_filename[length++] = (char)record->extension[idx];
 	}
+	full_filename[length] = '\0';
 	return full_filename;
 }
 
@@ -77,46 +78,70 @@ bool check_valid_part(const Partition* part)
 bool check_valid_part_index(const MBR* mbr, const size_t index)
 {
 	// make sure the index selected is something we can parse
-	if (check_valid_part(&mbr->partitions[index]) &&
-		mbr->partitions[index].type != FAT32_CHS &&
-		mbr->partitions[index].type != FAT12)
+	if (check_valid_part(&mbr->partitions[index]))
 		return true;
 	return false;
 }
 
-PartitionInfo* get_part_info(FILE* fp, const Partition* part)
+bool is_fat32(const PartitionType part_type)
 {
-	// read partition boot record
+	// CHS or LBA only changes how the MBR addresses the partition, not the filesystem
+	return part_type == FAT32_LBA || part_type == FAT32_CHS;
+}
+
+PartitionInfo* get_part_info(FILE* fp, const Partition* part, size_t* sector_size)
+{
+	// read partition boot record, the MBR counts in the disk's sectors which are only usually 512 bytes,
+	// so take the first size whose boot sector agrees that is its sector size
 	PartitionInfo* part_info = calloc(1, sizeof(PartitionInfo));
-	assert(!fseek(fp, part->lba_offset * SECTOR_SIZE + 0x0b, SEEK_SET));
-	assert(fread(part_info, sizeof(uint8_t), sizeof(PartitionInfo), fp));
+	for (*sector_size = SECTOR_SIZE; *sector_size <= MAX_SECTOR_SIZE; *sector_size *= 2)
+	{
+		const uint64_t read_time = get_trace_time();
+		if (seek_file(fp, (uint64_t)part->lba_offset * *sector_size + 0x0b) ||
+			fread(part_info, sizeof(uint8_t), sizeof(PartitionInfo), fp) != sizeof(PartitionInfo))
+			break;
+		trace_read(TRACE_PART_INFO, (uint64_t)part->lba_offset * *sector_size + 0x0b, sizeof(PartitionInfo), read_time);
+		if (part_info->bytes_per_sector == *sector_size)
+			return part_info;
+	}
+
+	// none agree, take the boot sector where a 512 byte disk would have it, the partition starts there too
+	*sector_size = SECTOR_SIZE;
+	const uint64_t read_time = get_trace_time();
+	if (seek_file(fp, (uint64_t)part->lba_offset * SECTOR_SIZE + 0x0b) ||
+		fread(part_info, sizeof(uint8_t), sizeof(PartitionInfo), fp) != sizeof(PartitionInfo) ||
+		part_info->bytes_per_sector == 0 || part_info->sectors_per_cluster == 0)
+	{
+		free(part_info);
+		return NULL;
+	}
+	trace_read(TRACE_PART_INFO, (uint64_t)part->lba_offset * SECTOR_SIZE + 0x0b, sizeof(PartitionInfo), read_time);
 	return part_info;
 }
 
-PartitionLocations* get_part_offsets(const Partition* part, PartitionInfo* part_info)
+PartitionLocations* get_part_offsets(const Partition* part, PartitionInfo* part_info, const size_t sector_size)
 {
 	// based on FAT type, calculate the offsets needed 
 	PartitionLocations* part_offsets = calloc(1, sizeof(PartitionLocations));
-	part_offsets->FAT[0] = (size_t)part_info->reserved_sector_count * part_info->bytes_per_sector;
+	part_offsets->FAT[0] = (uint64_t)part_info->reserved_sector_count * part_info->bytes_per_sector;
 
 	part_offsets->data_dir = 0;
 	part_offsets->root_dir = 0;
 
-	if (part->type == FAT16_LBA || part->type == FAT16_B)
+	// FAT16 keeps a fixed root directory between the FATs and the data region, FAT32 does not
+	const FatOps* ops = get_fat_ops(part->type);
+	if (ops)
 	{
-		part_offsets->FAT[1] = part_offsets->FAT[0] + (size_t)part_info->fat16_table_size * part_info->bytes_per_sector;
-		part_offsets->root_dir = part_offsets->FAT[1] + (size_t)part_info->fat16_table_size * part_info->bytes_per_sector;
-
-		part_offsets->data_dir = part_info->root_dir_entries * 32;
+		const uint64_t fat_size = (uint64_t)ops->get_fat_sectors(part_info) * part_info->bytes_per_sector;
+		part_offsets->FAT[1] = part_offsets->FAT[0] + fat_size;
+		part_offsets->root_dir = part_offsets->FAT[1] + fat_size;
+		part_offsets->data_dir = ops->get_root_dir_size(part_info);
 	}
-	else if (part->type == FAT32_LBA)
-	{
-		part_offsets->FAT[1] = part_offsets->FAT[0] + (size_t)part_info->fat32_table_size * part_info->bytes_per_sector;
-		part_offsets->root_dir = part_offsets->FAT[1] + (size_t)part_info->fat32_table_size * part_info->bytes_per_sector;
-	}
-	part_offsets->FAT[0] += (size_t)part->lba_offset * part_info->bytes_per_sector;
-	part_offsets->FAT[1] += (size_t)part->lba_offset * part_info->bytes_per_sector;
-	part_offsets->root_dir += (size_t)part->lba_offset * part_info->bytes_per_sector;
+	part_offsets->sector_size = sector_size;
+	const uint64_t part_start = get_part_start(part, sector_size);
+	part_offsets->FAT[0] += part_start;
+	part_offsets->FAT[1] += part_start;
+	part_offsets->root_dir += part_start;
 
 	part_offsets->data_dir += part_offsets->root_dir;
 
@@ -124,27 +149,107 @@ PartitionLocations* get_part_offsets(const Partition* part, PartitionInfo* part_
 	return part_offsets;
 }
 
-uint32_t get_cluster_offset(const PartitionInfo* part_info, const PartitionLocations* part_offsets, uint32_t cluster_number)
+uint64_t get_part_start(const Partition* part, const size_t sector_size)
+{
+	return (uint64_t)part->lba_offset * sector_size;
+}
+
+uint64_t get_cluster_offset(const PartitionInfo* part_info, const PartitionLocations* part_offsets, uint32_t cluster_number)
 {
 	// used to convert cluster to fseek offset using FAT algorithm
 	// 0 is root dir
 	if (cluster_number == 0)
 		return part_offsets->root_dir;
-	return part_offsets->data_dir + ((cluster_number - 2) * part_info->sectors_per_cluster * part_info->bytes_per_sector);
+	return part_offsets->data_dir + (uint64_t)(cluster_number - 2) * part_info->sectors_per_cluster * part_info->bytes_per_sector;
 }
 
 uint32_t get_cluster_number(const FileRecord* record, const PartitionType part_type)
 {
 	// read record and return cluster number using proper bytes based on type
-	return part_type == FAT32_LBA ? (record->first_cluster_hi << 16) | (record->first_cluster_lo) : record->first_cluster_lo;
+	return is_fat32(part_type) ? (record->first_cluster_hi << 16) | (record->first_cluster_lo) : record->first_cluster_lo;
 }
 
-FileRecord* get_dir(FILE* fp, const size_t offset, size_t* num_entries)
+size_t get_cluster_size(const PartitionInfo* part_info)
+{
+	return (size_t)part_info->bytes_per_sector * part_info->sectors_per_cluster;
+}
+
+uint32_t get_cluster_limit(const Partition* part, const PartitionInfo* part_info, const PartitionLocations* part_offsets)
+{
+	// clusters are numbered from 2, the data region runs to the end of the partition
+	const uint64_t part_end = ((uint64_t)part->lba_offset + part->sector_count) * part_offsets->sector_size;
+	if (part_end <= part_offsets->data_dir)
+		return 2;
+	return (uint32_t)((part_end - part_offsets->data_dir) / get_cluster_size(part_info) + 2);
+}
+
+uint8_t* read_fat_table(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const size_t fat_index, size_t* num_fat_entries)
+{
+	// read one whole FAT copy so chains can be followed without a seek per link
+	const FatOps* ops = get_fat_ops(part_type);
+	*num_fat_entries = 0;
+	if (!ops)
+		return NULL;
+
+	const size_t fat_bytes = ops->get_fat_sectors(part_info) * part_info->bytes_per_sector;
+	uint8_t* fat_table = malloc(fat_bytes);
+	if (!fat_table)
+		return NULL;
+
+	const uint64_t read_time = get_trace_time();
+	if (seek_file(fp, part_offsets->FAT[fat_index]) ||
+		fread(fat_table, 1, fat_bytes, fp) != fat_bytes)
+	{
+		free(fat_table);
+		return NULL;
+	}
+	trace_read(TRACE_FAT_TABLE, part_offsets->FAT[fat_index], fat_bytes, read_time);
+
+	return ops->decode_fat(fat_table, fat_bytes, num_fat_entries);
+}
+
+uint32_t get_fat_entry(const uint8_t* fat_table, const PartitionType part_type, const uint32_t cluster_number)
+{
+	// FAT32 only uses the low 28 bits of an entry, FAT12 tables are already unpacked to 16 bits
+	if (is_fat32(part_type))
+		return ((const uint32_t*)fat_table)[cluster_number] & 0x0FFFFFFF;
+	return ((const uint16_t*)fat_table)[cluster_number];
+}
+
+bool is_end_of_chain(const uint32_t fat_entry, const PartitionType part_type)
+{
+	// anything in the reserved/bad/EOC range stops the chain, as does a free or reserved link
+	if (fat_entry < 2)
+		return true;
+	if (is_fat32(part_type))
+		return fat_entry >= 0x0FFFFFF0;
+	return part_type == FAT12 ? fat_entry >= 0x0FF0 : fat_entry >= 0xFFF0;
+}
+
+static void terminate_short_name(FileRecord* record)
+{
+	// make sure everything is null terminated, long name fragments keep their UTF-16 characters
+	if (is_long_name_entry(record))
+		return;
+
+	unsigned char* fn_end = memchr(record->filename, ' ', sizeof(record->filename));
+	if (fn_end)
+		*fn_end = '\0';
+
+	unsigned char* ext_end = memchr(record->extension, ' ', sizeof(record->extension));
+	if (ext_end)
+		*ext_end = '\0';
+}
+
+static FileRecord* read_dir(FILE* fp, const uint64_t offset, size_t* num_entries, const bool deleted)
 {
-	assert(!fseek(fp, offset, SEEK_SET));
 	*num_entries = 0;
 	// start with 4 records
 	FileRecord* records = calloc(4, sizeof(FileRecord));
+	const uint64_t read_time = get_trace_time();
+	if (seek_file(fp, offset))
+		return records;
 
 	FileRecord tmp_record;
 
@@ -155,16 +260,10 @@ FileRecord* get_dir(FILE* fp, const size_t offset, size_t* num_entries)
 		// if 0, we have reached end of dir
 		if (tmp_record.filename[0] != 0x00)
 		{
-			if (tmp_record.filename[0] != 0xE5)	// this means file was deleted
+			// 0xE5 means file was deleted, only keep the kind of entry we were asked for
+			if ((tmp_record.filename[0] == 0xE5) == deleted)
 			{
-				// make sure everything is null terminated
-				char* fn_end = strchr(tmp_record.filename, ' ');
-				if (fn_end)
-					*fn_end = '\0';
-
-				char* ext_end = strchr(tmp_record.extension, ' ');
-				if (ext_end)
-					*ext_end = '\0';
+				terminate_short_name(&tmp_record);
 
 				// if we loop around to a new directory in a cluster directly after the one we are reading
 				// break
@@ -174,6 +273,9 @@ FileRecord* get_dir(FILE* fp, const size_t offset, size_t* num_entries)
 				memcpy(&records[*num_entries], &tmp_record, sizeof(FileRecord));
 				*num_entries += 1;
 			}
+			else if (tmp_record.filename[0] == '.' && tmp_record.filename[1] == ' ' && tmp_record.directory &&
+				tell_file(fp) - offset > sizeof(FileRecord))
+				break;	// same wrap around check as above while skipping live entries
 		}
 		else
 			break;
@@ -183,69 +285,45 @@ FileRecord* get_dir(FILE* fp, const size_t offset, size_t* num_entries)
 			records = (FileRecord*)realloc(records, sizeof(FileRecord) * (*num_entries + 4));
 		}
 	}
+	trace_read(deleted ? TRACE_GET_DELETED_DIR : TRACE_GET_DIR, offset, (size_t)(tell_file(fp) - offset), read_time);
 	return records;
 }
 
-uint8_t* read_file(const FILE* fp, const uint32_t start_cluster_number, const PartitionInfo* part_info,
-	const PartitionLocations* part_offsets, const PartitionType part_type, const size_t file_size)
+FileRecord* get_dir(FILE* fp, const uint64_t offset, size_t* num_entries)
 {
-	const size_t fat_entry_size = part_type == FAT32_LBA ? 4 : 2;
-	const size_t end_of_chain = part_type == FAT32_LBA ? 0xFFFFFFF0 : 0xFFF0;
-
-	// num cluster chain steps needed to follow
-	const size_t cluster_max_len = file_size / (part_info->bytes_per_sector * part_info->sectors_per_cluster);
-
-	// enough to store first entry and chain
-	uint32_t* cluster_chain = malloc((cluster_max_len + 1) * sizeof(uint32_t));
-	cluster_chain[0] = start_cluster_number;	// set first element to given cluster
-
-	// follow cluster chain only if we have more than 1 cluster
-	if (cluster_max_len > 0)
-	{
-		uint32_t next_cluster = 0;
-		size_t idx = 1;
-
-		// see to first cluster
-		assert(!fseek(fp, part_offsets->FAT[0] + start_cluster_number * fat_entry_size, SEEK_SET));
-
-		while (true)
-		{
-			assert(fread(&next_cluster, fat_entry_size, 1, fp));
-			assert(!fseek(fp, part_offsets->FAT[0] + next_cluster * fat_entry_size, SEEK_SET));
-			if (next_cluster >= end_of_chain) break; // make sure we haven't reached EOF
-			cluster_chain[idx] = next_cluster;
-			idx++;
-		}
+	return read_dir(fp, offset, num_entries, false);
+}
 
-	}
+FileRecord* get_deleted_dir(FILE* fp, const uint64_t offset, size_t* num_entries)
+{
+	return read_dir(fp, offset, num_entries, true);
+}
 
-	// allocate enough space for the data (read entire file)
-	uint8_t* data = calloc(1, file_size + 1);
-	const size_t cluster_size = part_info->bytes_per_sector * part_info->sectors_per_cluster;
+FileRecord* parse_dir(const uint8_t* buffer, const size_t length, size_t* num_entries)
+{
+	// same rules as get_dir, but bounded by the buffer rather than reading until the terminator
+	const size_t max_entries = length / sizeof(FileRecord);
+	FileRecord* records = calloc(max_entries + 1, sizeof(FileRecord));
+	*num_entries = 0;
 
-	size_t current_byte_offset = 0;	// offset into data
-	for (size_t idx = 0; idx < cluster_max_len + 1; idx++)	// idx = idx of cluster chain
+	for (size_t idx = 0; idx < max_entries; idx++)
 	{
-		assert(!fseek(fp, get_cluster_offset(part_info, part_offsets, cluster_chain[idx]), SEEK_SET));
+		FileRecord* record = &records[*num_entries];
+		memcpy(record, &buffer[idx * sizeof(FileRecord)], sizeof(FileRecord));
 
-		if (idx == cluster_max_len)
-		{
-			assert(fread(&data[current_byte_offset], file_size % cluster_size, 1, fp));
+		// if 0, we have reached end of dir
+		if (record->filename[0] == 0x00)
 			break;
-		}
+		if (record->filename[0] == 0xE5)	// this means file was deleted
+			continue;
 
-		assert(fread(&data[current_byte_offset], cluster_size, 1, fp));
-		current_byte_offset += cluster_size;
+		terminate_short_name(record);
+		*num_entries += 1;
 	}
-	data[file_size] = 0;
-
-	free(cluster_chain);
-
-	return data;
-
+	return records;
 }
 
-void display_partition_info(const MBR* mbr)
+void display_partition_info(FILE* fp, const MBR* mbr)
 {
 	// print info about partitions on MBR
 	printf("%10s%10s%12s%12s%12s%13s\n", "Part", "Boot", "Start", "End", "Size", "Type");
@@ -255,9 +333,12 @@ void display_partition_info(const MBR* mbr)
 
 		if (check_valid_part(&part))
 		{
-			const char* size = get_human_readable_size(part.sector_count * SECTOR_SIZE);
-			const char* start = get_human_readable_size(part.lba_offset * SECTOR_SIZE);
-			const char* end = get_human_readable_size(part.lba_offset * SECTOR_SIZE + part.sector_count * SECTOR_SIZE - 1);
+			// the MBR counts in the sector size the boot sector is found with, same as when mounting
+			size_t sector_size = SECTOR_SIZE;
+			free(get_part_info(fp, &part, &sector_size));
+			const char* size = get_human_readable_size((uint64_t)part.sector_count * sector_size);
+			const char* start = get_human_readable_size((uint64_t)part.lba_offset * sector_size);
+			const char* end = get_human_readable_size(((uint64_t)part.lba_offset + part.sector_count) * sector_size - 1);
 			char type[16];
 			switch (part.type)
 			{
@@ -271,10 +352,10 @@ void display_partition_info(const MBR* mbr)
 				strcpy(type, "*FAT16_B");
 				break;
 			case FAT32_CHS:
-				strcpy(type, "FAT32_CHS");
+				strcpy(type, "*FAT32_CHS");
 				break;
 			case FAT12:
-				strcpy(type, "FAT12");
+				strcpy(type, "*FAT12");
 				break;
 			default:
 				strcpy(type, "INVALID");
@@ -287,6 +368,215 @@ void display_partition_info(const MBR* mbr)
 	}
 }
 
+bool is_long_name_entry(const FileRecord* record)
+{
+	// read-only, hidden, system and volume label all at once never happens on a real entry
+	return record->readonly && record->hidden && record->system && record->volume_id;
+}
+
+static uint8_t get_short_name_checksum(const FileRecord* record)
+{
+	// get_dir cut the name at its first space, the checksum is over the padded name as stored on disk
+	const uint8_t* raw_name = record->filename;
+	uint8_t checksum = 0;
+	for (size_t idx = 0; idx < sizeof(record->filename) + sizeof(record->extension); idx++)
+		checksum = (uint8_t)(((checksum & 1) << 7) + (checksum >> 1) + (raw_name[idx] == '\0' ? ' ' : raw_name[idx]));
+	return checksum;
+}
+
+static size_t append_name(DirNames* names, size_t* capacity, size_t* used, const char* name, const size_t length)
+{
+	while (*used + length + 1 > *capacity)
+	{
+		*capacity *= 2;
+		names->storage = realloc(names->storage, *capacity);
+	}
+	const size_t offset = *used;
+	memcpy(&names->storage[offset], name, length);
+	names->storage[offset + length] = '\0';
+	*used += length + 1;
+	return offset;
+}
+
+static size_t encode_utf8(const uint16_t* units, const size_t num_units, char* output)
+{
+	// a long name ends at a null character or the 0xFFFF padding after it
+	size_t length = 0;
+	for (size_t idx = 0; idx < num_units && units[idx] != 0x0000 && units[idx] != 0xFFFF; idx++)
+	{
+		uint32_t code_point = units[idx];
+		if (code_point >= 0xD800 && code_point < 0xDC00 && idx + 1 < num_units &&
+			units[idx + 1] >= 0xDC00 && units[idx + 1] < 0xE000)
+		{
+			code_point = 0x10000 + ((code_point - 0xD800) << 10) + (units[idx + 1] - 0xDC00);
+			idx++;
+		}
+		else if (code_point >= 0xD800 && code_point < 0xE000)
+			code_point = 0xFFFD;	// half of a surrogate pair on its own
+
+		if (code_point < 0x80)
+			output[length++] = (char)code_point;
+		else if (code_point < 0x800)
+		{
+			output[length++] = (char)(0xC0 | (code_point >> 6));
+			output[length++] = (char)(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			output[length++] = (char)(0xE0 | (code_point >> 12));
+			output[length++] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			output[length++] = (char)(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			output[length++] = (char)(0xF0 | (code_point >> 18));
+			output[length++] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+			output[length++] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			output[length++] = (char)(0x80 | (code_point & 0x3F));
+		}
+	}
+	return length;
+}
+
+static char fold_case(const char character)
+{
+	// FAT compares names without case, only ASCII letters have a case we know how to fold
+	return character >= 'a' && character <= 'z' ? (char)(character - 'a' + 'A') : character;
+}
+
+static uint64_t hash_name(const char* name)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (; *name; name++)
+	{
+		hash ^= (uint8_t)fold_case(*name);
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static bool equal_names(const char* name_a, const char* name_b)
+{
+	for (; *name_a && fold_case(*name_a) == fold_case(*name_b); name_a++, name_b++)
+		;
+	return *name_a == *name_b;
+}
+
+static void insert_name(DirNames* names, const char* name, const size_t idx)
+{
+	size_t slot = hash_name(name) & names->slot_mask;
+	while (names->slots[slot] != 0)
+		slot = (slot + 1) & names->slot_mask;
+	names->slots[slot] = idx + 1;
+}
+
+DirNames* index_dir_names(const FileRecord* records, const size_t num_records)
+{
+	DirNames* names = calloc(1, sizeof(DirNames));
+	names->num_records = num_records;
+	names->short_names = malloc((num_records + 1) * sizeof(size_t));
+	names->long_names = malloc((num_records + 1) * sizeof(size_t));
+	size_t capacity = 16 * num_records + 64;
+	size_t used = 0;
+	names->storage = malloc(capacity);
+
+	// fragments come last part first, each one numbered down to 1 and followed by the short entry they name
+	uint16_t units[MAX_LFN_ENTRIES * LFN_CHARS_PER_ENTRY];
+	char utf8_name[MAX_LFN_ENTRIES * LFN_CHARS_PER_ENTRY * 3 + 1];
+	uint8_t expected_ordinal = 0;
+	uint8_t checksum = 0;
+	size_t num_units = 0;
+	bool complete = false;
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		const FileRecord* record = &records[idx];
+		names->short_names[idx] = SIZE_MAX;
+		names->long_names[idx] = SIZE_MAX;
+
+		if (is_long_name_entry(record))
+		{
+			const uint8_t* raw = (const uint8_t*)record;
+			const uint8_t ordinal = raw[0] & 0x1F;
+			if (raw[0] & 0x40)
+			{
+				expected_ordinal = ordinal <= MAX_LFN_ENTRIES ? ordinal : 0;
+				checksum = raw[13];
+				num_units = (size_t)ordinal * LFN_CHARS_PER_ENTRY;
+			}
+			complete = false;
+			if (expected_ordinal == 0 || ordinal != expected_ordinal || raw[13] != checksum)
+			{
+				expected_ordinal = 0;
+				continue;
+			}
+
+			// the 13 characters are spread over three runs of the entry
+			static const uint8_t char_offsets[LFN_CHARS_PER_ENTRY] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+			for (size_t unit = 0; unit < LFN_CHARS_PER_ENTRY; unit++)
+				units[(ordinal - 1) * LFN_CHARS_PER_ENTRY + unit] =
+					(uint16_t)(raw[char_offsets[unit]] | (raw[char_offsets[unit] + 1] << 8));
+			expected_ordinal--;
+			complete = expected_ordinal == 0;
+			continue;
+		}
+		if (record->volume_id)
+		{
+			complete = false;
+			continue;
+		}
+
+		const char* short_name = get_short_filename(record);
+		names->short_names[idx] = append_name(names, &capacity, &used, short_name, strlen(short_name));
+		if (complete && checksum == get_short_name_checksum(record))
+		{
+			const size_t length = encode_utf8(units, num_units, utf8_name);
+			if (length > 0)
+				names->long_names[idx] = append_name(names, &capacity, &used, utf8_name, length);
+		}
+		complete = false;
+		expected_ordinal = 0;
+	}
+
+	// two names per entry at most, keep the table at most half full
+	size_t num_slots = 16;
+	while (num_slots < 4 * num_records)
+		num_slots *= 2;
+	names->slots = calloc(num_slots, sizeof(size_t));
+	names->slot_mask = num_slots - 1;
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		if (names->short_names[idx] == SIZE_MAX)
+			continue;
+		const char* short_name = &names->storage[names->short_names[idx]];
+		insert_name(names, short_name, idx);
+		if (names->long_names[idx] != SIZE_MAX && !equal_names(&names->storage[names->long_names[idx]], short_name))
+			insert_name(names, &names->storage[names->long_names[idx]], idx);
+	}
+	return names;
+}
+
+void free_dir_names(DirNames* names)
+{
+	if (!names)
+		return;
+	free(names->slots);
+	free(names->long_names);
+	free(names->short_names);
+	free(names->storage);
+	free(names);
+}
+
+const char* get_long_filename(const DirNames* names, const size_t idx)
+{
+	return names->long_names[idx] == SIZE_MAX ? NULL : &names->storage[names->long_names[idx]];
+}
+
+const char* get_display_name(const DirNames* names, const FileRecord* records, const size_t idx)
+{
+	const char* long_name = get_long_filename(names, idx);
+	return long_name ? long_name : get_short_filename(&records[idx]);
+}
+
 char* get_date_time(const FileRecord* record)
 {
 	// Given a file record, calculate the human readable date and time
@@ -304,10 +594,10 @@ char* get_date_time(const FileRecord* record)
 	return date_time_string;
 }
 
-void display_records(const FileRecord* records, const size_t* num_records)
+void display_records(const FileRecord* records, const DirNames* names, const size_t* num_records)
 {
-	// Print a directory
-	printf("%-8s%-9s%-15s%15s%22s\n", "Type", "Attrib", "Name", "Size", "Date Modified");
+	// Print a directory, the long name goes last since it has no fixed width
+	printf("%-8s%-9s%-15s%15s%22s  %s\n", "Type", "Attrib", "Name", "Size", "Date Modified", "Long Name");
 	for (size_t idx = 0; idx < *num_records; idx++)
 	{
 		if (!records[idx].volume_id)
@@ -324,33 +614,32 @@ void display_records(const FileRecord* records, const size_t* num_records)
 			else
 				printf("%15s", "");
 			char* date_time_string = get_date_time(&records[idx]);
-			printf("%22s\n", date_time_string);
+			printf("%22s", date_time_string);
 			free(date_time_string);
+			const char* long_name = get_long_filename(names, idx);
+			if (long_name)
+				printf("  %s", long_name);
+			printf("\n");
 		}
 	}
 }
 
-size_t name_to_idx(const FileRecord* current_directory, size_t directory_entries, const char* name)
+size_t name_to_idx(const DirNames* names, const char* name)
 {
-	for (size_t idx = 0; idx < directory_entries; idx++)
+	// follow the probe sequence of the name until a free slot, either name of an entry matches
+	for (size_t slot = hash_name(name) & names->slot_mask; names->slots[slot] != 0; slot = (slot + 1) & names->slot_mask)
 	{
-		if (strcmp(name, get_short_filename(&current_directory[idx])) == 0)
-		{
+		const size_t idx = names->slots[slot] - 1;
+		if ((names->short_names[idx] != SIZE_MAX && equal_names(&names->storage[names->short_names[idx]], name)) ||
+			(names->long_names[idx] != SIZE_MAX && equal_names(&names->storage[names->long_names[idx]], name)))
 			return idx;
-		}
 	}
 	return SIZE_MAX;
 }
 
-FileRecord* name_to_record(FileRecord* current_directory, size_t directory_entries, const char* name)
+FileRecord* name_to_record(FileRecord* current_directory, const DirNames* names, const char* name)
 {
-	for (size_t idx = 0; idx < directory_entries; idx++)
-	{
-		if (strcmp(name, get_short_filename(&current_directory[idx])) == 0)
-		{
-			return &current_directory[idx];
-		}
-	}
-	return NULL;
+	const size_t idx = name_to_idx(names, name);
+	return idx == SIZE_MAX ? NULL : &current_directory[idx];
 }
 
@@ -1,16 +1,23 @@
 #pragma once
 #ifdef __GNUC__
-#define PACK(__Declaration__) __Declaration__ __attribute__((__packed__))
+#define PACK(__Declaration__) _Pragma("pack(push, 1)") __Declaration__ _Pragma("pack(pop)")
 #endif
 
 #ifdef _MSC_VER
 #define PACK(__Declaration__) __pragma(pack(push, 1)) __Declaration__ __pragma(pack(pop))
 #endif
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+// size of the MBR and the unit partitions are listed in before their boot sector is read
 #define SECTOR_SIZE 512
+// largest sector size a boot sector is probed for
+#define MAX_SECTOR_SIZE 4096
+// a VFAT long name is split over at most this many entries of 13 UTF-16 characters each
+#define MAX_LFN_ENTRIES 20
+#define LFN_CHARS_PER_ENTRY 13
 
 typedef enum PartitionType
 {
@@ -56,29 +63,41 @@ PACK(
 
 typedef struct PartitionLocations
 {
-	size_t FAT[2];
-	size_t root_dir;
-	size_t data_dir;
+	uint64_t FAT[2];
+	uint64_t root_dir;
+	uint64_t data_dir;
+	size_t sector_size;		// bytes per sector the MBR counts the partition in
 } PartitionLocations;
 
 PACK(
 	typedef struct FileRecord {
 		unsigned char filename[8];
 		unsigned char extension[3];
-		unsigned int readonly : 1;
-		unsigned int hidden : 1;
-		unsigned int system : 1;
-		unsigned int volume_id : 1;
-		unsigned int directory : 1;
-		unsigned int archive : 1;
-		unsigned int unused1 : 2;
-		uint8_t unused2[5];
+		uint8_t readonly : 1;
+		uint8_t hidden : 1;
+		uint8_t system : 1;
+		uint8_t volume_id : 1;
+		uint8_t directory : 1;
+		uint8_t archive : 1;
+		uint8_t unused1 : 2;
+		uint8_t unused2[8];
 		uint16_t first_cluster_hi;
 		uint16_t time;
 		uint16_t date;
 		uint16_t first_cluster_lo;
 		uint32_t file_size;
-	} FileRecord);
+	} FileRecord;)
+
+// names of one directory listing, built once when the listing is loaded
+typedef struct DirNames
+{
+	size_t num_records;
+	char *storage;			// every short and long name of the listing, NUL terminated
+	size_t *short_names;	// offset into storage per record, SIZE_MAX for long name entries and labels
+	size_t *long_names;		// offset into storage per record, SIZE_MAX without a valid long name
+	size_t *slots;			// hash index over both kinds of name, record index plus one, 0 is free
+	size_t slot_mask;
+} DirNames;
 
 /**
  * @brief Get the file attributes in a readable string
@@ -103,47 +122,111 @@ bool check_valid_part(const Partition *part);
  */
 bool check_valid_part_index(const MBR *mbr, const size_t index);
 /**
- * @brief Read the partition boot sector
+ * @brief Check if a partition type uses 32 bit FAT entries (LBA or CHS addressed)
+ */
+bool is_fat32(const PartitionType part_type);
+/**
+ * @brief Read the partition boot sector, finding the sector size the partition is addressed in
+ *
+ * @param fp Disk image
+ * @param part Partition entry
+ * @param sector_size Output for the sector size the boot sector was found with
+ * @return PartitionInfo* Boot sector fields, NULL if there is none
  */
-PartitionInfo *get_part_info(FILE *fp, const Partition *part);
+PartitionInfo *get_part_info(FILE *fp, const Partition *part, size_t *sector_size);
 /**
  * @brief Calculate global offsets for partition
  */
-PartitionLocations *get_part_offsets(const Partition *part, PartitionInfo *part_info);
+PartitionLocations *get_part_offsets(const Partition *part, PartitionInfo *part_info, size_t sector_size);
+/**
+ * @brief Get the byte offset of the start of a partition in the image
+ */
+uint64_t get_part_start(const Partition *part, size_t sector_size);
 /**
  * @brief Convert cluster to offset
  */
-uint32_t get_cluster_offset(const PartitionInfo *part_info, const PartitionLocations *part_offsets, uint32_t cluster_number);
+uint64_t get_cluster_offset(const PartitionInfo *part_info, const PartitionLocations *part_offsets, uint32_t cluster_number);
 /**
  * @brief Parse cluster number based on filesystem type
  */
 uint32_t get_cluster_number(const FileRecord *record, const PartitionType part_type);
+/**
+ * @brief Get the size of a single cluster in bytes
+ */
+size_t get_cluster_size(const PartitionInfo *part_info);
+/**
+ * @brief Get one past the highest cluster number that lies inside the partition
+ */
+uint32_t get_cluster_limit(const Partition *part, const PartitionInfo *part_info, const PartitionLocations *part_offsets);
+/**
+ * @brief Read a full copy of the FAT into memory, FAT12 is unpacked to 16 bits per entry
+ */
+uint8_t *read_fat_table(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+						const PartitionType part_type, const size_t fat_index, size_t *num_fat_entries);
+/**
+ * @brief Look up the next cluster of a chain in an in-memory FAT
+ */
+uint32_t get_fat_entry(const uint8_t *fat_table, const PartitionType part_type, const uint32_t cluster_number);
+/**
+ * @brief Check if a FAT entry terminates a cluster chain
+ */
+bool is_end_of_chain(const uint32_t fat_entry, const PartitionType part_type);
 /**
  * @brief Get a parsed array of all directory entries in the current dir at an offset
  */
-FileRecord *get_dir(FILE *fp, const size_t offset, size_t *num_entries);
+FileRecord *get_dir(FILE *fp, const uint64_t offset, size_t *num_entries);
 /**
- * @brief Get readable date and time from file record
+ * @brief Get a parsed array of the deleted (0xE5) entries in the dir at an offset
  */
-char *get_date_time(const FileRecord *record);
+FileRecord *get_deleted_dir(FILE *fp, const uint64_t offset, size_t *num_entries);
+/**
+ * @brief Get a parsed array of all directory entries in a directory already read into memory
+ */
+FileRecord *parse_dir(const uint8_t *buffer, const size_t length, size_t *num_entries);
+/**
+ * @brief Check if a directory entry is a fragment of a VFAT long name
+ */
+bool is_long_name_entry(const FileRecord *record);
+/**
+ * @brief Assemble the long names of a listing in one pass and hash index them with the short names
+ *
+ * Long name fragments must run in order straight before their short entry and carry its checksum,
+ * a broken sequence is dropped and the entry keeps only its short name.
+ *
+ * @param records Listing as get_dir returns it, long name fragments included
+ * @param num_records Number of records
+ * @return DirNames* UTF-8 names and their index
+ */
+DirNames *index_dir_names(const FileRecord *records, const size_t num_records);
 /**
- * @brief Read file using FAT lookups at given cluster
+ * @brief Destroy the names of a listing
  */
-uint8_t *read_file(const FILE *fp, const uint32_t start_cluster_number, const PartitionInfo *part_info,
-				   const PartitionLocations *part_offsets, const PartitionType part_type, const size_t file_size);
+void free_dir_names(DirNames *names);
+/**
+ * @brief Get the long name of an entry, or its short name when it has none
+ */
+const char *get_display_name(const DirNames *names, const FileRecord *records, const size_t idx);
+/**
+ * @brief Get the long name of an entry, NULL when it has none
+ */
+const char *get_long_filename(const DirNames *names, const size_t idx);
+/**
+ * @brief Get readable date and time from file record
+ */
+char *get_date_time(const FileRecord *record);
 /**
- * @brief String parser for directory
+ * @brief Find an entry by its long or short name, ignoring case, through the listing's hash index
  */
-size_t name_to_idx(const FileRecord *current_directory, size_t directory_entries, const char *name);
+size_t name_to_idx(const DirNames *names, const char *name);
 /**
- * @brief String parser for directory
+ * @brief Find the record of an entry by its long or short name, ignoring case
  */
-FileRecord *name_to_record(FileRecord *current_directory, size_t directory_entries, const char *name);
+FileRecord *name_to_record(FileRecord *current_directory, const DirNames *names, const char *name);
 /**
  * @brief list part handler
  */
-void display_partition_info(const MBR *mbr);
+void display_partition_info(FILE *fp, const MBR *mbr);
 /**
  * @brief Display a directory
  */
-void display_records(const FileRecord *records, const size_t *num_records);
\ No newline at end of file
+void display_records(const FileRecord *records, const DirNames *names, const size_t *num_records);
\ No newline at end of file
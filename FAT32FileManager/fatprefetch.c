@@ -0,0 +1,296 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "fatprefetch.h"
+#include "fatwidth.h"
+
+typedef struct PrefetchedDir
+{
+	uint64_t offset;
+	FileRecord* records;
+	size_t num_entries;
+} PrefetchedDir;
+
+struct Prefetcher
+{
+	FILE* fp;
+	PartitionInfo part_info;
+	PartitionLocations part_offsets;
+	const FatOps* ops;
+	size_t max_depth;
+	size_t byte_budget;
+
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t wake;
+	bool shutdown;
+	size_t generation;		// bumped by every request, the worker drops work from older ones
+	FileRecord* request;	// listing to prefetch below, owned by the prefetcher
+	size_t request_entries;
+
+	PrefetchedDir cache[PREFETCH_CACHE_SIZE];	// oldest first ring
+	size_t cache_head;
+	size_t num_cached;
+	size_t cached_bytes;
+	size_t hits;
+	size_t misses;
+};
+
+static bool is_cancelled(Prefetcher* prefetcher, const size_t generation)
+{
+	mtx_lock(&prefetcher->lock);
+	const bool cancelled = prefetcher->shutdown || prefetcher->generation != generation;
+	mtx_unlock(&prefetcher->lock);
+	return cancelled;
+}
+
+static void append_child_offsets(const Prefetcher* prefetcher, const FileRecord* records, const size_t num_entries,
+	uint64_t** offsets, size_t* num_offsets, size_t* capacity)
+{
+	for (size_t idx = 0; idx < num_entries; idx++)
+	{
+		// same rules as the volume walk: no labels, no . and .., nothing that points back at the root
+		const FileRecord* record = &records[idx];
+		const uint32_t cluster = prefetcher->ops->get_cluster_number(record);
+		if (!record->directory || record->volume_id || record->filename[0] == '.' || cluster < 2)
+			continue;
+
+		if (*num_offsets == *capacity)
+		{
+			*capacity = *capacity ? *capacity * 2 : 16;
+			*offsets = realloc(*offsets, *capacity * sizeof(uint64_t));
+		}
+		(*offsets)[(*num_offsets)++] = get_cluster_offset(&prefetcher->part_info, &prefetcher->part_offsets, cluster);
+	}
+}
+
+static PrefetchedDir* find_cached(Prefetcher* prefetcher, const uint64_t offset)
+{
+	for (size_t idx = 0; idx < prefetcher->num_cached; idx++)
+	{
+		PrefetchedDir* dir = &prefetcher->cache[(prefetcher->cache_head + idx) % PREFETCH_CACHE_SIZE];
+		if (dir->offset == offset)
+			return dir;
+	}
+	return NULL;
+}
+
+static void insert_cached(Prefetcher* prefetcher, const uint64_t offset, FileRecord* records, const size_t num_entries)
+{
+	// a listing bigger than the whole budget is never kept, it would push everything else out and still not fit
+	const size_t bytes = num_entries * sizeof(FileRecord);
+	if (bytes > prefetcher->byte_budget)
+	{
+		free(records);
+		return;
+	}
+
+	// drop the oldest listings until the new one fits in the budget
+	while (prefetcher->num_cached > 0 &&
+		(prefetcher->num_cached == PREFETCH_CACHE_SIZE || prefetcher->cached_bytes + bytes > prefetcher->byte_budget))
+	{
+		PrefetchedDir* oldest = &prefetcher->cache[prefetcher->cache_head];
+		prefetcher->cached_bytes -= oldest->num_entries * sizeof(FileRecord);
+		free(oldest->records);
+		prefetcher->cache_head = (prefetcher->cache_head + 1) % PREFETCH_CACHE_SIZE;
+		prefetcher->num_cached--;
+	}
+
+	PrefetchedDir* dir = &prefetcher->cache[(prefetcher->cache_head + prefetcher->num_cached) % PREFETCH_CACHE_SIZE];
+	dir->offset = offset;
+	dir->records = records;
+	dir->num_entries = num_entries;
+	prefetcher->cached_bytes += bytes;
+	prefetcher->num_cached++;
+}
+
+static void prefetch_tree(Prefetcher* prefetcher, FileRecord* records, const size_t num_entries, const size_t generation)
+{
+	// offsets of the directories on the level being read, and of the level below it
+	uint64_t* level = NULL;
+	size_t level_size = 0;
+	size_t level_capacity = 0;
+	uint64_t* next_level = NULL;
+	size_t next_level_size = 0;
+	size_t next_level_capacity = 0;
+	size_t bytes_read = 0;
+
+	append_child_offsets(prefetcher, records, num_entries, &level, &level_size, &level_capacity);
+	free(records);
+
+	for (size_t depth = 0; depth < prefetcher->max_depth && level_size > 0; depth++)
+	{
+		next_level_size = 0;
+		for (size_t idx = 0; idx < level_size; idx++)
+		{
+			if (bytes_read >= prefetcher->byte_budget || is_cancelled(prefetcher, generation))
+				goto done;
+
+			// a directory already cached is not read again, but its children still count for the next level
+			size_t num_records = 0;
+			mtx_lock(&prefetcher->lock);
+			const PrefetchedDir* cached = find_cached(prefetcher, level[idx]);
+			if (cached)
+				append_child_offsets(prefetcher, cached->records, cached->num_entries, &next_level, &next_level_size,
+					&next_level_capacity);
+			mtx_unlock(&prefetcher->lock);
+			if (cached)
+				continue;
+
+			// read without holding the lock so the foreground is never stuck behind the image
+			FileRecord* dir_records = get_dir(prefetcher->fp, level[idx], &num_records);
+			bytes_read += num_records * sizeof(FileRecord);
+			append_child_offsets(prefetcher, dir_records, num_records, &next_level, &next_level_size, &next_level_capacity);
+
+			mtx_lock(&prefetcher->lock);
+			if (!find_cached(prefetcher, level[idx]))
+				insert_cached(prefetcher, level[idx], dir_records, num_records);
+			else
+				free(dir_records);
+			mtx_unlock(&prefetcher->lock);
+		}
+
+		uint64_t* swap = level;
+		const size_t swap_capacity = level_capacity;
+		level = next_level;
+		level_size = next_level_size;
+		level_capacity = next_level_capacity;
+		next_level = swap;
+		next_level_capacity = swap_capacity;
+	}
+
+done:
+	free(level);
+	free(next_level);
+}
+
+static int run_prefetcher(void* arg)
+{
+	Prefetcher* prefetcher = arg;
+	mtx_lock(&prefetcher->lock);
+	while (!prefetcher->shutdown)
+	{
+		if (!prefetcher->request)
+		{
+			cnd_wait(&prefetcher->wake, &prefetcher->lock);
+			continue;
+		}
+
+		// take the newest request and work on it unlocked
+		FileRecord* records = prefetcher->request;
+		const size_t num_entries = prefetcher->request_entries;
+		const size_t generation = prefetcher->generation;
+		prefetcher->request = NULL;
+		mtx_unlock(&prefetcher->lock);
+
+		prefetch_tree(prefetcher, records, num_entries, generation);
+		mtx_lock(&prefetcher->lock);
+	}
+	mtx_unlock(&prefetcher->lock);
+	return 0;
+}
+
+Prefetcher* start_prefetcher(const char* image_path, const PartitionInfo* part_info,
+	const PartitionLocations* part_offsets, const PartitionType part_type, const size_t max_depth,
+	const size_t byte_budget)
+{
+	Prefetcher* prefetcher = calloc(1, sizeof(Prefetcher));
+	prefetcher->fp = fopen(image_path, "rb");
+	if (!prefetcher->fp)
+	{
+		free(prefetcher);
+		return NULL;
+	}
+	prefetcher->part_info = *part_info;
+	prefetcher->part_offsets = *part_offsets;
+	prefetcher->ops = get_fat_ops(part_type);
+	prefetcher->max_depth = max_depth;
+	prefetcher->byte_budget = byte_budget;
+
+	mtx_init(&prefetcher->lock, mtx_plain);
+	cnd_init(&prefetcher->wake);
+	if (thrd_create(&prefetcher->thread, run_prefetcher, prefetcher) != thrd_success)
+	{
+		cnd_destroy(&prefetcher->wake);
+		mtx_destroy(&prefetcher->lock);
+		fclose(prefetcher->fp);
+		free(prefetcher);
+		return NULL;
+	}
+	return prefetcher;
+}
+
+void stop_prefetcher(Prefetcher* prefetcher)
+{
+	if (!prefetcher)
+		return;
+
+	// the worker notices between directories, at most one listing read is waited on
+	mtx_lock(&prefetcher->lock);
+	prefetcher->shutdown = true;
+	cnd_signal(&prefetcher->wake);
+	mtx_unlock(&prefetcher->lock);
+	thrd_join(prefetcher->thread, NULL);
+
+	free(prefetcher->request);
+	for (size_t idx = 0; idx < prefetcher->num_cached; idx++)
+		free(prefetcher->cache[(prefetcher->cache_head + idx) % PREFETCH_CACHE_SIZE].records);
+	cnd_destroy(&prefetcher->wake);
+	mtx_destroy(&prefetcher->lock);
+	fclose(prefetcher->fp);
+	free(prefetcher);
+}
+
+void prefetch_children(Prefetcher* prefetcher, const FileRecord* records, const size_t num_entries)
+{
+	if (!prefetcher)
+		return;
+
+	FileRecord* request = malloc(num_entries * sizeof(FileRecord) + 1);
+	memcpy(request, records, num_entries * sizeof(FileRecord));
+
+	mtx_lock(&prefetcher->lock);
+	free(prefetcher->request);
+	prefetcher->request = request;
+	prefetcher->request_entries = num_entries;
+	prefetcher->generation++;
+	cnd_signal(&prefetcher->wake);
+	mtx_unlock(&prefetcher->lock);
+}
+
+FileRecord* get_prefetched_dir(Prefetcher* prefetcher, const uint64_t offset, size_t* num_entries)
+{
+	if (!prefetcher)
+		return NULL;
+
+	FileRecord* records = NULL;
+	mtx_lock(&prefetcher->lock);
+	const PrefetchedDir* cached = find_cached(prefetcher, offset);
+	if (cached)
+	{
+		records = malloc(cached->num_entries * sizeof(FileRecord) + 1);
+		memcpy(records, cached->records, cached->num_entries * sizeof(FileRecord));
+		*num_entries = cached->num_entries;
+		prefetcher->hits++;
+	}
+	else
+		prefetcher->misses++;
+	mtx_unlock(&prefetcher->lock);
+	return records;
+}
+
+void get_prefetch_stats(Prefetcher* prefetcher, PrefetchStats* stats)
+{
+	mtx_lock(&prefetcher->lock);
+	stats->max_depth = prefetcher->max_depth;
+	stats->byte_budget = prefetcher->byte_budget;
+	stats->num_cached = prefetcher->num_cached;
+	stats->cached_bytes = prefetcher->cached_bytes;
+	stats->hits = prefetcher->hits;
+	stats->misses = prefetcher->misses;
+	mtx_unlock(&prefetcher->lock);
+}
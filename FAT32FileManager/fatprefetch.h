@@ -0,0 +1,74 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+
+// most directories held in the prefetch cache at once
+#define PREFETCH_CACHE_SIZE 1024
+// defaults for 'prefetch on'
+#define DEFAULT_PREFETCH_DEPTH 2
+#define DEFAULT_PREFETCH_BUDGET (4 * 1024 * 1024)
+
+/*
+ * A worker thread with its own handle on the image. After the foreground loads a directory it hands the
+ * listing over and the worker reads the subdirectories below it, breadth first, into a cache keyed by
+ * directory offset. A newer request cancels whatever the worker was doing, the foreground never waits
+ * on a read, only on the lock around the cache.
+ */
+typedef struct Prefetcher Prefetcher;
+
+typedef struct PrefetchStats
+{
+	size_t max_depth;
+	size_t byte_budget;
+	size_t num_cached;
+	size_t cached_bytes;
+	size_t hits;
+	size_t misses;
+} PrefetchStats;
+
+/**
+ * @brief Start a prefetch worker
+ *
+ * @param image_path Disk image, opened again for the worker
+ * @param part_info Partition boot sector, copied
+ * @param part_offsets Partition offsets, copied
+ * @param part_type Partition filesystem type
+ * @param max_depth Levels of subdirectories to read below a loaded directory
+ * @param byte_budget Most bytes of listings to read per request and to keep cached
+ * @return Prefetcher* Worker, NULL if it could not be started
+ */
+Prefetcher *start_prefetcher(const char *image_path, const PartitionInfo *part_info,
+							 const PartitionLocations *part_offsets, PartitionType part_type, size_t max_depth,
+							 size_t byte_budget);
+/**
+ * @brief Cancel outstanding work, stop the worker and free the cache
+ *
+ * @param prefetcher Worker to stop, may be NULL
+ */
+void stop_prefetcher(Prefetcher *prefetcher);
+/**
+ * @brief Queue the subdirectories of a directory that was just loaded, cancelling the previous request
+ *
+ * @param prefetcher Worker, may be NULL
+ * @param records Listing of the loaded directory, copied
+ * @param num_entries Number of records
+ */
+void prefetch_children(Prefetcher *prefetcher, const FileRecord *records, size_t num_entries);
+/**
+ * @brief Look up a directory in the prefetch cache
+ *
+ * @param prefetcher Worker, may be NULL
+ * @param offset Offset of the directory
+ * @param num_entries Output for the number of records
+ * @return FileRecord* Copy of the listing for the caller to free, NULL if it was not prefetched
+ */
+FileRecord *get_prefetched_dir(Prefetcher *prefetcher, uint64_t offset, size_t *num_entries);
+/**
+ * @brief Read the settings and cache counters of a worker
+ *
+ * @param prefetcher Worker
+ * @param stats Output for a consistent copy of the counters
+ */
+void get_prefetch_stats(Prefetcher *prefetcher, PrefetchStats *stats);
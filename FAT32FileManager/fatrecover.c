@@ -0,0 +1,478 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatrecover.h"
+#include "utilties.h"
+#include "fattrace.h"
+#include "workpool.h"
+
+// largest file the carver writes for a single header
+#define MAX_CARVE_SIZE (64 * 1024 * 1024)
+// amount of free space read at once while scanning for headers
+#define CARVE_SCAN_SIZE (1024 * 1024)
+
+typedef enum RecoveryState
+{
+	RECOVER_CONTIGUOUS,
+	RECOVER_FRAGMENTED,
+	RECOVER_OVERWRITTEN
+} RecoveryState;
+
+typedef enum CarveEnd
+{
+	CARVE_FIRST_FOOTER,		// the file ends at the first footer after the header
+	CARVE_LAST_FOOTER,		// incremental saves append footers, the file ends at the last one that fits
+	CARVE_JPEG_MARKERS		// segments are skipped by length so an embedded thumbnail's EOI is not the end
+} CarveEnd;
+
+typedef struct Signature
+{
+	const char *extension;
+	const uint8_t *header;
+	size_t header_size;
+	const uint8_t *footer;
+	size_t footer_size;
+	size_t footer_extra;
+	CarveEnd end_rule;
+} Signature;
+
+typedef struct JpegScan
+{
+	size_t position;		// next marker, or next byte of entropy coded data
+	bool entropy_coded;		// inside the scan data after an SOS segment
+} JpegScan;
+
+static const uint8_t jpeg_header[] = { 0xFF, 0xD8, 0xFF };
+static const uint8_t jpeg_footer[] = { 0xFF, 0xD9 };
+static const uint8_t png_header[] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+static const uint8_t png_footer[] = { 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+static const uint8_t pdf_header[] = { '%', 'P', 'D', 'F', '-' };
+static const uint8_t pdf_footer[] = { '%', '%', 'E', 'O', 'F' };
+static const uint8_t zip_header[] = { 'P', 'K', 0x03, 0x04 };
+static const uint8_t zip_footer[] = { 'P', 'K', 0x05, 0x06 };
+
+static const Signature signatures[] =
+{
+	{ "jpg", jpeg_header, sizeof(jpeg_header), jpeg_footer, sizeof(jpeg_footer), 0, CARVE_JPEG_MARKERS },
+	{ "png", png_header, sizeof(png_header), png_footer, sizeof(png_footer), 0, CARVE_FIRST_FOOTER },
+	{ "pdf", pdf_header, sizeof(pdf_header), pdf_footer, sizeof(pdf_footer), 0, CARVE_LAST_FOOTER },
+	{ "zip", zip_header, sizeof(zip_header), zip_footer, sizeof(zip_footer), 18, CARVE_FIRST_FOOTER }	// end of central directory record
+};
+#define NUM_SIGNATURES (sizeof(signatures) / sizeof(Signature))
+
+typedef struct CarveHit
+{
+	uint32_t cluster;
+	uint32_t signature;
+} CarveHit;
+
+typedef struct CarveWorker
+{
+	WorkRange range;
+	const RecoveryVolume *volume;
+	const uint8_t *first_byte_signature;
+	CarveHit *hits;
+	size_t num_hits;
+	size_t hit_capacity;
+	bool failed;
+} CarveWorker;
+
+const char* get_deleted_filename(const FileRecord* record)
+{
+	// the first character is gone for good, show a placeholder instead
+	static _Thread_local char deleted_filename[13];
+	strcpy(deleted_filename, get_short_filename(record));
+	deleted_filename[0] = '_';
+	return deleted_filename;
+}
+
+static bool is_free_cluster(const RecoveryVolume* volume, const uint32_t cluster)
+{
+	return cluster >= 2 && cluster < volume->cluster_limit && volume->ops->get_fat_entry(volume->fat_table, cluster) == 0;
+}
+
+static size_t plan_recovery(const RecoveryVolume* volume, const FileRecord* record, uint32_t* clusters, RecoveryState* state)
+{
+	// the chain was wiped on delete, so assume the data sits in the free clusters after the first one
+	const size_t cluster_size = get_cluster_size(volume->part_info);
+	const size_t clusters_needed = (record->file_size + cluster_size - 1) / cluster_size;
+	uint32_t cluster = volume->ops->get_cluster_number(record);
+	size_t num_clusters = 0;
+
+	*state = RECOVER_CONTIGUOUS;
+	if (clusters_needed == 0)
+		return 0;
+	if (!is_free_cluster(volume, cluster))
+	{
+		*state = RECOVER_OVERWRITTEN;
+		return 0;
+	}
+
+	while (num_clusters < clusters_needed && cluster < volume->cluster_limit)
+	{
+		if (is_free_cluster(volume, cluster))
+		{
+			if (clusters)
+				clusters[num_clusters] = cluster;
+			num_clusters++;
+		}
+		else
+			*state = RECOVER_FRAGMENTED;
+		cluster++;
+	}
+	if (num_clusters < clusters_needed)
+		*state = RECOVER_OVERWRITTEN;
+	return num_clusters;
+}
+
+void display_deleted_records(const RecoveryVolume* volume, const FileRecord* records, const size_t num_records)
+{
+	printf("%-13s%-15s%15s%22s\n", "Status", "Name", "Size", "Date Modified");
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		// long filename fragments and volume labels are not files
+		if (records[idx].volume_id)
+			continue;
+
+		RecoveryState state = RECOVER_CONTIGUOUS;
+		if (!records[idx].directory)
+			plan_recovery(volume, &records[idx], NULL, &state);
+
+		const char* status = records[idx].directory ? "<DIR>" :
+			state == RECOVER_CONTIGUOUS ? "recoverable" : state == RECOVER_FRAGMENTED ? "partial" : "overwritten";
+		printf("%-13s%-15s", status, get_deleted_filename(&records[idx]));
+		if (!records[idx].directory)
+		{
+			const char* size = get_human_readable_size(records[idx].file_size);
+			printf("%15s", size);
+			free((void*)size);
+		}
+		else
+			printf("%15s", "");
+		char* date_time_string = get_date_time(&records[idx]);
+		printf("%22s\n", date_time_string);
+		free(date_time_string);
+	}
+}
+
+bool recover_deleted(const RecoveryVolume* volume, const FileRecord* record, const char* output_path)
+{
+	const size_t cluster_size = get_cluster_size(volume->part_info);
+	uint32_t* clusters = malloc(((record->file_size + cluster_size - 1) / cluster_size + 1) * sizeof(uint32_t));
+	RecoveryState state;
+	const size_t num_clusters = plan_recovery(volume, record, clusters, &state);
+	if (state == RECOVER_OVERWRITTEN)
+	{
+		printf("The clusters of %s have been reused, cannot recover it.\n", get_deleted_filename(record));
+		free(clusters);
+		return false;
+	}
+
+	FILE* output = fopen(output_path, "wb");
+	uint8_t* buffer = malloc(cluster_size);
+	bool success = output != NULL;
+	size_t bytes_left = record->file_size;
+	for (size_t idx = 0; idx < num_clusters && success; idx++)
+	{
+		const size_t length = bytes_left < cluster_size ? bytes_left : cluster_size;
+		const uint64_t offset = get_cluster_offset(volume->part_info, volume->part_offsets, clusters[idx]);
+		const uint64_t read_time = get_trace_time();
+		success = !seek_file(volume->fp, offset) &&
+			fread(buffer, 1, length, volume->fp) == length &&
+			fwrite(buffer, 1, length, output) == length;
+		if (success)
+			trace_read(TRACE_RECOVER, offset, length, read_time);
+		bytes_left -= length;
+	}
+	if (output)
+		fclose(output);
+	if (!success)
+		printf("Could not recover %s.\n", get_deleted_filename(record));
+	else if (state == RECOVER_FRAGMENTED)
+		printf("%s was fragmented, skipped clusters in use so the result may be damaged.\n", get_deleted_filename(record));
+
+	free(buffer);
+	free(clusters);
+	return success;
+}
+
+static int scan_free_clusters(void* arg)
+{
+	// read runs of free clusters and look at the first bytes of each, files always start on a cluster
+	CarveWorker* worker = arg;
+	const RecoveryVolume* volume = worker->volume;
+	const size_t cluster_size = get_cluster_size(volume->part_info);
+	const size_t clusters_per_read = CARVE_SCAN_SIZE / cluster_size ? CARVE_SCAN_SIZE / cluster_size : 1;
+	uint8_t* buffer = malloc(clusters_per_read * cluster_size);
+
+	// every thread needs its own file position
+	FILE* fp = fopen(volume->image_path, "rb");
+	if (!fp)
+	{
+		worker->failed = true;
+		free(buffer);
+		return 0;
+	}
+
+	uint32_t cluster = (uint32_t)worker->range.first;
+	while (cluster < worker->range.last)
+	{
+		if (!is_free_cluster(volume, cluster))
+		{
+			cluster++;
+			continue;
+		}
+
+		size_t run = 1;
+		while (run < clusters_per_read && cluster + run < worker->range.last && is_free_cluster(volume, cluster + (uint32_t)run))
+			run++;
+
+		const uint64_t read_time = get_trace_time();
+		if (seek_file(fp, get_cluster_offset(volume->part_info, volume->part_offsets, cluster)) ||
+			fread(buffer, 1, run * cluster_size, fp) != run * cluster_size)
+		{
+			worker->failed = true;
+			break;
+		}
+		trace_read(TRACE_SCAN, get_cluster_offset(volume->part_info, volume->part_offsets, cluster), run * cluster_size, read_time);
+
+		for (size_t idx = 0; idx < run; idx++)
+		{
+			// first byte lookup rules out almost every cluster before any compare
+			const uint8_t* start = &buffer[idx * cluster_size];
+			const uint8_t candidate = worker->first_byte_signature[start[0]];
+			if (!candidate)
+				continue;
+
+			const Signature* signature = &signatures[candidate - 1];
+			if (memcmp(start, signature->header, signature->header_size) != 0)
+				continue;
+
+			if (worker->num_hits == worker->hit_capacity)
+			{
+				worker->hit_capacity = worker->hit_capacity ? worker->hit_capacity * 2 : 64;
+				worker->hits = realloc(worker->hits, worker->hit_capacity * sizeof(CarveHit));
+			}
+			worker->hits[worker->num_hits].cluster = cluster + (uint32_t)idx;
+			worker->hits[worker->num_hits].signature = candidate - 1;
+			worker->num_hits++;
+		}
+		cluster += (uint32_t)run;
+	}
+
+	fclose(fp);
+	free(buffer);
+	return 0;
+}
+
+static const uint8_t* find_bytes(const uint8_t* haystack, const size_t haystack_size, const uint8_t* needle, const size_t needle_size)
+{
+	if (haystack_size < needle_size)
+		return NULL;
+	const uint8_t* end = haystack + haystack_size - needle_size + 1;
+	for (const uint8_t* cursor = haystack; cursor < end; cursor++)
+	{
+		cursor = memchr(cursor, needle[0], (size_t)(end - cursor));
+		if (!cursor)
+			return NULL;
+		if (memcmp(cursor, needle, needle_size) == 0)
+			return cursor;
+	}
+	return NULL;
+}
+
+static bool find_jpeg_end(const uint8_t* data, const size_t size, JpegScan* scan, size_t* end)
+{
+	// resumes where the last call stopped, returns false until the EOI of the top level image is in the data
+	while (true)
+	{
+		size_t position = scan->position;
+		if (scan->entropy_coded)
+		{
+			// scan data ends at the first FF that is not a stuffed 00, a restart marker or fill
+			if (position + 1 >= size)
+				return false;
+			const uint8_t* marker = memchr(&data[position], 0xFF, size - position - 1);
+			if (!marker)
+			{
+				scan->position = size - 1;
+				return false;
+			}
+			position = (size_t)(marker - data);
+			const uint8_t code = data[position + 1];
+			if (code == 0x00 || (code >= 0xD0 && code <= 0xD7) || code == 0xFF)
+			{
+				scan->position = position + (code == 0xFF ? 1 : 2);
+				continue;
+			}
+			scan->position = position;
+			scan->entropy_coded = false;
+		}
+
+		if (position + 2 > size)
+			return false;
+		const uint8_t code = data[position + 1];
+		if (data[position] != 0xFF)
+		{
+			// not a marker where one belongs, look for the next one like in scan data
+			scan->entropy_coded = true;
+			continue;
+		}
+		if (code == 0xD9)
+		{
+			*end = position + 2;
+			return true;
+		}
+
+		// SOI, restart markers, TEM and fill bytes stand alone, every other segment has a length after the marker
+		if (code == 0xFF || code == 0xD8 || code == 0x01 || (code >= 0xD0 && code <= 0xD7))
+		{
+			scan->position = position + (code == 0xFF ? 1 : 2);
+			continue;
+		}
+		if (position + 4 > size)
+			return false;
+		scan->position = position + 2 + ((size_t)data[position + 2] << 8 | data[position + 3]);
+		scan->entropy_coded = code == 0xDA;
+	}
+}
+
+static bool carve_hit(const RecoveryVolume* volume, const CarveHit* hit, const uint32_t stop_cluster, const char* destination)
+{
+	const Signature* signature = &signatures[hit->signature];
+	const size_t cluster_size = get_cluster_size(volume->part_info);
+
+	// the free run after the header is read until its end is known, so the file can be cut anywhere in it
+	size_t capacity = 16 * cluster_size;
+	uint8_t* data = malloc(capacity);
+	size_t size = 0;
+	size_t end = 0;
+	bool found_end = false;
+	JpegScan jpeg = { 0, false };
+	for (uint32_t cluster = hit->cluster; cluster < stop_cluster && is_free_cluster(volume, cluster) && size < MAX_CARVE_SIZE &&
+		!(found_end && signature->end_rule != CARVE_LAST_FOOTER); cluster++)
+	{
+		if (size + cluster_size > capacity)
+		{
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+		const uint64_t read_time = get_trace_time();
+		if (seek_file(volume->fp, get_cluster_offset(volume->part_info, volume->part_offsets, cluster)) ||
+			fread(&data[size], 1, cluster_size, volume->fp) != cluster_size)
+			break;
+		trace_read(TRACE_CARVE, get_cluster_offset(volume->part_info, volume->part_offsets, cluster), cluster_size, read_time);
+
+		// look again at the last few bytes of the previous cluster so a footer split over two is still found
+		const size_t overlap = signature->footer_size - 1;
+		const size_t searched = size > overlap ? size - overlap : 0;
+		size += cluster_size;
+
+		if (signature->end_rule == CARVE_JPEG_MARKERS)
+		{
+			found_end = find_jpeg_end(data, size, &jpeg, &end);
+			continue;
+		}
+		for (const uint8_t* footer = find_bytes(&data[searched], size - searched, signature->footer, signature->footer_size);
+			footer; footer = find_bytes(footer + 1, (size_t)(&data[size] - (footer + 1)), signature->footer, signature->footer_size))
+		{
+			end = (size_t)(footer - data) + signature->footer_size + signature->footer_extra;
+			found_end = true;
+			if (signature->end_rule == CARVE_FIRST_FOOTER)
+				break;
+		}
+	}
+
+	// a PDF footer is followed by its end of line
+	if (found_end && signature->end_rule == CARVE_LAST_FOOTER)
+	{
+		if (end < size && data[end] == '\r')
+			end++;
+		if (end < size && data[end] == '\n')
+			end++;
+	}
+
+	// without an end everything that was read is kept
+	const size_t length = found_end && end < size ? end : size;
+	bool success = false;
+	if (length > 0)
+	{
+		char* path = malloc(strlen(destination) + 32);
+		sprintf(path, "%s/%08u.%s", destination, hit->cluster, signature->extension);
+		FILE* output = fopen(path, "wb");
+		free(path);
+		if (output)
+		{
+			success = fwrite(data, 1, length, output) == length;
+			success &= fclose(output) == 0;
+		}
+	}
+
+	free(data);
+	return success;
+}
+
+size_t carve_volume(const RecoveryVolume* volume, const size_t num_threads, const char* destination)
+{
+	// map the first byte of every header to its signature
+	uint8_t first_byte_signature[256] = { 0 };
+	for (size_t idx = 0; idx < NUM_SIGNATURES; idx++)
+		first_byte_signature[signatures[idx].header[0]] = (uint8_t)(idx + 1);
+
+	CarveWorker* workers = calloc(num_threads, sizeof(CarveWorker));
+	if (!workers)
+	{
+		printf("Not enough memory to carve with %zu threads.\n\n", num_threads);
+		return 0;
+	}
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		workers[idx].volume = volume;
+		workers[idx].first_byte_signature = first_byte_signature;
+	}
+	run_parallel(workers, sizeof(CarveWorker), num_threads, scan_free_clusters, 2, volume->cluster_limit);
+
+	// workers cover ascending cluster ranges, so their hits concatenate in order
+	size_t num_hits = 0;
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		num_hits += workers[idx].num_hits;
+		if (workers[idx].failed)
+			printf("Warning: part of the free space could not be scanned.\n");
+	}
+	CarveHit* hits = malloc((num_hits + 1) * sizeof(CarveHit));
+	num_hits = 0;
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		if (workers[idx].num_hits && hits)
+			memcpy(&hits[num_hits], workers[idx].hits, workers[idx].num_hits * sizeof(CarveHit));
+		num_hits += workers[idx].num_hits;
+		free(workers[idx].hits);
+	}
+	free(workers);
+	if (!hits)
+	{
+		printf("Not enough memory to carve the headers found.\n\n");
+		return 0;
+	}
+
+	// write each file as soon as it is found, it ends at its footer or where the next one starts
+	make_directory(destination);
+	size_t num_carved = 0;
+	for (size_t idx = 0; idx < num_hits; idx++)
+	{
+		const uint32_t stop_cluster = idx + 1 < num_hits ? hits[idx + 1].cluster : volume->cluster_limit;
+		if (carve_hit(volume, &hits[idx], stop_cluster, destination))
+		{
+			printf("  %08u.%s\n", hits[idx].cluster, signatures[hits[idx].signature].extension);
+			num_carved++;
+		}
+	}
+	printf("Carved %zu files from unallocated space to %s\n\n", num_carved, destination);
+
+	free(hits);
+	return num_carved;
+}
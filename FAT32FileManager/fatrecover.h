@@ -0,0 +1,52 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatwidth.h"
+
+typedef struct RecoveryVolume
+{
+	FILE *fp;
+	const char *image_path;
+	const PartitionInfo *part_info;
+	const PartitionLocations *part_offsets;
+	PartitionType part_type;
+	const FatOps *ops;
+	const uint8_t *fat_table;
+	uint32_t cluster_limit;		// clusters from here on are outside the data region or the FAT
+} RecoveryVolume;
+
+/**
+ * @brief Get the readable name of a deleted entry, the 0xE5 marker is shown as '_'
+ *
+ * @param record Deleted directory entry
+ * @return const char* Readable filename
+ */
+const char *get_deleted_filename(const FileRecord *record);
+/**
+ * @brief Print the deleted entries of a directory and how well each one can be recovered
+ *
+ * @param volume Mounted volume
+ * @param records Deleted entries
+ * @param num_records Number of deleted entries
+ */
+void display_deleted_records(const RecoveryVolume *volume, const FileRecord *records, const size_t num_records);
+/**
+ * @brief Rebuild a deleted file from its first cluster and the free clusters following it
+ *
+ * @param volume Mounted volume
+ * @param record Deleted entry
+ * @param output_path Local file to write
+ * @return true The file was written
+ */
+bool recover_deleted(const RecoveryVolume *volume, const FileRecord *record, const char *output_path);
+/**
+ * @brief Scan unallocated clusters for JPEG/PNG/PDF/ZIP headers and write every hit out
+ *
+ * @param volume Mounted volume
+ * @param num_threads Number of scanning threads
+ * @param destination Local directory for carved files
+ * @return size_t Number of files carved
+ */
+size_t carve_volume(const RecoveryVolume *volume, const size_t num_threads, const char *destination);
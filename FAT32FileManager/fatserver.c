@@ -0,0 +1,314 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fatserver.h"
+
+#ifdef _WIN32
+
+bool run_server(const char* socket_path, const char* image_path, size_t part_index, bool create_index)
+{
+	printf("Server mode is not supported on this platform.\n");
+	return false;
+}
+
+bool run_client(const char* socket_path, char** commands, size_t num_commands)
+{
+	printf("Server mode is not supported on this platform.\n");
+	return false;
+}
+
+bool run_load_test(const char* socket_path, const char* command, size_t num_requests, size_t concurrency)
+{
+	printf("Server mode is not supported on this platform.\n");
+	return false;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fatcontextfactory.h"
+#include "cmdparser.h"
+#include "workpool.h"
+#include "utilties.h"
+
+// size of the buffer session output is copied through
+#define CLIENT_BUFFER_SIZE (64 * 1024)
+
+typedef struct LoadWorker
+{
+	WorkRange range;
+	const char* socket_path;
+	const char* command;
+	double* latencies;
+	size_t bytes_received;
+	size_t failures;
+} LoadWorker;
+
+static bool get_socket_address(const char* socket_path, struct sockaddr_un* address)
+{
+	memset(address, 0, sizeof(struct sockaddr_un));
+	address->sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address->sun_path))
+	{
+		printf("Socket path is too long: %s\n", socket_path);
+		return false;
+	}
+	strcpy(address->sun_path, socket_path);
+	return true;
+}
+
+static int connect_to_server(const char* socket_path)
+{
+	struct sockaddr_un address;
+	if (!get_socket_address(socket_path, &address))
+		return -1;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int compare_latency(const void* a, const void* b)
+{
+	const double left = *(const double*)a;
+	const double right = *(const double*)b;
+	return (left > right) - (left < right);
+}
+
+static void run_session(FileManagerContext* context, const int client_fd)
+{
+	// the descriptor is shared with the server, give this session its own file position
+	fclose(context->file);
+	context->file = fopen(context->image_path, "rb");
+	if (!context->file)
+		_exit(EXIT_FAILURE);
+
+	// the command loop and every handler talk to stdin and stdout, point them at the client
+	dup2(client_fd, STDIN_FILENO);
+	dup2(client_fd, STDOUT_FILENO);
+	close(client_fd);
+	setvbuf(stdout, NULL, _IOFBF, CLIENT_BUFFER_SIZE);
+
+	run_command_handler(context);
+}
+
+bool run_server(const char* socket_path, const char* image_path, size_t part_index, bool create_index)
+{
+	struct sockaddr_un address;
+	if (!get_socket_address(socket_path, &address))
+		return false;
+
+	// mount once, every session starts from this state
+	FileManagerContext* context = setup_file_manager_context(image_path);
+	char part_arg[32];
+	sprintf(part_arg, "%zu", part_index);
+	select_part(context, part_arg);
+	if (!context->current_dir)
+		return false;
+	if (create_index)
+		build_index(context, "");
+	context->interactive = false;
+
+	const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+	{
+		printf("Could not create socket: %s\n", strerror(errno));
+		return false;
+	}
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SERVER_BACKLOG) != 0)
+	{
+		printf("Could not listen on %s: %s\n", socket_path, strerror(errno));
+		close(listen_fd);
+		return false;
+	}
+
+	// finished sessions are reaped by the kernel
+	signal(SIGCHLD, SIG_IGN);
+	printf("Serving %s partition %zu on %s\n", image_path, part_index, socket_path);
+	fflush(stdout);
+
+	while (true)
+	{
+		const int client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd < 0)
+		{
+			if (errno != EINTR)
+				printf("Could not accept connection: %s\n", strerror(errno));
+			continue;
+		}
+
+		// anything still buffered would be inherited by the child and sent to the client
+		fflush(stdout);
+		const pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(listen_fd);
+			run_session(context, client_fd);
+			_exit(EXIT_SUCCESS);
+		}
+		if (pid < 0)
+			printf("Could not start session: %s\n", strerror(errno));
+		close(client_fd);
+	}
+}
+
+bool run_client(const char* socket_path, char** commands, size_t num_commands)
+{
+	const int fd = connect_to_server(socket_path);
+	if (fd < 0)
+	{
+		printf("Could not connect to %s.\n", socket_path);
+		return false;
+	}
+
+	uint8_t* buffer = malloc(CLIENT_BUFFER_SIZE);
+	bool success = true;
+	if (num_commands)
+	{
+		// send everything up front, the session ends once the server has answered it all
+		for (size_t idx = 0; idx < num_commands && success; idx++)
+		{
+			success = write_all(fd, commands[idx], strlen(commands[idx])) == 0 && write_all(fd, "\n", 1) == 0;
+		}
+		shutdown(fd, SHUT_WR);
+
+		ssize_t bytes_read;
+		while (success && (bytes_read = read(fd, buffer, CLIENT_BUFFER_SIZE)) > 0)
+			success = write_all(STDOUT_FILENO, buffer, (size_t)bytes_read) == 0;
+	}
+	else
+	{
+		// relay stdin to the server and output back until the server closes the session
+		struct pollfd fds[2] = { { fd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+		size_t num_fds = 2;
+		while (success)
+		{
+			if (poll(fds, num_fds, -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (fds[0].revents)
+			{
+				const ssize_t bytes_read = read(fd, buffer, CLIENT_BUFFER_SIZE);
+				if (bytes_read <= 0)
+					break;
+				success = write_all(STDOUT_FILENO, buffer, (size_t)bytes_read) == 0;
+			}
+			if (num_fds == 2 && fds[1].revents)
+			{
+				const ssize_t bytes_read = read(STDIN_FILENO, buffer, CLIENT_BUFFER_SIZE);
+				if (bytes_read <= 0)
+				{
+					// nothing more to send, keep reading what is left
+					shutdown(fd, SHUT_WR);
+					num_fds = 1;
+				}
+				else
+					success = write_all(fd, buffer, (size_t)bytes_read) == 0;
+			}
+		}
+	}
+
+	free(buffer);
+	close(fd);
+	return success;
+}
+
+static int run_load_worker(void* arg)
+{
+	LoadWorker* worker = arg;
+	uint8_t* buffer = malloc(CLIENT_BUFFER_SIZE);
+	const size_t command_length = strlen(worker->command);
+	for (size_t idx = worker->range.first; idx < worker->range.last; idx++)
+	{
+		// every request is a full session: connect, run the command, read to the end
+		const double start = get_time_ms();
+		const int fd = connect_to_server(worker->socket_path);
+		bool success = fd >= 0;
+		if (success)
+		{
+			success = write_all(fd, worker->command, command_length) == 0 && write_all(fd, "\n", 1) == 0;
+			shutdown(fd, SHUT_WR);
+
+			ssize_t bytes_read;
+			while ((bytes_read = read(fd, buffer, CLIENT_BUFFER_SIZE)) > 0)
+				worker->bytes_received += (size_t)bytes_read;
+			if (bytes_read < 0)
+				success = false;
+			close(fd);
+		}
+		worker->latencies[idx] = get_time_ms() - start;
+		if (!success)
+			worker->failures++;
+	}
+	free(buffer);
+	return 0;
+}
+
+bool run_load_test(const char* socket_path, const char* command, size_t num_requests, size_t concurrency)
+{
+	if (!num_requests || !concurrency)
+	{
+		printf("Need at least one request and one connection.\n");
+		return false;
+	}
+	if (concurrency > num_requests)
+		concurrency = num_requests;
+
+	double* latencies = calloc(num_requests, sizeof(double));
+	LoadWorker* workers = calloc(concurrency, sizeof(LoadWorker));
+	for (size_t idx = 0; idx < concurrency; idx++)
+	{
+		workers[idx].socket_path = socket_path;
+		workers[idx].command = command;
+		workers[idx].latencies = latencies;
+	}
+
+	// a client that disappears mid-request must not take the whole test down
+	signal(SIGPIPE, SIG_IGN);
+	const double start = get_time_ms();
+	run_parallel(workers, sizeof(LoadWorker), concurrency, run_load_worker, 0, num_requests);
+	const double elapsed = get_time_ms() - start;
+
+	size_t failures = 0;
+	size_t bytes_received = 0;
+	for (size_t idx = 0; idx < concurrency; idx++)
+	{
+		failures += workers[idx].failures;
+		bytes_received += workers[idx].bytes_received;
+	}
+	qsort(latencies, num_requests, sizeof(double), compare_latency);
+
+	printf("%zu requests over %zu connections in %.2f s, %zu failed\n", num_requests, concurrency, elapsed / 1000.0,
+		failures);
+	printf("Throughput: %.1f req/s, %s received\n", (double)num_requests * 1000.0 / elapsed,
+		get_human_readable_size(bytes_received));
+	printf("Latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", latencies[num_requests / 2],
+		latencies[(num_requests * 99) / 100], latencies[num_requests - 1]);
+
+	free(workers);
+	free(latencies);
+	return failures == 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+// pending connections the kernel queues before sessions are forked off
+#define SERVER_BACKLOG 128
+// most commands a client sends on one connection from the command line
+#define MAX_CLIENT_COMMANDS 32
+
+/**
+ * @brief Mount an image once and serve the command set over a unix domain socket
+ *
+ * Every connection becomes a session with its own cwd, forked from the mounted process so the FAT, the
+ * boot sector and any index are already warm. A session reads commands one per line and ends when the
+ * client stops sending, sessions run concurrently. Does not return unless the socket cannot be set up.
+ *
+ * @param socket_path Path of the socket to create, an existing one is replaced
+ * @param image_path Disk image to serve
+ * @param part_index Partition to select for every session
+ * @param create_index Build or refresh the sidecar index before serving
+ * @return bool False if the server could not start
+ */
+bool run_server(const char *socket_path, const char *image_path, size_t part_index, bool create_index);
+/**
+ * @brief Connect to a server and run commands
+ *
+ * With no commands, lines typed on stdin are sent as they come and output is shown until either side closes.
+ *
+ * @param socket_path Socket the server listens on
+ * @param commands Commands to send, one per line
+ * @param num_commands Number of commands
+ * @return bool False if the server could not be reached
+ */
+bool run_client(const char *socket_path, char **commands, size_t num_commands);
+/**
+ * @brief Send the same command to a server many times and report throughput and latency
+ *
+ * @param socket_path Socket the server listens on
+ * @param command Command each request runs in a fresh session
+ * @param num_requests Total requests
+ * @param concurrency Requests in flight at once
+ * @return bool False if any request failed
+ */
+bool run_load_test(const char *socket_path, const char *command, size_t num_requests, size_t concurrency);
@@ -0,0 +1,465 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "fatsnapshot.h"
+#include "fatwidth.h"
+#include "utilties.h"
+#include "fattrace.h"
+
+typedef struct PendingFile
+{
+	uint32_t first_cluster;
+	size_t file_size;
+} PendingFile;
+
+static char* get_snapshot_path(const char* image_path, const size_t part_index)
+{
+	char* path = malloc(strlen(image_path) + 32);
+	sprintf(path, "%s.p%zu.fmidx", image_path, part_index);
+	return path;
+}
+
+static int compare_dirs(const void* a, const void* b)
+{
+	const SnapshotDir* lhs = a;
+	const SnapshotDir* rhs = b;
+	if (lhs->offset < rhs->offset) return -1;
+	if (lhs->offset > rhs->offset) return 1;
+	return 0;
+}
+
+static int compare_pending_files(const void* a, const void* b)
+{
+	const PendingFile* lhs = a;
+	const PendingFile* rhs = b;
+	if (lhs->first_cluster != rhs->first_cluster)
+		return lhs->first_cluster < rhs->first_cluster ? -1 : 1;
+	// keep the largest size first so duplicates cover the longest chain
+	if (lhs->file_size != rhs->file_size)
+		return lhs->file_size > rhs->file_size ? -1 : 1;
+	return 0;
+}
+
+static bool write_section(FILE* file, const void* data, const size_t size, const size_t count)
+{
+	return count == 0 || fwrite(data, size, count, file) == count;
+}
+
+static bool build_snapshot(FILE* fp, const char* path, const Partition* part, const PartitionInfo* part_info,
+	const PartitionLocations* part_offsets, const uint8_t* boot_sector, const uint8_t* fat_table,
+	const size_t num_fat_entries, const uint64_t fat_checksum, const uint64_t image_size, const int64_t image_mtime)
+{
+	const FatOps* ops = get_fat_ops(part->type);
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(SnapshotHeader));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	memcpy(header.boot_sector, boot_sector, SECTOR_SIZE);
+	memcpy(&header.part, part, sizeof(Partition));
+	header.fat_checksum = fat_checksum;
+	header.image_size = image_size;
+	header.image_mtime = image_mtime;
+	header.total_clusters = num_fat_entries > 2 ? num_fat_entries - 2 : 0;
+
+	// FAT summary
+	for (uint32_t cluster = 2; cluster < num_fat_entries; cluster++)
+	{
+		const uint32_t fat_entry = ops->get_fat_entry(fat_table, cluster);
+		if (fat_entry == 0)
+			header.free_clusters++;
+		else if (fat_entry == ops->bad_cluster)
+			header.bad_clusters++;
+	}
+
+	// read every directory once, the dir list doubles as the work queue
+	size_t dir_capacity = 64, record_capacity = 256, file_capacity = 256;
+	SnapshotDir* dirs = malloc(dir_capacity * sizeof(SnapshotDir));
+	FileRecord* records = malloc(record_capacity * sizeof(FileRecord));
+	PendingFile* pending = malloc(file_capacity * sizeof(PendingFile));
+	size_t num_pending = 0;
+	uint8_t* visited = calloc(num_fat_entries + 1, sizeof(uint8_t));
+
+	dirs[0].offset = part_offsets->root_dir;
+	header.num_dirs = 1;
+	for (size_t dir_idx = 0; dir_idx < header.num_dirs; dir_idx++)
+	{
+		size_t num_entries = 0;
+		FileRecord* listing = get_dir(fp, dirs[dir_idx].offset, &num_entries);
+
+		while (header.num_records + num_entries > record_capacity)
+			record_capacity *= 2;
+		records = realloc(records, record_capacity * sizeof(FileRecord));
+		memcpy(&records[header.num_records], listing, num_entries * sizeof(FileRecord));
+		dirs[dir_idx].first_record = header.num_records;
+		dirs[dir_idx].num_records = num_entries;
+		header.num_records += num_entries;
+
+		for (size_t idx = 0; idx < num_entries; idx++)
+		{
+			const FileRecord* record = &listing[idx];
+			const uint32_t cluster = ops->get_cluster_number(record);
+			if (record->volume_id || cluster < 2 || cluster >= num_fat_entries)
+				continue;
+
+			if (record->directory)
+			{
+				if (record->filename[0] == '.' || visited[cluster])
+					continue;
+				visited[cluster] = 1;
+				if (header.num_dirs == dir_capacity)
+				{
+					dir_capacity *= 2;
+					dirs = realloc(dirs, dir_capacity * sizeof(SnapshotDir));
+				}
+				dirs[header.num_dirs++].offset = get_cluster_offset(part_info, part_offsets, cluster);
+			}
+			else if (record->file_size > 0)
+			{
+				if (num_pending == file_capacity)
+				{
+					file_capacity *= 2;
+					pending = realloc(pending, file_capacity * sizeof(PendingFile));
+				}
+				pending[num_pending].first_cluster = cluster;
+				pending[num_pending].file_size = record->file_size;
+				num_pending++;
+			}
+		}
+		free(listing);
+	}
+	qsort(dirs, header.num_dirs, sizeof(SnapshotDir), compare_dirs);
+	qsort(pending, num_pending, sizeof(PendingFile), compare_pending_files);
+
+	// turn every chain into runs of consecutive clusters
+	const size_t cluster_size = get_cluster_size(part_info);
+	size_t extent_capacity = 256;
+	SnapshotFile* files = malloc((num_pending + 1) * sizeof(SnapshotFile));
+	SnapshotExtent* extents = malloc(extent_capacity * sizeof(SnapshotExtent));
+	for (size_t idx = 0; idx < num_pending; idx++)
+	{
+		if (header.num_files && files[header.num_files - 1].first_cluster == pending[idx].first_cluster)
+			continue;
+
+		SnapshotFile* file = &files[header.num_files++];
+		file->first_cluster = pending[idx].first_cluster;
+		file->first_extent = header.num_extents;
+		file->num_extents = 0;
+
+		size_t clusters_left = (pending[idx].file_size + cluster_size - 1) / cluster_size;
+		uint32_t cluster = pending[idx].first_cluster;
+		while (clusters_left > 0)
+		{
+			SnapshotExtent* last = file->num_extents ? &extents[header.num_extents - 1] : NULL;
+			if (last && last->cluster + last->num_clusters == cluster)
+			{
+				last->num_clusters++;
+			}
+			else
+			{
+				if (header.num_extents == extent_capacity)
+				{
+					extent_capacity *= 2;
+					extents = realloc(extents, extent_capacity * sizeof(SnapshotExtent));
+				}
+				extents[header.num_extents].cluster = cluster;
+				extents[header.num_extents].num_clusters = 1;
+				header.num_extents++;
+				file->num_extents++;
+			}
+			clusters_left--;
+
+			cluster = ops->next_cluster(fat_table, num_fat_entries, cluster);
+			if (!cluster)
+				break;
+		}
+	}
+
+	// write next to the final name first so a crash never leaves a half written index behind
+	char* tmp_path = malloc(strlen(path) + 5);
+	sprintf(tmp_path, "%s.tmp", path);
+	FILE* file = fopen(tmp_path, "wb");
+	bool success = file &&
+		write_section(file, &header, sizeof(SnapshotHeader), 1) &&
+		write_section(file, dirs, sizeof(SnapshotDir), header.num_dirs) &&
+		write_section(file, records, sizeof(FileRecord), header.num_records) &&
+		write_section(file, files, sizeof(SnapshotFile), header.num_files) &&
+		write_section(file, extents, sizeof(SnapshotExtent), header.num_extents);
+	if (file && fclose(file))
+		success = false;
+
+	if (success)
+	{
+		remove(path);
+		success = rename(tmp_path, path) == 0;
+	}
+	if (!success)
+		remove(tmp_path);
+
+	free(tmp_path);
+	free(extents);
+	free(files);
+	free(visited);
+	free(pending);
+	free(records);
+	free(dirs);
+	return success;
+}
+
+static bool add_section_size(size_t* total, const uint64_t count, const size_t size)
+{
+	// the counts come from the file, a corrupt header must not wrap the total around to the file size
+	if (count > (SIZE_MAX - *total) / size)
+		return false;
+	*total += (size_t)count * size;
+	return true;
+}
+
+static bool check_section_ranges(const Snapshot* snapshot)
+{
+	// every directory and file points into a later section, a damaged index must not point past it
+	const SnapshotHeader* header = snapshot->header;
+	for (uint64_t idx = 0; idx < header->num_dirs; idx++)
+	{
+		const SnapshotDir* dir = &snapshot->dirs[idx];
+		if (dir->first_record > header->num_records || dir->num_records > header->num_records - dir->first_record)
+			return false;
+	}
+	for (uint64_t idx = 0; idx < header->num_files; idx++)
+	{
+		const SnapshotFile* file = &snapshot->files[idx];
+		if (file->first_extent > header->num_extents || file->num_extents > header->num_extents - file->first_extent)
+			return false;
+	}
+	return true;
+}
+
+static Snapshot* load_snapshot(const char* path)
+{
+	Snapshot* snapshot = calloc(1, sizeof(Snapshot));
+
+#ifndef _WIN32
+	// map the file so reopening costs page faults rather than reads
+	const int fd = open(path, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) || (size_t)info.st_size < sizeof(SnapshotHeader))
+	{
+		if (fd >= 0)
+			close(fd);
+		free(snapshot);
+		return NULL;
+	}
+	snapshot->size = (size_t)info.st_size;
+	snapshot->base = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snapshot->base == MAP_FAILED)
+	{
+		free(snapshot);
+		return NULL;
+	}
+	snapshot->mapped = true;
+#else
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		free(snapshot);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	snapshot->size = (size_t)tell_file(file);
+	fseek(file, 0, SEEK_SET);
+	snapshot->base = malloc(snapshot->size + 1);
+	if (snapshot->size < sizeof(SnapshotHeader) || fread(snapshot->base, 1, snapshot->size, file) != snapshot->size)
+	{
+		fclose(file);
+		free(snapshot->base);
+		free(snapshot);
+		return NULL;
+	}
+	fclose(file);
+#endif
+
+	const SnapshotHeader* header = (const SnapshotHeader*)snapshot->base;
+	snapshot->header = header;
+
+	// make sure every section fits in the file before handing out pointers into it
+	size_t expected_size = sizeof(SnapshotHeader);
+	const bool fits = add_section_size(&expected_size, header->num_dirs, sizeof(SnapshotDir)) &&
+		add_section_size(&expected_size, header->num_records, sizeof(FileRecord)) &&
+		add_section_size(&expected_size, header->num_files, sizeof(SnapshotFile)) &&
+		add_section_size(&expected_size, header->num_extents, sizeof(SnapshotExtent));
+	if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || !fits || expected_size != snapshot->size)
+	{
+		close_snapshot(snapshot);
+		return NULL;
+	}
+
+	uint8_t* section = snapshot->base + sizeof(SnapshotHeader);
+	snapshot->dirs = (const SnapshotDir*)section;
+	section += header->num_dirs * sizeof(SnapshotDir);
+	snapshot->records = (const FileRecord*)section;
+	section += header->num_records * sizeof(FileRecord);
+	snapshot->files = (const SnapshotFile*)section;
+	section += header->num_files * sizeof(SnapshotFile);
+	snapshot->extents = (const SnapshotExtent*)section;
+	if (!check_section_ranges(snapshot))
+	{
+		close_snapshot(snapshot);
+		return NULL;
+	}
+	return snapshot;
+}
+
+Snapshot* open_snapshot(FILE* fp, const char* image_path, const size_t part_index, const Partition* part,
+	const PartitionInfo* part_info, const PartitionLocations* part_offsets, const uint8_t* fat_table,
+	size_t num_fat_entries, const bool create)
+{
+	char* path = get_snapshot_path(image_path, part_index);
+	Snapshot* snapshot = load_snapshot(path);
+	if (!snapshot && !create)
+	{
+		free(path);
+		return NULL;
+	}
+
+	// the snapshot is only trusted if the boot sector and the FAT are unchanged
+	uint8_t boot_sector[SECTOR_SIZE];
+	const uint64_t read_time = get_trace_time();
+	if (seek_file(fp, get_part_start(part, part_offsets->sector_size)) || fread(boot_sector, 1, SECTOR_SIZE, fp) != SECTOR_SIZE)
+	{
+		printf("Could not read partition metadata.\n");
+		close_snapshot(snapshot);
+		free(path);
+		return NULL;
+	}
+	trace_read(TRACE_SNAPSHOT, get_part_start(part, part_offsets->sector_size), SECTOR_SIZE, read_time);
+	if (snapshot &&
+		(memcmp(snapshot->header->boot_sector, boot_sector, SECTOR_SIZE) != 0 ||
+			memcmp(&snapshot->header->part, part, sizeof(Partition)) != 0))
+	{
+		close_snapshot(snapshot);
+		snapshot = NULL;
+	}
+
+	// an image that was not written since the index was built cannot have a different FAT,
+	// a device or a file without a stamp is always hashed
+	uint64_t image_size = 0;
+	int64_t image_mtime = 0;
+	if (get_file_stamp(image_path, &image_size, &image_mtime))
+	{
+		image_size = 0;
+		image_mtime = 0;
+	}
+	if (snapshot && image_mtime != 0 && snapshot->header->image_size == image_size &&
+		snapshot->header->image_mtime == image_mtime)
+	{
+		free(path);
+		return snapshot;
+	}
+
+	// otherwise hash the FAT, reading it only if the caller has not already
+	uint8_t* own_fat_table = NULL;
+	if (!fat_table)
+	{
+		own_fat_table = read_fat_table(fp, part_info, part_offsets, part->type, 0, &num_fat_entries);
+		fat_table = own_fat_table;
+	}
+	if (!fat_table)
+	{
+		printf("Could not read partition metadata.\n");
+		close_snapshot(snapshot);
+		free(path);
+		return NULL;
+	}
+	const size_t fat_bytes = num_fat_entries * get_fat_ops(part->type)->fat_entry_size;
+	const uint64_t fat_checksum = hash_buffer(fat_table, fat_bytes, 0);
+	if (snapshot && snapshot->header->fat_checksum != fat_checksum)
+	{
+		close_snapshot(snapshot);
+		snapshot = NULL;
+	}
+
+	// stale or missing, rebuild it
+	if (!snapshot)
+	{
+		if (build_snapshot(fp, path, part, part_info, part_offsets, boot_sector, fat_table, num_fat_entries, fat_checksum,
+			image_size, image_mtime))
+			snapshot = load_snapshot(path);
+		else
+			printf("Could not write index %s.\n", path);
+	}
+
+	free(own_fat_table);
+	free(path);
+	return snapshot;
+}
+
+void close_snapshot(Snapshot* snapshot)
+{
+	if (!snapshot)
+		return;
+#ifndef _WIN32
+	if (snapshot->mapped)
+		munmap(snapshot->base, snapshot->size);
+#else
+	free(snapshot->base);
+#endif
+	free(snapshot);
+}
+
+FileRecord* snapshot_get_dir(const Snapshot* snapshot, const uint64_t offset, size_t* num_entries)
+{
+	if (!snapshot)
+		return NULL;
+
+	size_t low = 0;
+	size_t high = snapshot->header->num_dirs;
+	while (low < high)
+	{
+		const size_t mid = low + (high - low) / 2;
+		if (snapshot->dirs[mid].offset < offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == snapshot->header->num_dirs || snapshot->dirs[low].offset != offset)
+		return NULL;
+
+	// hand out a copy, callers own the directory array like they do with get_dir
+	const SnapshotDir* dir = &snapshot->dirs[low];
+	FileRecord* records = malloc((dir->num_records + 1) * sizeof(FileRecord));
+	memcpy(records, &snapshot->records[dir->first_record], dir->num_records * sizeof(FileRecord));
+	*num_entries = dir->num_records;
+	return records;
+}
+
+const SnapshotExtent* snapshot_get_extents(const Snapshot* snapshot, const uint32_t first_cluster, size_t* num_extents)
+{
+	if (!snapshot)
+		return NULL;
+
+	size_t low = 0;
+	size_t high = snapshot->header->num_files;
+	while (low < high)
+	{
+		const size_t mid = low + (high - low) / 2;
+		if (snapshot->files[mid].first_cluster < first_cluster)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == snapshot->header->num_files || snapshot->files[low].first_cluster != first_cluster)
+		return NULL;
+
+	*num_extents = snapshot->files[low].num_extents;
+	return &snapshot->extents[snapshot->files[low].first_extent];
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+
+#define SNAPSHOT_MAGIC 0x58444D46	// "FMDX"
+#define SNAPSHOT_VERSION 3
+
+/*
+ * Sidecar layout, every section is an array of fixed-size little endian records so the file can be
+ * mapped and used in place:
+ *   SnapshotHeader
+ *   SnapshotDir[num_dirs]			sorted by offset
+ *   FileRecord[num_records]		directory listings exactly as get_dir returns them
+ *   SnapshotFile[num_files]		sorted by first cluster
+ *   SnapshotExtent[num_extents]
+ */
+PACK(
+	typedef struct SnapshotHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint8_t boot_sector[SECTOR_SIZE];
+		Partition part;
+		uint64_t fat_checksum;
+		uint64_t image_size;		// size and modification time in nanoseconds of the image when the index was built,
+		int64_t image_mtime;		// while both match the FAT is not read to validate it, 0 if it was not a regular file
+		uint64_t total_clusters;
+		uint64_t free_clusters;
+		uint64_t bad_clusters;
+		uint64_t num_dirs;
+		uint64_t num_records;
+		uint64_t num_files;
+		uint64_t num_extents;
+	} SnapshotHeader;)
+
+PACK(
+	typedef struct SnapshotDir {
+		uint64_t offset;
+		uint64_t first_record;
+		uint64_t num_records;
+	} SnapshotDir;)
+
+PACK(
+	typedef struct SnapshotFile {
+		uint32_t first_cluster;
+		uint32_t num_extents;
+		uint64_t first_extent;
+	} SnapshotFile;)
+
+PACK(
+	typedef struct SnapshotExtent {
+		uint32_t cluster;
+		uint32_t num_clusters;
+	} SnapshotExtent;)
+
+typedef struct Snapshot
+{
+	uint8_t *base;
+	size_t size;
+	bool mapped;
+	const SnapshotHeader *header;
+	const SnapshotDir *dirs;
+	const FileRecord *records;
+	const SnapshotFile *files;
+	const SnapshotExtent *extents;
+} Snapshot;
+
+/**
+ * @brief Load the sidecar snapshot of a partition, rebuilding it if it no longer matches the image
+ *
+ * The boot sector, partition entry and the image's size and modification time are compared first. The FAT
+ * is only read and hashed when the image changed since the index was built or the index has to be built.
+ *
+ * @param fp Disk image
+ * @param image_path Path of the disk image, the sidecar lives next to it
+ * @param part_index Partition number
+ * @param part Partition entry
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param fat_table FAT already read by the caller, NULL to read it here when it is needed
+ * @param num_fat_entries Number of entries in fat_table
+ * @param create Build the sidecar if it does not exist yet
+ * @return Snapshot* Validated snapshot, NULL if there is none
+ */
+Snapshot *open_snapshot(FILE *fp, const char *image_path, const size_t part_index, const Partition *part,
+						const PartitionInfo *part_info, const PartitionLocations *part_offsets, const uint8_t *fat_table,
+						const size_t num_fat_entries, const bool create);
+/**
+ * @brief Release a snapshot
+ *
+ * @param snapshot Snapshot to release
+ */
+void close_snapshot(Snapshot *snapshot);
+/**
+ * @brief Get a copy of a directory listing from the snapshot
+ *
+ * @param snapshot Loaded snapshot
+ * @param offset Image offset of the directory
+ * @param num_entries Number of records returned
+ * @return FileRecord* Same records get_dir would return, NULL if the directory is not in the snapshot
+ */
+FileRecord *snapshot_get_dir(const Snapshot *snapshot, const uint64_t offset, size_t *num_entries);
+/**
+ * @brief Get the cluster runs of the file starting at a cluster
+ *
+ * @param snapshot Loaded snapshot
+ * @param first_cluster First cluster of the file
+ * @param num_extents Number of runs returned
+ * @return const SnapshotExtent* Runs in file order, NULL if the file is not in the snapshot
+ */
+const SnapshotExtent *snapshot_get_extents(const Snapshot *snapshot, const uint32_t first_cluster, size_t *num_extents);
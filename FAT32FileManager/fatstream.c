@@ -0,0 +1,522 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatparser.h"
+#include "fatstream.h"
+#include "fattrace.h"
+#include "fatwidth.h"
+#include "utilties.h"
+
+// most output files we keep open at once
+#define MAX_OPEN_OUTPUTS 64
+#define NO_TARGET UINT32_MAX
+
+typedef struct StreamReader
+{
+	FILE *in;
+	uint64_t position;
+	uint8_t *scratch;
+	size_t scratch_size;
+} StreamReader;
+
+typedef struct StreamTarget
+{
+	bool directory;
+	char *path;
+	size_t size;
+	size_t clusters_needed;
+	size_t clusters_seen;
+	uint8_t *dir_buffer;
+	FILE *output;
+	size_t output_position;
+} StreamTarget;
+
+typedef struct StreamState
+{
+	const PartitionInfo *part_info;
+	const FatOps *ops;
+	size_t cluster_size;
+	uint8_t *fat_table;
+	size_t num_clusters;
+	uint32_t *chain_head;	// first cluster of the chain each cluster belongs to
+	uint32_t *chain_pos;	// position of each cluster inside its chain
+	uint32_t *head_target;	// chain head -> target index
+	uint32_t *spool_slot;	// cluster -> slot + 1 in the spool file
+	StreamTarget *targets;
+	size_t num_targets;
+	size_t target_capacity;
+	FILE *spool;
+	size_t spooled_clusters;
+	size_t num_open;
+	bool success;
+} StreamState;
+
+static bool stream_read(StreamReader* reader, void* buffer, const size_t length)
+{
+	// skipped bytes are read too, so the trace shows the whole pass over the image
+	const uint64_t read_time = get_trace_time();
+	if (fread(buffer, 1, length, reader->in) != length)
+		return false;
+	trace_read(TRACE_STREAM, reader->position, length, read_time);
+	reader->position += length;
+	return true;
+}
+
+static bool stream_rewind_to(StreamReader* reader, const uint64_t offset)
+{
+	// only an input redirected from a file can go back, a pipe cannot
+	if (seek_file(reader->in, offset))
+		return false;
+	reader->position = offset;
+	return true;
+}
+
+static bool stream_skip_to(StreamReader* reader, const uint64_t offset)
+{
+	// we can only move forward, so skipping means reading and throwing the data away
+	if (offset < reader->position)
+		return false;
+	while (reader->position < offset)
+	{
+		const uint64_t bytes_left = offset - reader->position;
+		const size_t chunk = bytes_left < reader->scratch_size ? (size_t)bytes_left : reader->scratch_size;
+		if (!stream_read(reader, reader->scratch, chunk))
+			return false;
+	}
+	return true;
+}
+
+static void close_outputs(StreamState* state)
+{
+	for (size_t idx = 0; idx < state->num_targets; idx++)
+	{
+		if (state->targets[idx].output)
+		{
+			fclose(state->targets[idx].output);
+			state->targets[idx].output = NULL;
+		}
+	}
+	state->num_open = 0;
+}
+
+static void map_chains(StreamState* state)
+{
+	// a chain head is an allocated cluster that no other cluster links to
+	uint8_t* referenced = calloc(state->num_clusters, sizeof(uint8_t));
+	for (uint32_t cluster = 2; cluster < state->num_clusters; cluster++)
+	{
+		const uint32_t next_cluster = state->ops->next_cluster(state->fat_table, state->num_clusters, cluster);
+		if (next_cluster)
+			referenced[next_cluster] = 1;
+	}
+
+	for (uint32_t head = 2; head < state->num_clusters; head++)
+	{
+		if (referenced[head] || state->ops->get_fat_entry(state->fat_table, head) == 0)
+			continue;
+
+		uint32_t cluster = head;
+		uint32_t pos = 0;
+		while (state->chain_head[cluster] == 0)
+		{
+			state->chain_head[cluster] = head;
+			state->chain_pos[cluster] = pos++;
+			const uint32_t next_cluster = state->ops->next_cluster(state->fat_table, state->num_clusters, cluster);
+			if (!next_cluster)
+				break;
+			cluster = next_cluster;
+		}
+	}
+	free(referenced);
+}
+
+static size_t get_chain_length(const StreamState* state, const uint32_t head)
+{
+	size_t length = 0;
+	uint32_t cluster = head;
+	while (cluster >= 2 && cluster < state->num_clusters && state->chain_head[cluster] == head &&
+		state->chain_pos[cluster] == length)
+	{
+		length++;
+		cluster = state->ops->next_cluster(state->fat_table, state->num_clusters, cluster);
+	}
+	return length;
+}
+
+static void register_records(StreamState* state, const FileRecord* records, const size_t num_records, const char* parent_path);
+
+static void deliver_cluster(StreamState* state, const uint32_t cluster, const uint8_t* data);
+
+static void drain_spool(StreamState* state, const uint32_t head)
+{
+	// hand over clusters of this chain that went past before we knew who owned them
+	uint8_t* data = malloc(state->cluster_size);
+	uint32_t cluster = head;
+	while (cluster >= 2 && cluster < state->num_clusters && state->chain_head[cluster] == head)
+	{
+		if (state->spool_slot[cluster])
+		{
+			const size_t slot = state->spool_slot[cluster] - 1;
+			state->spool_slot[cluster] = 0;
+			if (seek_file(state->spool, (uint64_t)slot * state->cluster_size) ||
+				fread(data, 1, state->cluster_size, state->spool) != state->cluster_size)
+			{
+				printf("Could not read spooled cluster %u.\n", cluster);
+				state->success = false;
+				break;
+			}
+			deliver_cluster(state, cluster, data);
+		}
+		cluster = state->ops->next_cluster(state->fat_table, state->num_clusters, cluster);
+	}
+	free(data);
+	fseek(state->spool, 0, SEEK_END);
+}
+
+static void complete_directory(StreamState* state, const size_t target_idx)
+{
+	size_t num_records = 0;
+	const size_t dir_length = state->targets[target_idx].clusters_needed * state->cluster_size;
+	FileRecord* records = parse_dir(state->targets[target_idx].dir_buffer, dir_length, &num_records);
+	free(state->targets[target_idx].dir_buffer);
+	state->targets[target_idx].dir_buffer = NULL;
+
+	// copy the path, registering children may move the target array
+	char* path = malloc(strlen(state->targets[target_idx].path) + 1);
+	strcpy(path, state->targets[target_idx].path);
+	register_records(state, records, num_records, path);
+	free(path);
+	free(records);
+}
+
+static void deliver_cluster(StreamState* state, const uint32_t cluster, const uint8_t* data)
+{
+	const uint32_t target_idx = state->head_target[state->chain_head[cluster]];
+	StreamTarget* target = &state->targets[target_idx];
+	const size_t position = (size_t)state->chain_pos[cluster] * state->cluster_size;
+
+	if (state->chain_pos[cluster] >= target->clusters_needed)
+		return;
+	target->clusters_seen++;
+
+	if (target->directory)
+	{
+		memcpy(&target->dir_buffer[position], data, state->cluster_size);
+		if (target->clusters_seen == target->clusters_needed)
+			complete_directory(state, target_idx);
+		return;
+	}
+
+	if (!target->output)
+	{
+		if (state->num_open == MAX_OPEN_OUTPUTS)
+			close_outputs(state);
+		target->output = fopen(target->path, "r+b");
+		target->output_position = 0;
+		if (!target->output)
+		{
+			printf("Could not write %s.\n", target->path);
+			state->success = false;
+			return;
+		}
+		state->num_open++;
+	}
+
+	size_t length = state->cluster_size;
+	if (position + length > target->size)
+		length = target->size - position;
+
+	// only seek when the cluster is not the next one in the file
+	if ((target->output_position != position && seek_file(target->output, position)) ||
+		fwrite(data, 1, length, target->output) != length)
+	{
+		printf("Could not write %s.\n", target->path);
+		state->success = false;
+	}
+	target->output_position = position + length;
+
+	if (target->clusters_seen == target->clusters_needed)
+	{
+		fclose(target->output);
+		target->output = NULL;
+		state->num_open--;
+	}
+}
+
+static void register_target(StreamState* state, const bool directory, const char* path, const size_t size, const uint32_t head)
+{
+	if (state->num_targets == state->target_capacity)
+	{
+		state->target_capacity *= 2;
+		state->targets = realloc(state->targets, state->target_capacity * sizeof(StreamTarget));
+	}
+	const size_t target_idx = state->num_targets++;
+	StreamTarget* target = &state->targets[target_idx];
+	memset(target, 0, sizeof(StreamTarget));
+	target->directory = directory;
+	target->size = size;
+	target->path = malloc(strlen(path) + 1);
+	strcpy(target->path, path);
+
+	// create the output right away so empty files and directories exist even without data
+	if (directory)
+	{
+		make_directory(path);
+	}
+	else
+	{
+		FILE* created = fopen(path, "wb");
+		if (created)
+			fclose(created);
+		else
+		{
+			printf("Could not write %s.\n", path);
+			state->success = false;
+		}
+	}
+
+	// a chain can only belong to one target, cross-linked chains go to whoever claimed them first
+	if (head < 2 || head >= state->num_clusters || state->chain_head[head] != head || state->head_target[head] != NO_TARGET)
+		return;
+	if (!directory && size == 0)
+		return;
+
+	const size_t chain_length = get_chain_length(state, head);
+	size_t clusters_needed = directory ? chain_length : (size + state->cluster_size - 1) / state->cluster_size;
+	if (clusters_needed > chain_length)
+		clusters_needed = chain_length;
+	target->clusters_needed = clusters_needed;
+	if (directory)
+		target->dir_buffer = calloc(clusters_needed + 1, state->cluster_size);
+
+	state->head_target[head] = (uint32_t)target_idx;
+	drain_spool(state, head);
+}
+
+static void register_records(StreamState* state, const FileRecord* records, const size_t num_records, const char* parent_path)
+{
+	for (size_t idx = 0; idx < num_records; idx++)
+	{
+		const FileRecord* record = &records[idx];
+
+		// skip volume labels, long filename fragments and the . and .. links
+		if (record->volume_id || (record->directory && record->filename[0] == '.'))
+			continue;
+
+		// the raw 8.3 bytes may hold separators or dots, keep every entry inside the destination
+		char* name = get_safe_filename(get_short_filename(record), NULL);
+		char* path = malloc(strlen(parent_path) + strlen(name) + 2);
+		sprintf(path, "%s/%s", parent_path, name);
+		register_target(state, record->directory, path, record->file_size, state->ops->get_cluster_number(record));
+		free(path);
+		free(name);
+	}
+}
+
+bool extract_stream(FILE* in, const size_t part_index, const char* destination)
+{
+	StreamReader reader = { in, 0, malloc(1024 * 1024), 1024 * 1024 };
+	setvbuf(in, NULL, _IOFBF, 1024 * 1024);
+
+	MBR mbr;
+	if (!stream_read(&reader, &mbr, sizeof(MBR)))
+	{
+		printf("Could not read MBR.\n");
+		free(reader.scratch);
+		return false;
+	}
+
+	// pick the requested partition, or the first one we can read
+	size_t selected_part = part_index;
+	if (selected_part == SIZE_MAX)
+	{
+		for (size_t idx = 0; idx < 4 && selected_part == SIZE_MAX; idx++)
+			if (check_valid_part_index(&mbr, idx))
+				selected_part = idx;
+	}
+	if (selected_part >= 4 || !check_valid_part_index(&mbr, selected_part))
+	{
+		printf("Partition number out of range.\n");
+		free(reader.scratch);
+		return false;
+	}
+	const Partition* part = &mbr.partitions[selected_part];
+
+	// boot sector, the MBR counts in the disk's sectors so try each size until the boot sector agrees,
+	// every candidate lies further into the image than the last so this still only reads forward
+	uint8_t boot_sector[SECTOR_SIZE];
+	PartitionInfo part_info;
+	PartitionInfo fallback_info;
+	bool found_boot_sector = false;
+	bool have_fallback = false;
+	size_t sector_size = SECTOR_SIZE;
+	for (; sector_size <= MAX_SECTOR_SIZE; sector_size *= 2)
+	{
+		if (!stream_skip_to(&reader, (uint64_t)part->lba_offset * sector_size) ||
+			!stream_read(&reader, boot_sector, sizeof(boot_sector)))
+			break;
+		memcpy(&part_info, &boot_sector[0x0b], sizeof(PartitionInfo));
+		if (part_info.bytes_per_sector == sector_size)
+		{
+			found_boot_sector = true;
+			break;
+		}
+		if (sector_size == SECTOR_SIZE)
+		{
+			fallback_info = part_info;
+			have_fallback = part_info.bytes_per_sector != 0 && part_info.sectors_per_cluster != 0;
+		}
+	}
+
+	// none agree, use the one where a 512 byte disk keeps it like get_part_info does, if we can get back there
+	if (!found_boot_sector && have_fallback)
+	{
+		sector_size = SECTOR_SIZE;
+		part_info = fallback_info;
+		found_boot_sector = stream_rewind_to(&reader, (uint64_t)part->lba_offset * SECTOR_SIZE + SECTOR_SIZE);
+		if (!found_boot_sector)
+			printf("No boot sector matches its sector size and the input cannot seek back to the first one.\n");
+	}
+	if (!found_boot_sector)
+	{
+		printf("Could not read boot sector.\n");
+		free(reader.scratch);
+		return false;
+	}
+	PartitionLocations* part_offsets = get_part_offsets(part, &part_info, sector_size);
+
+	StreamState state;
+	memset(&state, 0, sizeof(StreamState));
+	state.part_info = &part_info;
+	state.ops = get_fat_ops(part->type);
+	state.cluster_size = get_cluster_size(&part_info);
+	state.success = true;
+
+	// first FAT, the second copy is skipped over
+	const FatOps* ops = state.ops;
+	const size_t fat_bytes = ops->get_fat_sectors(&part_info) * part_info.bytes_per_sector;
+	uint8_t* raw_fat = malloc(fat_bytes);
+	if (!stream_skip_to(&reader, part_offsets->FAT[0]) || !stream_read(&reader, raw_fat, fat_bytes))
+	{
+		printf("Could not read FAT.\n");
+		free(raw_fat);
+		free(part_offsets);
+		free(reader.scratch);
+		return false;
+	}
+	state.fat_table = ops->decode_fat(raw_fat, fat_bytes, &state.num_clusters);
+	if (!state.fat_table)
+	{
+		printf("Could not read FAT.\n");
+		free(part_offsets);
+		free(reader.scratch);
+		return false;
+	}
+	state.chain_head = calloc(state.num_clusters, sizeof(uint32_t));
+	state.chain_pos = calloc(state.num_clusters, sizeof(uint32_t));
+	state.head_target = malloc(state.num_clusters * sizeof(uint32_t));
+	memset(state.head_target, 0xFF, state.num_clusters * sizeof(uint32_t));
+	state.spool_slot = calloc(state.num_clusters, sizeof(uint32_t));
+	state.target_capacity = 64;
+	state.targets = malloc(state.target_capacity * sizeof(StreamTarget));
+	state.spool = tmpfile();
+	map_chains(&state);
+
+	// the root directory is either a fixed region (FAT12/16) or a normal chain (FAT32)
+	make_directory(destination);
+	if (is_fat32(part->type))
+	{
+		register_target(&state, true, destination, 0, part_info.root_dir_first_cluster);
+	}
+	else
+	{
+		const size_t root_bytes = (size_t)part_info.root_dir_entries * sizeof(FileRecord);
+		uint8_t* root_buffer = malloc(root_bytes);
+		size_t num_records = 0;
+		if (!stream_skip_to(&reader, part_offsets->root_dir) || !stream_read(&reader, root_buffer, root_bytes))
+		{
+			printf("Could not read root directory.\n");
+			state.success = false;
+		}
+		else
+		{
+			FileRecord* records = parse_dir(root_buffer, root_bytes, &num_records);
+			register_records(&state, records, num_records, destination);
+			free(records);
+		}
+		free(root_buffer);
+	}
+
+	// find the last cluster we care about so we can stop reading early
+	uint32_t last_cluster = 0;
+	for (uint32_t cluster = 2; cluster < state.num_clusters; cluster++)
+		if (state.chain_head[cluster])
+			last_cluster = cluster;
+
+	// sweep the data region once, front to back
+	uint8_t* cluster_data = malloc(state.cluster_size);
+	for (uint32_t cluster = 2; cluster <= last_cluster && state.success; cluster++)
+	{
+		if (!state.chain_head[cluster])
+			continue;
+
+		const uint64_t offset = part_offsets->data_dir + (uint64_t)(cluster - 2) * state.cluster_size;
+		if (!stream_skip_to(&reader, offset) || !stream_read(&reader, cluster_data, state.cluster_size))
+		{
+			printf("Image ended at offset %llu.\n", (unsigned long long)reader.position);
+			state.success = false;
+			break;
+		}
+
+		if (state.head_target[state.chain_head[cluster]] != NO_TARGET)
+		{
+			deliver_cluster(&state, cluster, cluster_data);
+		}
+		else if (state.spool)
+		{
+			// owner unknown yet, keep it until its directory shows up
+			if (fwrite(cluster_data, 1, state.cluster_size, state.spool) != state.cluster_size)
+			{
+				printf("Could not write spool file.\n");
+				state.success = false;
+				break;
+			}
+			state.spool_slot[cluster] = (uint32_t)++state.spooled_clusters;
+		}
+	}
+	close_outputs(&state);
+
+	size_t num_files = 0;
+	size_t num_incomplete = 0;
+	for (size_t idx = 0; idx < state.num_targets; idx++)
+	{
+		if (!state.targets[idx].directory)
+			num_files++;
+		if (state.targets[idx].clusters_seen != state.targets[idx].clusters_needed)
+			num_incomplete++;
+		free(state.targets[idx].dir_buffer);
+		free(state.targets[idx].path);
+	}
+
+	const char* spooled_size = get_human_readable_size(state.spooled_clusters * state.cluster_size);
+	printf("Extracted %zu files from stream to %s (%s spooled).\n", num_files, destination, spooled_size);
+	if (num_incomplete)
+		printf("Warning: %zu entries are incomplete.\n", num_incomplete);
+	free((void*)spooled_size);
+
+	if (state.spool)
+		fclose(state.spool);
+	free(cluster_data);
+	free(state.targets);
+	free(state.spool_slot);
+	free(state.head_target);
+	free(state.chain_pos);
+	free(state.chain_head);
+	free(state.fat_table);
+	free(part_offsets);
+	free(reader.scratch);
+	return state.success && num_incomplete == 0;
+}
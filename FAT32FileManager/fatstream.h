@@ -0,0 +1,17 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * @brief Extract every file of a partition from a non-seekable image stream in a single forward pass
+ *
+ * Metadata (MBR, boot sector, FAT, directories) is parsed as it passes by. Data clusters whose owner
+ * is not known yet, because their directory appears later in the image, are spooled to a temporary
+ * file and written out once the owning directory has been read.
+ *
+ * @param in Image stream (pipe, stdin, ...)
+ * @param part_index Partition to extract, SIZE_MAX for the first readable partition
+ * @param destination Local directory to extract into
+ * @return true All files were written
+ */
+bool extract_stream(FILE *in, const size_t part_index, const char *destination);
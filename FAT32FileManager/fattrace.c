@@ -0,0 +1,413 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <threads.h>
+
+#include "fattrace.h"
+#include "fatdirect.h"
+#include "fatparser.h"
+#include "utilties.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// buffer the trace is written through, a directory listing alone can log hundreds of reads
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+// most origins a trace header may name before we consider the file damaged
+#define MAX_TRACE_ORIGINS 256
+
+static const char* origin_names[NUM_TRACE_ORIGINS] =
+{
+	"setup_file_manager_context", "get_part_info", "read_fat_table", "get_dir", "get_deleted_dir",
+	"read_file_range", "sweep_extents", "open_snapshot", "recover_deleted", "scan_free_clusters", "carve_hit",
+	"stream_read"
+};
+
+static const char* backend_names[] = { "stdio", "pread", "mmap", "direct" };
+
+// one trace per process, reads are logged from deep inside the parser where no context is passed down
+static once_flag trace_once = ONCE_FLAG_INIT;
+static mtx_t trace_lock;
+static FILE* trace_file;
+static char* trace_path;
+static uint64_t trace_start;
+static size_t trace_records;
+static uint64_t trace_bytes;
+// counted whether or not a trace is recording, so a job can tell how much it read
+static _Thread_local uint64_t thread_read_bytes;
+
+typedef struct ReplayImage
+{
+	ReplayBackend backend;
+	FILE *fp;
+	int fd;
+	uint8_t *map;
+	uint64_t map_size;
+	DirectReader *direct;
+} ReplayImage;
+
+typedef struct OriginStats
+{
+	size_t reads;
+	uint64_t bytes;
+	uint64_t time_ns;
+} OriginStats;
+
+static void init_trace_lock(void)
+{
+	mtx_init(&trace_lock, mtx_plain);
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+bool start_trace(const char* path)
+{
+	stop_trace();
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Could not create %s.\n", path);
+		return false;
+	}
+	setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	// name every origin so a replayer built from another version still knows what it is looking at
+	TraceHeader header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.num_origins = NUM_TRACE_ORIGINS;
+	char names[NUM_TRACE_ORIGINS][TRACE_NAME_SIZE];
+	memset(names, 0, sizeof(names));
+	for (size_t idx = 0; idx < NUM_TRACE_ORIGINS; idx++)
+		strncpy(names[idx], origin_names[idx], TRACE_NAME_SIZE - 1);
+	if (fwrite(&header, sizeof(TraceHeader), 1, file) != 1 || fwrite(names, sizeof(names), 1, file) != 1)
+	{
+		printf("Could not write %s.\n", path);
+		fclose(file);
+		return false;
+	}
+
+	mtx_lock(&trace_lock);
+	trace_file = file;
+	trace_path = malloc(strlen(path) + 1);
+	strcpy(trace_path, path);
+	trace_start = get_time_ns();
+	trace_records = 0;
+	trace_bytes = 0;
+	mtx_unlock(&trace_lock);
+	return true;
+}
+
+void stop_trace(void)
+{
+	call_once(&trace_once, init_trace_lock);
+	mtx_lock(&trace_lock);
+	if (trace_file)
+	{
+		const bool written = fclose(trace_file) == 0;
+		const char* readable_size = get_human_readable_size(trace_bytes);
+		if (written)
+			printf("Traced %zu reads (%s) to %s.\n", trace_records, readable_size, trace_path);
+		else
+			printf("Could not write %s.\n", trace_path);
+		free((void*)readable_size);
+		free(trace_path);
+		trace_file = NULL;
+		trace_path = NULL;
+	}
+	mtx_unlock(&trace_lock);
+}
+
+bool is_tracing(void)
+{
+	call_once(&trace_once, init_trace_lock);
+	mtx_lock(&trace_lock);
+	const bool tracing = trace_file != NULL;
+	mtx_unlock(&trace_lock);
+	return tracing;
+}
+
+uint64_t get_trace_time(void)
+{
+	return get_time_ns();
+}
+
+void trace_read(const TraceOrigin origin, const uint64_t offset, const size_t length, const uint64_t start_time)
+{
+	thread_read_bytes += length;
+
+	// the lock is cheap next to the read it logs, and keeps records from several threads whole and in order
+	call_once(&trace_once, init_trace_lock);
+	mtx_lock(&trace_lock);
+	if (trace_file)
+	{
+		// a read already in flight when the trace started counts as issued with it
+		const uint64_t time_ns = start_time > trace_start ? start_time - trace_start : 0;
+		const TraceRecord record = { time_ns, offset, (uint32_t)length, (uint32_t)origin };
+		fwrite(&record, sizeof(TraceRecord), 1, trace_file);
+		trace_records++;
+		trace_bytes += length;
+	}
+	mtx_unlock(&trace_lock);
+}
+
+uint64_t get_thread_read_bytes(void)
+{
+	return thread_read_bytes;
+}
+
+bool parse_replay_backend(const char* name, ReplayBackend* backend)
+{
+	for (size_t idx = 0; idx < sizeof(backend_names) / sizeof(backend_names[0]); idx++)
+	{
+		if (strcmp(name, backend_names[idx]) == 0)
+		{
+			*backend = (ReplayBackend)idx;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool open_replay_image(ReplayImage* image, const char* path, const ReplayBackend backend)
+{
+	memset(image, 0, sizeof(ReplayImage));
+	image->backend = backend;
+	image->fd = -1;
+	switch (backend)
+	{
+	case REPLAY_STDIO:
+		image->fp = fopen(path, "rb");
+		return image->fp != NULL;
+	case REPLAY_DIRECT:
+		image->direct = open_direct_reader(path, SECTOR_SIZE);
+		return image->direct != NULL;
+#ifndef _WIN32
+	case REPLAY_PREAD:
+		image->fd = open(path, O_RDONLY);
+		return image->fd >= 0;
+	case REPLAY_MMAP:
+	{
+		image->fd = open(path, O_RDONLY);
+		struct stat info;
+		if (image->fd < 0 || fstat(image->fd, &info) != 0 || info.st_size == 0)
+			return false;
+		void* map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, image->fd, 0);
+		if (map == MAP_FAILED)
+			return false;
+		image->map = map;
+		image->map_size = (uint64_t)info.st_size;
+		return true;
+	}
+#else
+	case REPLAY_PREAD:
+	case REPLAY_MMAP:
+		printf("The %s backend is not supported on this platform.\n", backend_names[backend]);
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+static void close_replay_image(ReplayImage* image)
+{
+	if (image->fp)
+		fclose(image->fp);
+	close_direct_reader(image->direct);
+#ifndef _WIN32
+	if (image->map)
+		munmap(image->map, (size_t)image->map_size);
+	if (image->fd >= 0)
+		close(image->fd);
+#endif
+}
+
+static bool replay_read(ReplayImage* image, const uint64_t offset, const size_t length, uint8_t* buffer)
+{
+	switch (image->backend)
+	{
+	case REPLAY_STDIO:
+		return !seek_file(image->fp, offset) && fread(buffer, 1, length, image->fp) == length;
+	case REPLAY_DIRECT:
+		return direct_read(image->direct, offset, length, buffer);
+#ifndef _WIN32
+	case REPLAY_PREAD:
+	{
+		size_t bytes_read = 0;
+		while (bytes_read < length)
+		{
+			const ssize_t result = pread(image->fd, &buffer[bytes_read], length - bytes_read, (off_t)(offset + bytes_read));
+			if (result <= 0)
+				return false;
+			bytes_read += (size_t)result;
+		}
+		return true;
+	}
+	case REPLAY_MMAP:
+		// copy out like the other backends do, so the page faults are part of the timing
+		if (offset > image->map_size || length > image->map_size - offset)
+			return false;
+		memcpy(buffer, &image->map[offset], length);
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+static int compare_latency(const void* a, const void* b)
+{
+	const uint64_t left = *(const uint64_t*)a;
+	const uint64_t right = *(const uint64_t*)b;
+	return (left > right) - (left < right);
+}
+
+static void print_replay_stats(const char (*names)[TRACE_NAME_SIZE], const OriginStats* stats, const size_t num_origins,
+	uint64_t* latencies, const size_t num_reads, const uint64_t bytes, const uint64_t elapsed_ns, const ReplayBackend backend)
+{
+	const double seconds = elapsed_ns > 0 ? (double)elapsed_ns / 1e9 : 1e-9;
+	const char* readable_size = get_human_readable_size(bytes);
+	printf("Replayed %zu reads (%s) with %s in %.1f ms, %.0f reads/s, %.1f MB/s\n", num_reads, readable_size,
+		backend_names[backend], (double)elapsed_ns / 1e6, (double)num_reads / seconds, (double)bytes / seconds / 1048576.0);
+	free((void*)readable_size);
+
+	if (num_reads > 0)
+	{
+		qsort(latencies, num_reads, sizeof(uint64_t), compare_latency);
+		printf("Latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", (double)latencies[num_reads / 2] / 1e6,
+			(double)latencies[(num_reads * 99) / 100] / 1e6, (double)latencies[num_reads - 1] / 1e6);
+	}
+
+	printf("  %-28s%10s%12s%12s\n", "Origin", "Reads", "Bytes", "Time ms");
+	for (size_t idx = 0; idx < num_origins; idx++)
+	{
+		if (stats[idx].reads == 0)
+			continue;
+		const char* origin_size = get_human_readable_size(stats[idx].bytes);
+		printf("  %-28s%10zu%12s%12.2f\n", names[idx], stats[idx].reads, origin_size, (double)stats[idx].time_ns / 1e6);
+		free((void*)origin_size);
+	}
+	printf("\n");
+}
+
+bool replay_trace(const char* trace_path, const char* image_path, const ReplayBackend backend, const bool timed)
+{
+	FILE* trace = fopen(trace_path, "rb");
+	if (!trace)
+	{
+		printf("Could not open %s.\n", trace_path);
+		return false;
+	}
+	setvbuf(trace, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	TraceHeader header;
+	if (fread(&header, sizeof(TraceHeader), 1, trace) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.num_origins == 0 || header.num_origins > MAX_TRACE_ORIGINS)
+	{
+		printf("%s is not a trace.\n", trace_path);
+		fclose(trace);
+		return false;
+	}
+	char (*names)[TRACE_NAME_SIZE] = calloc(header.num_origins, TRACE_NAME_SIZE);
+	if (fread(names, TRACE_NAME_SIZE, header.num_origins, trace) != header.num_origins)
+	{
+		printf("%s is not a trace.\n", trace_path);
+		free(names);
+		fclose(trace);
+		return false;
+	}
+	for (size_t idx = 0; idx < header.num_origins; idx++)
+		names[idx][TRACE_NAME_SIZE - 1] = '\0';
+
+	ReplayImage image;
+	if (!open_replay_image(&image, image_path, backend))
+	{
+		printf("Could not open %s with the %s backend.\n", image_path, backend_names[backend]);
+		close_replay_image(&image);
+		free(names);
+		fclose(trace);
+		return false;
+	}
+
+	OriginStats* stats = calloc(header.num_origins, sizeof(OriginStats));
+	size_t latency_capacity = 1024;
+	uint64_t* latencies = malloc(latency_capacity * sizeof(uint64_t));
+	size_t buffer_size = 0;
+	uint8_t* buffer = NULL;
+	size_t num_reads = 0;
+	uint64_t bytes = 0;
+	bool success = true;
+
+	// reads go out one after another in the order they were logged, which is the order they completed in
+	const uint64_t replay_start = get_time_ns();
+	TraceRecord record;
+	while (fread(&record, sizeof(TraceRecord), 1, trace) == 1)
+	{
+		if (record.origin >= header.num_origins)
+		{
+			printf("Trace record %zu has an unknown origin.\n", num_reads);
+			success = false;
+			break;
+		}
+		if (record.length > buffer_size)
+		{
+			buffer_size = record.length;
+			buffer = realloc(buffer, buffer_size);
+		}
+		if (timed)
+		{
+			// wait until the read is as far into the replay as it was into the recording
+			const uint64_t due = replay_start + record.time_ns;
+			const uint64_t now = get_time_ns();
+			if (due > now)
+			{
+				const struct timespec delay = { (time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000) };
+				thrd_sleep(&delay, NULL);
+			}
+		}
+
+		const uint64_t read_start = get_time_ns();
+		if (!replay_read(&image, record.offset, record.length, buffer))
+		{
+			printf("Could not read %u bytes at offset %llu.\n", record.length, (unsigned long long)record.offset);
+			success = false;
+			break;
+		}
+		const uint64_t latency = get_time_ns() - read_start;
+
+		if (num_reads == latency_capacity)
+		{
+			latency_capacity *= 2;
+			latencies = realloc(latencies, latency_capacity * sizeof(uint64_t));
+		}
+		latencies[num_reads++] = latency;
+		bytes += record.length;
+		stats[record.origin].reads++;
+		stats[record.origin].bytes += record.length;
+		stats[record.origin].time_ns += latency;
+	}
+	const uint64_t elapsed_ns = get_time_ns() - replay_start;
+
+	print_replay_stats((const char (*)[TRACE_NAME_SIZE])names, stats, header.num_origins, latencies, num_reads, bytes,
+		elapsed_ns, backend);
+
+	free(buffer);
+	free(latencies);
+	free(stats);
+	close_replay_image(&image);
+	free(names);
+	fclose(trace);
+	return success;
+}
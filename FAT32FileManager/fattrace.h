@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// magic at the start of every trace file, the last character is the format version
+#define TRACE_MAGIC "FMTRACE1"
+// longest origin name stored in a trace header
+#define TRACE_NAME_SIZE 32
+
+// the function an image read was issued from, stored as a number and named in the trace header
+typedef enum TraceOrigin
+{
+	TRACE_MBR = 0,
+	TRACE_PART_INFO,
+	TRACE_FAT_TABLE,
+	TRACE_GET_DIR,
+	TRACE_GET_DELETED_DIR,
+	TRACE_READ_FILE_RANGE,
+	TRACE_SWEEP,
+	TRACE_SNAPSHOT,
+	TRACE_RECOVER,
+	TRACE_SCAN,
+	TRACE_CARVE,
+	TRACE_STREAM,
+	NUM_TRACE_ORIGINS
+} TraceOrigin;
+
+typedef enum ReplayBackend
+{
+	REPLAY_STDIO = 0,
+	REPLAY_PREAD,
+	REPLAY_MMAP,
+	REPLAY_DIRECT
+} ReplayBackend;
+
+// written to disk as they are, the fields are ordered so neither has padding
+// the header is followed by num_origins names of TRACE_NAME_SIZE bytes, then the records
+typedef struct TraceHeader
+{
+	char magic[8];
+	uint32_t num_origins;
+} TraceHeader;
+
+typedef struct TraceRecord
+{
+	uint64_t time_ns;	// since the trace started
+	uint64_t offset;
+	uint32_t length;
+	uint32_t origin;
+} TraceRecord;
+
+/**
+ * @brief Start logging every image read of this process to a trace file
+ *
+ * @param path Trace file to create
+ * @return true The trace is recording
+ */
+bool start_trace(const char *path);
+/**
+ * @brief Stop the trace and print how much it recorded
+ */
+void stop_trace(void);
+/**
+ * @brief Check if a trace is recording
+ */
+bool is_tracing(void);
+/**
+ * @brief Get the clock trace records are stamped with, taken right before a read is issued
+ */
+uint64_t get_trace_time(void);
+/**
+ * @brief Log one read of the image, does nothing unless a trace is recording
+ *
+ * @param origin Function the read came from
+ * @param offset Offset in the image
+ * @param length Number of bytes read
+ * @param start_time get_trace_time from before the read, so replay issues it when it was issued
+ */
+void trace_read(TraceOrigin origin, uint64_t offset, size_t length, uint64_t start_time);
+/**
+ * @brief Get the number of image bytes the calling thread has read, traced or not
+ */
+uint64_t get_thread_read_bytes(void);
+/**
+ * @brief Look up a replay backend by name
+ *
+ * @param name stdio, pread, mmap or direct
+ * @param backend Output for the backend
+ * @return true The name is a backend
+ */
+bool parse_replay_backend(const char *name, ReplayBackend *backend);
+/**
+ * @brief Issue every read of a trace against an image again and report how the backend did
+ *
+ * @param trace_path Recorded trace
+ * @param image_path Disk image to read
+ * @param backend How to read the image
+ * @param timed Keep the gaps between reads from the recording instead of reading at full speed
+ * @return true Every read was replayed
+ */
+bool replay_trace(const char *trace_path, const char *image_path, ReplayBackend backend, bool timed);
@@ -0,0 +1,416 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "fatusage.h"
+#include "utilties.h"
+#include "workpool.h"
+
+typedef struct UsageShared
+{
+	const FatVolume *volume;
+	const char *image_path;
+	const Snapshot *snapshot;
+	uint64_t start_offset;
+
+	mtx_t lock;
+	cnd_t wake;
+	UsageNode *nodes;
+	size_t num_nodes;
+	size_t capacity;
+	size_t *queue;			// directories waiting to be read, only ever appended to
+	size_t queue_head;
+	size_t queue_tail;
+	size_t queue_capacity;
+	size_t busy;			// workers reading a directory, more work can show up until this is 0
+	uint64_t *visited;		// directory clusters already queued
+} UsageShared;
+
+typedef struct UsageWorker
+{
+	WorkRange range;
+	UsageShared *shared;
+} UsageWorker;
+
+typedef struct UsageFrame
+{
+	const UsageNode *node;
+	size_t next_child;
+} UsageFrame;
+
+static bool test_bit(const uint64_t* bitmap, const uint32_t bit)
+{
+	return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit(uint64_t* bitmap, const uint32_t bit)
+{
+	bitmap[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static bool is_skipped(const FileRecord* record)
+{
+	// same rules as the volume walk: no labels and no . and .. links
+	return record->volume_id || (record->directory && record->filename[0] == '.');
+}
+
+static uint64_t count_clusters(const FatVolume* volume, const uint32_t cluster)
+{
+	if (cluster < 2 || cluster >= volume->num_fat_entries)
+		return 0;
+
+	// a chain that loops stops once it has taken as many links as the FAT has entries
+	size_t steps_taken = 0;
+	volume->ops->advance_chain(volume->fat_table, volume->num_fat_entries, cluster, volume->num_fat_entries, &steps_taken);
+	return (uint64_t)steps_taken + 1;
+}
+
+static void push_dir(UsageShared* shared, const size_t node_idx)
+{
+	if (shared->queue_tail == shared->queue_capacity)
+	{
+		shared->queue_capacity *= 2;
+		shared->queue = realloc(shared->queue, shared->queue_capacity * sizeof(size_t));
+	}
+	shared->queue[shared->queue_tail++] = node_idx;
+}
+
+static size_t append_node(UsageShared* shared, const FileRecord* record, const size_t parent, const uint64_t clusters)
+{
+	if (shared->num_nodes == shared->capacity)
+	{
+		shared->capacity *= 2;
+		shared->nodes = realloc(shared->nodes, shared->capacity * sizeof(UsageNode));
+	}
+	UsageNode* node = &shared->nodes[shared->num_nodes];
+	memset(node, 0, sizeof(UsageNode));
+	memcpy(&node->record, record, sizeof(FileRecord));
+	node->parent = parent;
+	node->clusters = clusters;
+	return shared->num_nodes++;
+}
+
+static int walk_directories(void* arg)
+{
+	UsageWorker* worker = arg;
+	UsageShared* shared = worker->shared;
+	const FatVolume* volume = shared->volume;
+
+	// every worker seeks on its own handle, they never wait on each other for I/O
+	FILE* fp = fopen(shared->image_path, "rb");
+	if (!fp)
+		return 1;
+
+	mtx_lock(&shared->lock);
+	while (true)
+	{
+		while (shared->queue_head == shared->queue_tail && shared->busy > 0)
+			cnd_wait(&shared->wake, &shared->lock);
+		// nothing queued and nobody left who could queue more
+		if (shared->queue_head == shared->queue_tail)
+			break;
+
+		const size_t dir_idx = shared->queue[shared->queue_head++];
+		const uint64_t offset = dir_idx == 0 ? shared->start_offset : get_cluster_offset(volume->part_info,
+			volume->part_offsets, volume->ops->get_cluster_number(&shared->nodes[dir_idx].record));
+		shared->busy++;
+		mtx_unlock(&shared->lock);
+
+		size_t num_records = 0;
+		FileRecord* records = snapshot_get_dir(shared->snapshot, offset, &num_records);
+		if (!records)
+			records = get_dir(fp, offset, &num_records);
+
+		// follow the chains before taking the lock, the FAT is only ever read
+		uint64_t* clusters = calloc(num_records + 1, sizeof(uint64_t));
+		for (size_t idx = 0; idx < num_records; idx++)
+		{
+			if (!is_skipped(&records[idx]))
+				clusters[idx] = count_clusters(volume, volume->ops->get_cluster_number(&records[idx]));
+		}
+
+		mtx_lock(&shared->lock);
+		for (size_t idx = 0; idx < num_records; idx++)
+		{
+			if (is_skipped(&records[idx]))
+				continue;
+			const size_t node_idx = append_node(shared, &records[idx], dir_idx, clusters[idx]);
+
+			// a directory pointing back at the root or at one we already queued would be read forever
+			const uint32_t cluster = volume->ops->get_cluster_number(&records[idx]);
+			if (!records[idx].directory || cluster < 2 || cluster >= volume->num_fat_entries ||
+				test_bit(shared->visited, cluster))
+				continue;
+			set_bit(shared->visited, cluster);
+			push_dir(shared, node_idx);
+		}
+		shared->busy--;
+		cnd_broadcast(&shared->wake);
+		mtx_unlock(&shared->lock);
+
+		free(clusters);
+		free(records);
+		mtx_lock(&shared->lock);
+	}
+	mtx_unlock(&shared->lock);
+
+	fclose(fp);
+	return 0;
+}
+
+static int compare_nodes(const void* a, const void* b)
+{
+	// names only repeat on a damaged volume, fall back on the cluster so the order never depends on the walk
+	const UsageNode* node_a = *(const UsageNode* const*)a;
+	const UsageNode* node_b = *(const UsageNode* const*)b;
+	const int order = strcmp(node_a->name, node_b->name);
+	if (order != 0)
+		return order;
+	const uint32_t cluster_a = ((uint32_t)node_a->record.first_cluster_hi << 16) | node_a->record.first_cluster_lo;
+	const uint32_t cluster_b = ((uint32_t)node_b->record.first_cluster_hi << 16) | node_b->record.first_cluster_lo;
+	return (cluster_a > cluster_b) - (cluster_a < cluster_b);
+}
+
+static void sum_subtrees(UsageTree* tree)
+{
+	// children always come after their parent, so going backwards every subtree is complete before it is added up
+	for (size_t idx = tree->num_nodes; idx-- > 0;)
+	{
+		UsageNode* node = &tree->nodes[idx];
+		node->total_clusters += node->clusters;
+		if (idx == 0)
+			break;
+
+		UsageNode* parent = &tree->nodes[node->parent];
+		if (node->record.directory)
+			parent->total_dirs += 1;
+		else
+		{
+			parent->total_files += 1;
+			node->total_size += node->record.file_size;
+		}
+		parent->total_size += node->total_size;
+		parent->total_clusters += node->total_clusters;
+		parent->total_files += node->total_files;
+		parent->total_dirs += node->total_dirs;
+	}
+}
+
+static void sort_children(UsageTree* tree)
+{
+	for (size_t idx = 1; idx < tree->num_nodes; idx++)
+	{
+		strcpy(tree->nodes[idx].name, get_short_filename(&tree->nodes[idx].record));
+		tree->nodes[tree->nodes[idx].parent].num_children++;
+	}
+
+	// group the children by parent, then sort every group by name
+	size_t first_child = 0;
+	for (size_t idx = 0; idx < tree->num_nodes; idx++)
+	{
+		tree->nodes[idx].first_child = first_child;
+		first_child += tree->nodes[idx].num_children;
+	}
+	size_t* filled = calloc(tree->num_nodes, sizeof(size_t));
+	tree->children = malloc((tree->num_nodes + 1) * sizeof(UsageNode*));
+	for (size_t idx = 1; idx < tree->num_nodes; idx++)
+	{
+		const size_t parent = tree->nodes[idx].parent;
+		tree->children[tree->nodes[parent].first_child + filled[parent]++] = &tree->nodes[idx];
+	}
+	free(filled);
+
+	for (size_t idx = 0; idx < tree->num_nodes; idx++)
+	{
+		if (tree->nodes[idx].num_children > 1)
+			qsort(&tree->children[tree->nodes[idx].first_child], tree->nodes[idx].num_children, sizeof(UsageNode*),
+				compare_nodes);
+	}
+}
+
+UsageTree* load_usage_tree(const FatVolume* volume, const char* image_path, const Snapshot* snapshot,
+	const uint64_t start_offset, const uint32_t start_cluster, const size_t num_threads)
+{
+	// make sure the workers will be able to open the image before starting them
+	FILE* probe = fopen(image_path, "rb");
+	if (!probe)
+		return NULL;
+	fclose(probe);
+
+	UsageShared shared;
+	memset(&shared, 0, sizeof(UsageShared));
+	shared.volume = volume;
+	shared.image_path = image_path;
+	shared.snapshot = snapshot;
+	shared.start_offset = start_offset;
+	shared.capacity = 64;
+	shared.nodes = malloc(shared.capacity * sizeof(UsageNode));
+	shared.queue_capacity = 16;
+	shared.queue = malloc(shared.queue_capacity * sizeof(size_t));
+	shared.visited = calloc((volume->num_fat_entries + 63) / 64 + 1, sizeof(uint64_t));
+	mtx_init(&shared.lock, mtx_plain);
+	cnd_init(&shared.wake);
+
+	// the directory we start from has no record of its own, only its chain
+	FileRecord start_record;
+	memset(&start_record, 0, sizeof(FileRecord));
+	start_record.directory = 1;
+	append_node(&shared, &start_record, SIZE_MAX, count_clusters(volume, start_cluster));
+	if (start_cluster >= 2 && start_cluster < volume->num_fat_entries)
+		set_bit(shared.visited, start_cluster);
+	push_dir(&shared, 0);
+
+	UsageWorker* workers = calloc(num_threads, sizeof(UsageWorker));
+	for (size_t idx = 0; idx < num_threads; idx++)
+		workers[idx].shared = &shared;
+	run_parallel(workers, sizeof(UsageWorker), num_threads, walk_directories, 0, num_threads);
+
+	free(workers);
+	cnd_destroy(&shared.wake);
+	mtx_destroy(&shared.lock);
+	free(shared.visited);
+	free(shared.queue);
+
+	UsageTree* tree = calloc(1, sizeof(UsageTree));
+	tree->nodes = shared.nodes;
+	tree->num_nodes = shared.num_nodes;
+	tree->cluster_size = get_cluster_size(volume->part_info);
+	tree->num_threads = num_threads;
+	sum_subtrees(tree);
+	sort_children(tree);
+	return tree;
+}
+
+void free_usage_tree(UsageTree* tree)
+{
+	if (!tree)
+		return;
+	free(tree->children);
+	free(tree->nodes);
+	free(tree);
+}
+
+static char* get_node_path(const UsageTree* tree, const UsageNode* node, const char* label)
+{
+	// walk up to the start, then fill the names in from the back
+	size_t length = 0;
+	for (const UsageNode* step = node; step != tree->nodes; step = &tree->nodes[step->parent])
+		length += strlen(step->name) + 1;
+
+	// a label that already ends in a separator does not get a second one
+	const size_t label_length = strlen(label);
+	const bool has_separator = label_length > 0 && (label[label_length - 1] == '/' || label[label_length - 1] == '\\');
+	const size_t skip = has_separator && length > 0 ? 1 : 0;
+	char* path = malloc(label_length + length + 1);
+	memcpy(path, label, label_length);
+	size_t end = label_length + length - skip;
+	path[end] = '\0';
+	for (const UsageNode* step = node; step != tree->nodes; step = &tree->nodes[step->parent])
+	{
+		const size_t name_length = strlen(step->name);
+		end -= name_length;
+		memcpy(&path[end], step->name, name_length);
+		if (end > label_length)
+			path[--end] = '/';
+	}
+	return path;
+}
+
+static void push_frame(UsageFrame** stack, size_t* depth, size_t* capacity, const UsageNode* node)
+{
+	if (*depth == *capacity)
+	{
+		*capacity *= 2;
+		*stack = realloc(*stack, *capacity * sizeof(UsageFrame));
+	}
+	(*stack)[*depth].node = node;
+	(*stack)[*depth].next_child = 0;
+	*depth += 1;
+}
+
+static void print_totals(const UsageTree* tree, FILE* out)
+{
+	const UsageNode* start = &tree->nodes[0];
+	char* size = (char*)get_human_readable_size(start->total_size);
+	char* allocated = (char*)get_human_readable_size(start->total_clusters * tree->cluster_size);
+	fprintf(out, "%zu directories, %zu files, %s in files, %s allocated, walked with %zu threads.\n\n",
+		start->total_dirs, start->total_files, size, allocated, tree->num_threads);
+	free(allocated);
+	free(size);
+}
+
+void print_disk_usage(const UsageTree* tree, const size_t max_depth, const char* label, FILE* out)
+{
+	fprintf(out, "%12s%12s%10s  %s\n", "Size", "Allocated", "Files", "Path");
+
+	// depth first without recursion, a directory is printed once everything below it has been
+	size_t capacity = 64;
+	size_t depth = 0;
+	UsageFrame* stack = malloc(capacity * sizeof(UsageFrame));
+	push_frame(&stack, &depth, &capacity, &tree->nodes[0]);
+	while (depth > 0)
+	{
+		UsageFrame* frame = &stack[depth - 1];
+		if (frame->next_child < frame->node->num_children)
+		{
+			const UsageNode* child = tree->children[frame->node->first_child + frame->next_child++];
+			if (child->record.directory && depth <= max_depth)
+				push_frame(&stack, &depth, &capacity, child);
+			continue;
+		}
+
+		const UsageNode* node = frame->node;
+		char* path = get_node_path(tree, node, label);
+		char* size = (char*)get_human_readable_size(node->total_size);
+		char* allocated = (char*)get_human_readable_size(node->total_clusters * tree->cluster_size);
+		fprintf(out, "%12s%12s%10zu  %s\n", size, allocated, node->total_files, path);
+		free(allocated);
+		free(size);
+		free(path);
+		depth--;
+	}
+	free(stack);
+	print_totals(tree, out);
+}
+
+void print_usage_tree(const UsageTree* tree, const char* label, FILE* out)
+{
+	char* start_path = get_node_path(tree, &tree->nodes[0], label);
+	char* start_size = (char*)get_human_readable_size(tree->nodes[0].total_size);
+	fprintf(out, "%s  %s\n", start_path, start_size);
+	free(start_size);
+	free(start_path);
+
+	// depth first without recursion, each frame remembers which child comes next
+	size_t capacity = 64;
+	size_t depth = 0;
+	UsageFrame* stack = malloc(capacity * sizeof(UsageFrame));
+	push_frame(&stack, &depth, &capacity, &tree->nodes[0]);
+	while (depth > 0)
+	{
+		UsageFrame* frame = &stack[depth - 1];
+		if (frame->next_child == frame->node->num_children)
+		{
+			depth--;
+			continue;
+		}
+		const UsageNode* child = tree->children[frame->node->first_child + frame->next_child++];
+
+		// an ancestor that still has siblings to come keeps its line going
+		for (size_t level = 1; level < depth; level++)
+			fputs(stack[level - 1].next_child < stack[level - 1].node->num_children ? "|   " : "    ", out);
+		fputs(frame->next_child < frame->node->num_children ? "|-- " : "`-- ", out);
+
+		char* size = (char*)get_human_readable_size(child->record.directory ? child->total_size : child->record.file_size);
+		fprintf(out, "%s%s  %s\n", child->name, child->record.directory ? "/" : "", size);
+		free(size);
+
+		if (child->num_children > 0)
+			push_frame(&stack, &depth, &capacity, child);
+	}
+	free(stack);
+	print_totals(tree, out);
+}
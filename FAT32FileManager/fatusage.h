@@ -0,0 +1,69 @@
+#pragma once
+#include <stdio.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+#include "fatchain.h"
+
+typedef struct UsageNode
+{
+	FileRecord record;
+	char name[13];
+	size_t parent;			// SIZE_MAX for the directory the walk started from
+	size_t first_child;		// into UsageTree.children
+	size_t num_children;
+	uint64_t clusters;		// clusters allocated to this entry's own chain
+	uint64_t total_size;	// file sizes of the whole subtree
+	uint64_t total_clusters;
+	size_t total_files;
+	size_t total_dirs;
+} UsageNode;
+
+typedef struct UsageTree
+{
+	UsageNode *nodes;		// parents always come before their children, nodes[0] is the start
+	size_t num_nodes;
+	UsageNode **children;	// grouped by parent, sorted by name
+	size_t cluster_size;
+	size_t num_threads;
+} UsageTree;
+
+/**
+ * @brief Walk a directory and everything below it with a shared queue of directories, summing the subtrees
+ *
+ * Every worker reads directories through its own handle on the image and queues the subdirectories it
+ * finds for whichever worker is free. Allocated clusters come from the chains in the in-memory FAT.
+ *
+ * @param volume Volume to walk, needs the FAT in memory
+ * @param image_path Disk image, opened again per worker
+ * @param snapshot Sidecar snapshot to read directories from, may be NULL
+ * @param start_offset Offset of the directory to start from
+ * @param start_cluster First cluster of that directory, 0 for the FAT12/16 root
+ * @param num_threads Number of worker threads
+ * @return UsageTree* Every entry below the directory with subtree totals, NULL if the image could not be opened
+ */
+UsageTree *load_usage_tree(const FatVolume *volume, const char *image_path, const Snapshot *snapshot,
+						   uint64_t start_offset, uint32_t start_cluster, size_t num_threads);
+/**
+ * @brief Destroy a usage tree
+ *
+ * @param tree Tree to destroy
+ */
+void free_usage_tree(UsageTree *tree);
+/**
+ * @brief Print the totals of every directory down to a depth, children before their parent
+ *
+ * @param tree Walked tree
+ * @param max_depth Deepest directory level to print, the start is level 0
+ * @param label Name to print for the start directory
+ * @param out Stream to print to
+ */
+void print_disk_usage(const UsageTree *tree, size_t max_depth, const char *label, FILE *out);
+/**
+ * @brief Print every entry of the tree indented under its directory, sorted by name
+ *
+ * @param tree Walked tree
+ * @param label Name to print for the start directory
+ * @param out Stream to print to
+ */
+void print_usage_tree(const UsageTree *tree, const char *label, FILE *out);
@@ -0,0 +1,139 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatwalk.h"
+#include "fatwidth.h"
+
+void append_volume_entry(VolumeTree* tree, size_t* capacity, const FileRecord* record, const size_t parent)
+{
+	if (tree->num_entries == *capacity)
+	{
+		*capacity *= 2;
+		tree->entries = realloc(tree->entries, *capacity * sizeof(VolumeEntry));
+	}
+
+	// build the full path from the parent's path
+	const char* name = get_short_filename(record);
+	const char* parent_path = parent == SIZE_MAX ? "" : tree->entries[parent].path;
+	char* path = malloc(strlen(parent_path) + strlen(name) + 2);
+	if (parent == SIZE_MAX)
+		strcpy(path, name);
+	else
+		sprintf(path, "%s/%s", parent_path, name);
+
+	VolumeEntry* entry = &tree->entries[tree->num_entries];
+	memcpy(&entry->record, record, sizeof(FileRecord));
+	entry->parent = parent;
+	entry->path = path;
+	tree->num_entries += 1;
+}
+
+bool is_tree_record(const FileRecord* record)
+{
+	// volume labels, long filename fragments and the . and .. links are not entries of their own
+	return !record->volume_id && !(record->directory && record->filename[0] == '.');
+}
+
+VolumeTree* walk_volume_tree(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, const size_t num_fat_entries, const VolumeWalkHooks* hooks)
+{
+	const FatOps* ops = get_fat_ops(part_type);
+	VolumeTree* tree = calloc(1, sizeof(VolumeTree));
+	size_t capacity = 64;
+	tree->entries = malloc(capacity * sizeof(VolumeEntry));
+
+	// every directory is opened once, the FAT32 root has a cluster of its own that nothing may point back at
+	uint8_t* visited = calloc(num_fat_entries + 1, sizeof(uint8_t));
+	if (is_fat32(part_type) && part_info->root_dir_first_cluster < num_fat_entries)
+		visited[part_info->root_dir_first_cluster] = 1;
+
+	// directories are visited in the order they are found, so the tree itself is the work queue
+	// SIZE_MAX is the root directory
+	size_t next_dir = SIZE_MAX;
+	size_t scan_idx = 0;
+	while (true)
+	{
+		const uint64_t offset = next_dir == SIZE_MAX ? part_offsets->root_dir :
+			get_cluster_offset(part_info, part_offsets, ops->get_cluster_number(&tree->entries[next_dir].record));
+
+		size_t num_records = 0;
+		FileRecord* records = snapshot_get_dir(snapshot, offset, &num_records);
+		if (!records)
+			records = get_dir(fp, offset, &num_records);
+		const size_t first_entry = tree->num_entries;
+		for (size_t idx = 0; idx < num_records; idx++)
+		{
+			if (is_tree_record(&records[idx]))
+				append_volume_entry(tree, &capacity, &records[idx], next_dir);
+		}
+		if (hooks && hooks->on_listing)
+			hooks->on_listing(hooks->context, tree, records, num_records, first_entry);
+		free(records);
+
+		// find the next directory we have not opened yet
+		// a directory pointing at cluster 0 or 1 would loop back to the root, so never open it
+		next_dir = SIZE_MAX;
+		for (; scan_idx < tree->num_entries && next_dir == SIZE_MAX; scan_idx++)
+		{
+			const VolumeEntry* entry = &tree->entries[scan_idx];
+			const uint32_t cluster = ops->get_cluster_number(&entry->record);
+			if (!entry->record.directory || cluster < 2)
+				continue;
+			if (cluster >= num_fat_entries || visited[cluster])
+			{
+				// a repeated cluster is a cycle or a cross-link, its contents are already in the tree
+				if (hooks && hooks->on_skipped)
+					hooks->on_skipped(hooks->context, tree, scan_idx, cluster, cluster >= num_fat_entries);
+				continue;
+			}
+			visited[cluster] = 1;
+			next_dir = scan_idx;
+		}
+		if (next_dir == SIZE_MAX)
+			break;
+	}
+
+	free(visited);
+	return tree;
+}
+
+static void report_skipped(void* context, const VolumeTree* tree, const size_t entry, const uint32_t cluster,
+	const bool past_end)
+{
+	fprintf(context, "Skipped directory %s, cluster %u %s.\n", tree->entries[entry].path, cluster,
+		past_end ? "is past the end of the FAT" : "was already listed");
+}
+
+VolumeTree* load_volume_tree(FILE* fp, const PartitionInfo* part_info, const PartitionLocations* part_offsets,
+	const PartitionType part_type, const Snapshot* snapshot, const size_t num_fat_entries, FILE* out)
+{
+	const VolumeWalkHooks hooks = { out, NULL, report_skipped };
+	return walk_volume_tree(fp, part_info, part_offsets, part_type, snapshot, num_fat_entries, out ? &hooks : NULL);
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+	return strcmp((*(const VolumeEntry* const*)a)->path, (*(const VolumeEntry* const*)b)->path);
+}
+
+const VolumeEntry** sort_by_path(const VolumeTree* tree)
+{
+	const VolumeEntry** sorted = malloc((tree->num_entries + 1) * sizeof(VolumeEntry*));
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+		sorted[idx] = &tree->entries[idx];
+	qsort(sorted, tree->num_entries, sizeof(VolumeEntry*), compare_paths);
+	return sorted;
+}
+
+void free_volume_tree(VolumeTree* tree)
+{
+	if (!tree)
+		return;
+	for (size_t idx = 0; idx < tree->num_entries; idx++)
+		free(tree->entries[idx].path);
+	free(tree->entries);
+	free(tree);
+}
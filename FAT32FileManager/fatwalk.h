@@ -0,0 +1,96 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+#include "fatsnapshot.h"
+
+typedef struct VolumeEntry
+{
+	FileRecord record;
+	size_t parent;
+	char *path;
+} VolumeEntry;
+
+typedef struct VolumeTree
+{
+	VolumeEntry *entries;
+	size_t num_entries;
+} VolumeTree;
+
+// optional calls made while walking a volume, for callers that need more than the flat tree
+typedef struct VolumeWalkHooks
+{
+	void *context;
+	// every directory listing read, the tree entries from first_entry on came from it in order
+	void (*on_listing)(void *context, const VolumeTree *tree, const FileRecord *records, size_t num_records,
+					   size_t first_entry);
+	// a directory kept as an entry but not walked, its cluster was opened before or is past the end of the FAT
+	void (*on_skipped)(void *context, const VolumeTree *tree, size_t entry, uint32_t cluster, bool past_end);
+} VolumeWalkHooks;
+
+/**
+ * @brief Check whether a directory record becomes an entry of a volume tree
+ *
+ * Volume labels, long filename fragments and the . and .. links are left out.
+ *
+ * @param record Directory entry
+ * @return true The record is an entry of its own
+ */
+bool is_tree_record(const FileRecord *record);
+/**
+ * @brief Walk every directory of the partition and flatten it into a list, calling hooks along the way
+ *
+ * A directory whose first cluster was already opened is kept as an entry but not walked again.
+ *
+ * @param fp Disk image
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param part_type Partition filesystem type
+ * @param snapshot Sidecar snapshot to read directories from, may be NULL
+ * @param num_fat_entries Number of clusters in the FAT, a directory starting past it is not opened
+ * @param hooks Calls to make for every listing and skipped directory, may be NULL
+ * @return VolumeTree* Every file and directory on the partition, parents before children
+ */
+VolumeTree *walk_volume_tree(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+							 const PartitionType part_type, const Snapshot *snapshot, const size_t num_fat_entries,
+							 const VolumeWalkHooks *hooks);
+/**
+ * @brief Walk every directory of the partition and flatten it into a list
+ *
+ * A directory whose first cluster was already opened is kept as an entry but not walked again.
+ *
+ * @param fp Disk image
+ * @param part_info Partition boot sector
+ * @param part_offsets Partition offsets
+ * @param part_type Partition filesystem type
+ * @param snapshot Sidecar snapshot to read directories from, may be NULL
+ * @param num_fat_entries Number of clusters in the FAT, a directory starting past it is not opened
+ * @param out Stream to report directories skipped as cycles to, may be NULL
+ * @return VolumeTree* Every file and directory on the partition, parents before children
+ */
+VolumeTree *load_volume_tree(FILE *fp, const PartitionInfo *part_info, const PartitionLocations *part_offsets,
+							 const PartitionType part_type, const Snapshot *snapshot, const size_t num_fat_entries,
+							 FILE *out);
+/**
+ * @brief Add an entry to a tree, its path built from the parent's
+ *
+ * @param tree Tree to add to
+ * @param capacity Allocated entries, grown as needed
+ * @param record Directory entry
+ * @param parent Index of the directory the entry is in, SIZE_MAX for the root
+ */
+void append_volume_entry(VolumeTree *tree, size_t *capacity, const FileRecord *record, const size_t parent);
+/**
+ * @brief List the entries of a tree ordered by path
+ *
+ * @param tree Tree to sort, it is left as it is
+ * @return const VolumeEntry** Pointers into the tree, free the array when done
+ */
+const VolumeEntry **sort_by_path(const VolumeTree *tree);
+/**
+ * @brief Destroy a volume tree
+ *
+ * @param tree Tree to destroy
+ */
+void free_volume_tree(VolumeTree *tree);
@@ -0,0 +1,136 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatwidth.h"
+
+static uint8_t* decode_fat12(uint8_t* raw_fat, const size_t fat_bytes, size_t* num_fat_entries)
+{
+	// every 3 bytes pack 2 entries, unpack them once at mount so lookups are plain 16 bit loads
+	// a FAT whose size is not a multiple of 3 ends in a lone even entry, as a 1 sector FAT does
+	const size_t num_entries = fat_bytes * 2 / 3;
+	uint16_t* table = malloc((num_entries + 1) * sizeof(uint16_t));
+	if (!table)
+	{
+		free(raw_fat);
+		return NULL;
+	}
+	size_t byte = 0;
+	size_t entry = 0;
+
+	// 4 entries out of 6 bytes, assembled little endian whatever the host is, compilers turn it into one load
+	for (; byte + 6 <= fat_bytes && entry + 4 <= num_entries; byte += 6, entry += 4)
+	{
+		const uint64_t packed = (uint64_t)raw_fat[byte] | (uint64_t)raw_fat[byte + 1] << 8 |
+			(uint64_t)raw_fat[byte + 2] << 16 | (uint64_t)raw_fat[byte + 3] << 24 |
+			(uint64_t)raw_fat[byte + 4] << 32 | (uint64_t)raw_fat[byte + 5] << 40;
+		table[entry] = (uint16_t)(packed & 0xFFF);
+		table[entry + 1] = (uint16_t)((packed >> 12) & 0xFFF);
+		table[entry + 2] = (uint16_t)((packed >> 24) & 0xFFF);
+		table[entry + 3] = (uint16_t)((packed >> 36) & 0xFFF);
+	}
+	for (; entry + 2 <= num_entries; byte += 3, entry += 2)
+	{
+		table[entry] = (uint16_t)(raw_fat[byte] | ((raw_fat[byte + 1] & 0x0F) << 8));
+		table[entry + 1] = (uint16_t)((raw_fat[byte + 1] >> 4) | (raw_fat[byte + 2] << 4));
+	}
+	if (entry < num_entries)
+		table[entry] = (uint16_t)(raw_fat[byte] | ((raw_fat[byte + 1] & 0x0F) << 8));
+
+	free(raw_fat);
+	*num_fat_entries = num_entries;
+	return (uint8_t*)table;
+}
+
+static uint8_t* decode_fat16(uint8_t* raw_fat, const size_t fat_bytes, size_t* num_fat_entries)
+{
+	*num_fat_entries = fat_bytes / sizeof(uint16_t);
+	return raw_fat;
+}
+
+static uint8_t* decode_fat32(uint8_t* raw_fat, const size_t fat_bytes, size_t* num_fat_entries)
+{
+	*num_fat_entries = fat_bytes / sizeof(uint32_t);
+	return raw_fat;
+}
+
+/*
+ * One copy of every function per FAT width, the entry type, mask and end of chain marker are constants
+ * inside each, so the compiler can keep the chain loops down to a load, a mask and a compare.
+ */
+#define DEFINE_FAT_OPS(WIDTH, ENTRY_TYPE, ENTRY_MASK, END_OF_CHAIN, BAD_CLUSTER, DECODE_FAT, TABLE_SIZE,			\
+	ROOT_DIR_SIZE, CLUSTER_NUMBER)																					\
+	static size_t get_fat_sectors_##WIDTH(const PartitionInfo* part_info)											\
+	{																												\
+		return TABLE_SIZE;																							\
+	}																												\
+	static size_t get_root_dir_size_##WIDTH(const PartitionInfo* part_info)										\
+	{																												\
+		(void)part_info;																							\
+		return ROOT_DIR_SIZE;																						\
+	}																												\
+	static uint32_t get_cluster_number_##WIDTH(const FileRecord* record)											\
+	{																												\
+		return CLUSTER_NUMBER;																						\
+	}																												\
+	static uint32_t get_fat_entry_##WIDTH(const uint8_t* fat_table, const uint32_t cluster_number)				\
+	{																												\
+		return ((const ENTRY_TYPE*)fat_table)[cluster_number] & (ENTRY_MASK);										\
+	}																												\
+	static uint32_t next_cluster_##WIDTH(const uint8_t* fat_table, const size_t num_fat_entries,					\
+		const uint32_t cluster_number)																				\
+	{																												\
+		const uint32_t next_cluster = ((const ENTRY_TYPE*)fat_table)[cluster_number] & (ENTRY_MASK);				\
+		if (next_cluster < 2 || next_cluster >= (END_OF_CHAIN) || next_cluster >= num_fat_entries)					\
+			return 0;																								\
+		return next_cluster;																						\
+	}																												\
+	static uint32_t advance_chain_##WIDTH(const uint8_t* fat_table, const size_t num_fat_entries,					\
+		uint32_t cluster_number, const size_t steps, size_t* steps_taken)											\
+	{																												\
+		const ENTRY_TYPE* table = (const ENTRY_TYPE*)fat_table;														\
+		size_t step = 0;																							\
+		for (; step < steps; step++)																				\
+		{																											\
+			const uint32_t next_cluster = table[cluster_number] & (ENTRY_MASK);										\
+			if (next_cluster < 2 || next_cluster >= (END_OF_CHAIN) || next_cluster >= num_fat_entries)				\
+				break;																								\
+			cluster_number = next_cluster;																			\
+		}																											\
+		*steps_taken = step;																						\
+		return cluster_number;																						\
+	}																												\
+	static const FatOps fat_ops_##WIDTH =																			\
+	{																												\
+		#WIDTH, sizeof(ENTRY_TYPE), (ENTRY_MASK), (END_OF_CHAIN), (BAD_CLUSTER), DECODE_FAT, get_fat_sectors_##WIDTH,\
+		get_root_dir_size_##WIDTH, get_cluster_number_##WIDTH, get_fat_entry_##WIDTH, next_cluster_##WIDTH,		\
+		advance_chain_##WIDTH																						\
+	};
+
+// FAT12 shares the FAT16 layout once its table is unpacked, only the markers are narrower
+DEFINE_FAT_OPS(FAT12, uint16_t, 0x0FFF, 0x0FF0, 0x0FF7, decode_fat12, part_info->fat16_table_size,
+	(size_t)part_info->root_dir_entries * sizeof(FileRecord), record->first_cluster_lo)
+DEFINE_FAT_OPS(FAT16, uint16_t, 0xFFFF, 0xFFF0, 0xFFF7, decode_fat16, part_info->fat16_table_size,
+	(size_t)part_info->root_dir_entries * sizeof(FileRecord), record->first_cluster_lo)
+// FAT32 only uses the low 28 bits of an entry and keeps its root directory in the data region
+DEFINE_FAT_OPS(FAT32, uint32_t, 0x0FFFFFFF, 0x0FFFFFF0, 0x0FFFFFF7, decode_fat32, part_info->fat32_table_size,
+	0, ((uint32_t)record->first_cluster_hi << 16) | record->first_cluster_lo)
+
+const FatOps* get_fat_ops(const PartitionType part_type)
+{
+	switch (part_type)
+	{
+	case FAT12:
+		return &fat_ops_FAT12;
+	case FAT16_LBA:
+	case FAT16_B:
+		return &fat_ops_FAT16;
+	case FAT32_CHS:
+	case FAT32_LBA:
+		return &fat_ops_FAT32;
+	default:
+		return NULL;
+	}
+}
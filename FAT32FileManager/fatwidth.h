@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fatparser.h"
+
+/*
+ * Everything that depends on how wide a FAT entry is, generated once per width so loops over the FAT
+ * never test the partition type. Pick the table with get_fat_ops when a partition is selected and call
+ * through it from then on.
+ */
+typedef struct FatOps
+{
+	const char *name;
+	size_t fat_entry_size;	// in the table read_fat_table returns, FAT12 is unpacked to 16 bits
+	uint32_t entry_mask;
+	uint32_t end_of_chain;	// first value that ends a chain, after masking
+	uint32_t bad_cluster;
+
+	/**
+	 * @brief Turn a FAT copy as stored on disk into the table the other functions index
+	 *
+	 * @param raw_fat FAT copy read from disk, ownership passes to the function
+	 * @param fat_bytes Size of the copy
+	 * @param num_fat_entries Output for the number of entries
+	 * @return uint8_t* Table to index, may be raw_fat itself, NULL if it could not be allocated and raw_fat is freed
+	 */
+	uint8_t *(*decode_fat)(uint8_t *raw_fat, size_t fat_bytes, size_t *num_fat_entries);
+	/**
+	 * @brief Number of sectors in one FAT copy
+	 */
+	size_t (*get_fat_sectors)(const PartitionInfo *part_info);
+	/**
+	 * @brief Bytes of fixed root directory region between the FATs and the data region
+	 */
+	size_t (*get_root_dir_size)(const PartitionInfo *part_info);
+	/**
+	 * @brief First cluster of a directory entry
+	 */
+	uint32_t (*get_cluster_number)(const FileRecord *record);
+	/**
+	 * @brief Value of one FAT entry
+	 */
+	uint32_t (*get_fat_entry)(const uint8_t *fat_table, uint32_t cluster_number);
+	/**
+	 * @brief Follow one link, 0 if the chain ends or leaves the table
+	 */
+	uint32_t (*next_cluster)(const uint8_t *fat_table, size_t num_fat_entries, uint32_t cluster_number);
+	/**
+	 * @brief Follow up to a number of links in one tight loop
+	 *
+	 * @param fat_table FAT copy
+	 * @param num_fat_entries Entries in the table
+	 * @param cluster_number Cluster to start from
+	 * @param steps Links to follow
+	 * @param steps_taken Links actually followed, fewer than asked if the chain ended
+	 * @return uint32_t Cluster reached
+	 */
+	uint32_t (*advance_chain)(const uint8_t *fat_table, size_t num_fat_entries, uint32_t cluster_number, size_t steps,
+							  size_t *steps_taken);
+} FatOps;
+
+/**
+ * @brief Get the FAT width specific functions for a partition type
+ *
+ * @param part_type Partition filesystem type
+ * @return const FatOps* Functions for the type, NULL if it is not a FAT we read
+ */
+const FatOps *get_fat_ops(PartitionType part_type);
@@ -4,15 +4,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/stat.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "utilties.h"
 
-const char* get_human_readable_size(size_t size)
+const char* get_human_readable_size(uint64_t size)
 {
 	// rather than displaying bytes, round to KB, MB, or GB
-	const size_t GIGABYTE = 1073741824;
-	const size_t MEGABYTE = 1048576;
-	const size_t KILOBYTE = 1024;
+	const uint64_t GIGABYTE = 1073741824;
+	const uint64_t MEGABYTE = 1048576;
+	const uint64_t KILOBYTE = 1024;
 
 	char* readable_size = calloc(32, sizeof(char));
 	if (size >= GIGABYTE)
@@ -22,7 +35,7 @@ const char* get_human_readable_size(size_t size)
 	else if (size >= KILOBYTE)
 		assert(sprintf(readable_size, "%.2lf KB", (double)(size / KILOBYTE)));
 	else
-		assert(sprintf(readable_size, "%lu B", size));
+		assert(sprintf(readable_size, "%llu B", (unsigned long long)size));
 
 	return readable_size;
 }
@@ -52,3 +65,248 @@ char get_path_separator(const char* path)
 	}
 	return '/';
 }
+
+int make_directory(const char* path)
+{
+#ifdef _WIN32
+	const int result = _mkdir(path);
+#else
+	const int result = mkdir(path, 0755);
+#endif
+	if (result && errno == EEXIST)
+		return 0;
+	return result;
+}
+
+static bool is_safe_filename(const char* name)
+{
+	// a name taken from the image becomes one component of a local path, it may neither climb out of nor split it
+	if (!name || name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return false;
+	for (const unsigned char* cursor = (const unsigned char*)name; *cursor; cursor++)
+	{
+		if (*cursor < 0x20 || *cursor == 0x7F || *cursor == '/' || *cursor == '\\' || *cursor == ':')
+			return false;
+	}
+	return true;
+}
+
+char* get_safe_filename(const char* name, const char* fallback)
+{
+	// take the first usable name, failing both the fallback is kept with every unsafe character replaced
+	const char* source = is_safe_filename(name) || !fallback ? name : fallback;
+	if (!source)
+		source = "";
+	char* safe = malloc(strlen(source) + 2);
+	strcpy(safe, source);
+	if (is_safe_filename(safe))
+		return safe;
+
+	for (unsigned char* cursor = (unsigned char*)safe; *cursor; cursor++)
+	{
+		if (*cursor < 0x20 || *cursor == 0x7F || *cursor == '/' || *cursor == '\\' || *cursor == ':')
+			*cursor = '_';
+	}
+	if (safe[0] == '\0' || strcmp(safe, ".") == 0 || strcmp(safe, "..") == 0)
+	{
+		// nothing but dots left, the name still says it was there
+		for (char* cursor = safe; *cursor; cursor++)
+			*cursor = '_';
+		if (safe[0] == '\0')
+			strcpy(safe, "_");
+	}
+	return safe;
+}
+
+uint64_t hash_buffer(const void* buffer, size_t length, uint64_t seed)
+{
+	// multiply-rotate mix over 64-bit words, the tail is folded in byte by byte
+	const uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+	const uint8_t* bytes = buffer;
+	uint64_t hash = seed ^ (length * prime_1);
+
+	while (length >= sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		hash ^= word * prime_2;
+		hash = ((hash << 31) | (hash >> 33)) * prime_1;
+		bytes += sizeof(word);
+		length -= sizeof(word);
+	}
+	while (length > 0)
+	{
+		hash ^= *bytes++ * prime_1;
+		hash = ((hash << 23) | (hash >> 41)) * prime_2;
+		length--;
+	}
+
+	hash ^= hash >> 33;
+	hash *= prime_2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+size_t split_arguments(char* line, char** tokens, size_t max_tokens)
+{
+	// quotes let a long filename with spaces through as one token, they are dropped as the token is compacted
+	size_t num_tokens = 0;
+	char* cursor = line;
+	while (num_tokens < max_tokens)
+	{
+		while (*cursor == ' ')
+			cursor++;
+		if (*cursor == '\0')
+			break;
+
+		char* token = cursor;
+		char* end = cursor;
+		bool quoted = false;
+		for (; *cursor != '\0' && (quoted || *cursor != ' '); cursor++)
+		{
+			if (*cursor == '"')
+				quoted = !quoted;
+			else
+				*end++ = *cursor;
+		}
+		if (*cursor != '\0')
+			cursor++;
+		*end = '\0';
+		tokens[num_tokens++] = token;
+	}
+	return num_tokens;
+}
+
+bool match_pattern(const char* pattern, const char* name)
+{
+	// greedy match that backtracks to the last * on a mismatch, linear for patterns with a single *
+	const char* star = NULL;
+	const char* star_name = NULL;
+	while (*name)
+	{
+		if (*pattern == '*')
+		{
+			star = pattern++;
+			star_name = name;
+		}
+		else if (*pattern == '?' || toupper((unsigned char)*pattern) == toupper((unsigned char)*name))
+		{
+			pattern++;
+			name++;
+		}
+		else if (star)
+		{
+			pattern = star + 1;
+			name = ++star_name;
+		}
+		else
+			return false;
+	}
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+bool has_wildcards(const char* pattern)
+{
+	return strpbrk(pattern, "*?") != NULL;
+}
+
+int write_all(int fd, const void* buffer, size_t length)
+{
+	const uint8_t* bytes = buffer;
+	while (length > 0)
+	{
+#ifdef _WIN32
+		const int written = _write(fd, bytes, length > INT32_MAX ? INT32_MAX : (unsigned int)length);
+#else
+		const ssize_t written = write(fd, bytes, length);
+#endif
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		bytes += written;
+		length -= (size_t)written;
+	}
+	return 0;
+}
+
+int is_terminal(int fd)
+{
+#ifdef _WIN32
+	return _isatty(fd);
+#else
+	return isatty(fd);
+#endif
+}
+
+size_t get_cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+double get_time_ms(void)
+{
+	// monotonic where there is one, so a clock change never shows up in a measurement
+#ifdef _WIN32
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+int seek_file(FILE* fp, const uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+uint64_t tell_file(FILE* fp)
+{
+#ifdef _WIN32
+	return (uint64_t)_ftelli64(fp);
+#else
+	return (uint64_t)ftello(fp);
+#endif
+}
+
+int get_file_stamp(const char* path, uint64_t* size, int64_t* mtime)
+{
+	// only a regular file has a size and a time that change whenever it is written, a device has neither
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info) ||
+		(info.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)))
+		return -1;
+	*size = (uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+	// 100 ns ticks since 1601, moved to 1970 first so nanoseconds fit
+	const uint64_t ticks = (uint64_t)info.ftLastWriteTime.dwHighDateTime << 32 | info.ftLastWriteTime.dwLowDateTime;
+	*mtime = (int64_t)(ticks - 116444736000000000ULL) * 100;
+#else
+	struct stat info;
+	if (stat(path, &info) || !S_ISREG(info.st_mode))
+		return -1;
+	*size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+	*mtime = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	*mtime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+	return 0;
+}
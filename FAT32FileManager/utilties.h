@@ -1,4 +1,8 @@
 #pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 /**
  * @brief Get the human readable size
@@ -6,7 +10,7 @@
  * @param size Number bytes
  * @return const char* Human readable size
  */
-const char *get_human_readable_size(size_t size);
+const char *get_human_readable_size(uint64_t size);
 /**
  * @brief Terminate a non-null-terminated string by removing trailing spaces
  *
@@ -20,3 +24,102 @@ void remove_trailing_spaces(const char *buffer);
  * @return char Path separator
  */
 char get_path_separator(const char *path);
+/**
+ * @brief Create a directory on the local disk, succeeding if it already exists
+ *
+ * @param path Directory to create
+ * @return int 0 on success
+ */
+int make_directory(const char *path);
+/**
+ * @brief Make a name read from an image safe to use as one component of a local path
+ *
+ * A name is unusable when it is empty, . or .., or holds a path separator, a colon or a control character.
+ * The fallback is taken when the name is unusable, and when both are the fallback has those characters
+ * replaced by underscores.
+ *
+ * @param name Name to use, usually the long name, may be NULL
+ * @param fallback Name to use instead, usually the 8.3 name, may be NULL
+ * @return char* Name to write under, free it when done
+ */
+char *get_safe_filename(const char *name, const char *fallback);
+/**
+ * @brief Hash a buffer, 8 bytes at a time
+ *
+ * @param buffer Data to hash
+ * @param length Number of bytes
+ * @param seed Starting value, pass a previous result to continue a hash
+ * @return uint64_t Hash of the data
+ */
+uint64_t hash_buffer(const void *buffer, size_t length, uint64_t seed);
+/**
+ * @brief Split a line on spaces in place, text in double quotes stays one token
+ *
+ * @param line Line to split, spaces are replaced by null characters and quotes removed
+ * @param tokens Output array of token pointers
+ * @param max_tokens Size of the output array
+ * @return size_t Number of tokens found
+ */
+size_t split_arguments(char *line, char **tokens, size_t max_tokens);
+/**
+ * @brief Match a name against a glob pattern, ignoring case like FAT does
+ *
+ * @param pattern Pattern where * matches any run of characters and ? any one character
+ * @param name Name to test
+ * @return true The whole name matches
+ */
+bool match_pattern(const char *pattern, const char *name);
+/**
+ * @brief Check if a string contains glob wildcards
+ */
+bool has_wildcards(const char *pattern);
+/**
+ * @brief Write a whole buffer to a file descriptor, retrying short writes
+ *
+ * @param fd Descriptor to write to
+ * @param buffer Data to write
+ * @param length Number of bytes
+ * @return int 0 on success
+ */
+int write_all(int fd, const void *buffer, size_t length);
+/**
+ * @brief Check if a file descriptor is an interactive terminal
+ *
+ * @param fd Descriptor to check
+ * @return int Non-zero if it is a terminal
+ */
+int is_terminal(int fd);
+/**
+ * @brief Get the number of processors available to the process
+ *
+ * @return size_t Number of processors, at least 1
+ */
+size_t get_cpu_count(void);
+/**
+ * @brief Get a time in milliseconds to measure intervals with
+ */
+double get_time_ms(void);
+/**
+ * @brief Seek to an absolute offset, past 4 GiB where long is only 32 bits
+ *
+ * @param fp File to seek
+ * @param offset Byte offset from the start of the file
+ * @return int 0 on success
+ */
+int seek_file(FILE *fp, uint64_t offset);
+/**
+ * @brief Get the current position in a file as a 64 bit offset
+ *
+ * @param fp File to inspect
+ * @return uint64_t Byte offset from the start of the file
+ */
+uint64_t tell_file(FILE *fp);
+/**
+ * @brief Get the size and modification time of a regular file without opening it
+ *
+ * @param path File to inspect
+ * @param size Output for the size in bytes
+ * @param mtime Output for the modification time in nanoseconds
+ * @return int 0 on success, -1 if it cannot be inspected or is not a regular file
+ */
+int get_file_stamp(const char *path, uint64_t *size, int64_t *mtime);
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "workpool.h"
+
+void run_parallel(void* workers, const size_t worker_size, const size_t num_threads, int (*function)(void*),
+	const size_t first, const size_t last)
+{
+	uint8_t* worker_bytes = workers;
+	thrd_t* threads = malloc(num_threads * sizeof(thrd_t));
+	bool* started = calloc(num_threads, sizeof(bool));
+	const size_t share = (last - first + num_threads - 1) / num_threads;
+	for (size_t idx = 0; idx < num_threads; idx++)
+	{
+		WorkRange* range = (WorkRange*)&worker_bytes[idx * worker_size];
+		range->first = first + idx * share < last ? first + idx * share : last;
+		range->last = first + (idx + 1) * share < last ? first + (idx + 1) * share : last;
+	}
+	for (size_t idx = 1; idx < num_threads; idx++)
+		started[idx] = thrd_create(&threads[idx], function, &worker_bytes[idx * worker_size]) == thrd_success;
+
+	// anything we could not start a thread for runs here
+	function(worker_bytes);
+	for (size_t idx = 1; idx < num_threads; idx++)
+	{
+		if (started[idx])
+			thrd_join(threads[idx], NULL);
+		else
+			function(&worker_bytes[idx * worker_size]);
+	}
+	free(started);
+	free(threads);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stddef.h>
+
+typedef struct WorkRange
+{
+	size_t first;
+	size_t last;
+} WorkRange;
+
+/**
+ * @brief Split [first, last) evenly over a number of threads and run a function on each share
+ *
+ * Every worker struct must start with a WorkRange, which is filled in before the function runs.
+ * The calling thread takes the first share, shares that cannot get a thread also run on it.
+ *
+ * @param workers Array of worker structs
+ * @param worker_size Size of one worker struct
+ * @param num_threads Number of workers
+ * @param function Function to run per worker
+ * @param first First item
+ * @param last One past the last item
+ */
+void run_parallel(void *workers, const size_t worker_size, const size_t num_threads, int (*function)(void *),
+				  const size_t first, const size_t last);
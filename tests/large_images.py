@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""Check the file manager against sparse synthetic images that need 64 bit offsets or large sectors.
+
+Builds FAT32 images in a scratch directory, runs extract-all, cat with a range and export --range on
+each one, and compares what comes out with the data the images were built from.
+
+    python3 tests/large_images.py <FAT32FileManager binary> [scratch dir]
+
+The images are sparse, about 10 GB apparent size but only a few MB on disk, so the scratch directory
+has to be on a filesystem with sparse file support. Exits non-zero if any check fails.
+"""
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+GIB = 1024 ** 3
+END_OF_CHAIN = 0x0FFFFFFF
+
+
+class Fat32Image:
+    """FAT32 volume behind an MBR, only the sectors holding data are ever written."""
+
+    def __init__(self, bytes_per_sector, sectors_per_cluster, num_clusters, part_start, mbr_unit):
+        self.bps = bytes_per_sector
+        self.spc = sectors_per_cluster
+        self.cluster_size = bytes_per_sector * sectors_per_cluster
+        self.num_clusters = num_clusters
+        self.part_start = part_start
+        self.mbr_unit = mbr_unit
+        self.reserved = 32
+        self.fat_sectors = -(-(num_clusters + 2) * 4 // bytes_per_sector)
+        self.data_sector = self.reserved + 2 * self.fat_sectors
+        self.total_sectors = self.data_sector + num_clusters * sectors_per_cluster
+        self.fat = {0: 0x0FFFFFF8, 1: END_OF_CHAIN}
+        self.clusters = {}
+        self.root = []
+        self.root_cluster = self.allocate([2])
+
+    def allocate(self, clusters):
+        for current, following in zip(clusters, clusters[1:]):
+            self.fat[current] = following
+        self.fat[clusters[-1]] = END_OF_CHAIN
+        return clusters[0]
+
+    def write_chain(self, clusters, payload):
+        for idx, cluster in enumerate(clusters):
+            self.clusters[cluster] = payload[idx * self.cluster_size:(idx + 1) * self.cluster_size]
+
+    @staticmethod
+    def entry(name, attributes, cluster, size):
+        base, _, extension = name.partition('.')
+        return (base.ljust(8) + extension.ljust(3)).encode() + bytes([attributes]) + bytes(8) + \
+            struct.pack('<HHHHI', cluster >> 16, 0x6000, 0x5821, cluster & 0xFFFF, size)
+
+    def add_file(self, directory, name, payload, clusters):
+        first_cluster = 0
+        if payload:
+            first_cluster = self.allocate(clusters)
+            self.write_chain(clusters, payload)
+        directory.append(self.entry(name, 0x20, first_cluster, len(payload)))
+
+    def add_directory(self, directory, name, cluster, parent_cluster):
+        self.allocate([cluster])
+        directory.append(self.entry(name, 0x10, cluster, 0))
+        return [self.entry('.', 0x10, cluster, 0), self.entry('..', 0x10, parent_cluster, 0)]
+
+    def close_directory(self, cluster, entries):
+        raw = b''.join(entries)
+        assert len(raw) <= self.cluster_size
+        self.clusters[cluster] = raw + bytes(self.cluster_size - len(raw))
+
+    def save(self, path):
+        self.close_directory(self.root_cluster, self.root)
+        base = self.part_start
+        with open(path, 'wb') as image:
+            image.truncate(base + self.total_sectors * self.bps)
+
+            mbr = bytearray(512)
+            mbr[446:462] = struct.pack('<B3sB3sII', 0x80, bytes(3), 0x0C, bytes(3), self.part_start // self.mbr_unit,
+                                       self.total_sectors * self.bps // self.mbr_unit)
+            mbr[510:512] = b'\x55\xaa'
+            image.write(mbr)
+
+            boot = bytearray(self.bps)
+            boot[0:11] = b'\xeb\x58\x90MSWIN4.1'
+            boot[11:36] = struct.pack('<HBHBHHBHHHII', self.bps, self.spc, self.reserved, 2, 0, 0, 0xF8, 0, 63, 255,
+                                      self.part_start // self.bps, self.total_sectors)
+            boot[36:48] = struct.pack('<IHHI', self.fat_sectors, 0, 0, self.root_cluster)
+            boot[510:512] = b'\x55\xaa'
+            image.seek(base)
+            image.write(boot)
+
+            for copy in range(2):
+                fat_start = base + (self.reserved + copy * self.fat_sectors) * self.bps
+                for cluster, value in self.fat.items():
+                    image.seek(fat_start + cluster * 4)
+                    image.write(struct.pack('<I', value))
+            for cluster, data in self.clusters.items():
+                image.seek(base + (self.data_sector + (cluster - 2) * self.spc) * self.bps)
+                image.write(data)
+
+
+def build_image(path, bytes_per_sector, sectors_per_cluster, num_clusters, part_start, mbr_unit):
+    """Lay out a small tree whose chains cross cluster boundaries, are fragmented and sit at the end of the volume."""
+    rng = random.Random(bytes_per_sector ^ part_start)
+    image = Fat32Image(bytes_per_sector, sectors_per_cluster, num_clusters, part_start, mbr_unit)
+    size = image.cluster_size
+    last_cluster = num_clusters + 1
+    files = {}
+
+    def payload(length):
+        return bytes(rng.getrandbits(8) for _ in range(length))
+
+    files['HELLO.TXT'] = b'hello from a large image\n' * 7
+    image.add_file(image.root, 'HELLO.TXT', files['HELLO.TXT'], [3])
+    files['EMPTY.DAT'] = b''
+    image.add_file(image.root, 'EMPTY.DAT', b'', [])
+
+    # two chains interleaved cluster by cluster
+    files['DATA.BIN'] = payload(5 * size + 123)
+    files['OTHER.BIN'] = payload(5 * size - 9)
+    image.add_file(image.root, 'DATA.BIN', files['DATA.BIN'], list(range(4, 16, 2)))
+    image.add_file(image.root, 'OTHER.BIN', files['OTHER.BIN'], list(range(5, 15, 2)))
+
+    # a directory and a file in the last clusters, the furthest the volume reaches
+    sub = image.add_directory(image.root, 'SUB', last_cluster - 8, image.root_cluster)
+    files['SUB/LATE.BIN'] = payload(3 * size + 77)
+    image.add_file(sub, 'LATE.BIN', files['SUB/LATE.BIN'], [last_cluster - 3, last_cluster - 2, last_cluster - 1,
+                                                            last_cluster])
+    files['SUB/NEAR.TXT'] = b'near the start\n'
+    image.add_file(sub, 'NEAR.TXT', files['SUB/NEAR.TXT'], [16])
+    image.close_directory(last_cluster - 8, sub)
+
+    image.save(path)
+    return files, size
+
+
+def run_session(binary, image_path, commands, cwd):
+    result = subprocess.run([binary, image_path], input=('\n'.join(commands) + '\nexit\n').encode(),
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, cwd=cwd, timeout=600)
+    return result.stdout
+
+
+def read_tree(root):
+    found = {}
+    for directory, _, names in os.walk(root):
+        for name in names:
+            path = os.path.join(directory, name)
+            with open(path, 'rb') as extracted:
+                found[os.path.relpath(path, root).replace(os.sep, '/')] = extracted.read()
+    return found
+
+
+def check_image(binary, work, label, files, cluster_size, image_path):
+    failures = []
+    os.makedirs(work)
+
+    # ranges starting just before a cluster boundary and running over several of them
+    data_range = (cluster_size - 7, 3 * cluster_size + 11)
+    late_range = (cluster_size + 1, 2 * cluster_size)
+    output = run_session(binary, image_path, [
+        'sel part 0',
+        'extract-all extracted',
+        'cat DATA.BIN %d %d' % data_range,
+        'export --range %d %d DATA.BIN' % data_range,
+        'cd SUB',
+        'cat LATE.BIN %d %d' % late_range,
+        'export --range %d %d LATE.BIN' % late_range,
+    ], work)
+
+    extracted = read_tree(os.path.join(work, 'extracted'))
+    if extracted != files:
+        missing = sorted(set(files) - set(extracted))
+        extra = sorted(set(extracted) - set(files))
+        differ = sorted(name for name in set(files) & set(extracted) if files[name] != extracted[name])
+        failures.append('extract-all: missing %s, unexpected %s, different %s' % (missing, extra, differ))
+
+    for name, (offset, length) in (('DATA.BIN', data_range), ('SUB/LATE.BIN', late_range)):
+        expected = files[name][offset:offset + length]
+        if expected not in output:
+            failures.append('cat %s %d %d: wrong bytes' % (name, offset, length))
+        exported = os.path.join(work, os.path.basename(name))
+        if not os.path.exists(exported):
+            failures.append('export --range %d %d %s: nothing written' % (offset, length, name))
+            continue
+        with open(exported, 'rb') as result:
+            if result.read() != expected:
+                failures.append('export --range %d %d %s: wrong bytes' % (offset, length, name))
+
+    print('%-40s %s' % (label, 'ok' if not failures else 'FAILED'))
+    for failure in failures:
+        print('    ' + failure)
+    if failures:
+        print('    session output:\n' + output.decode('latin-1')[-2000:])
+    return not failures
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print(__doc__)
+        return 2
+    binary = os.path.abspath(sys.argv[1])
+    scratch = tempfile.mkdtemp(prefix='fat-large-', dir=sys.argv[2] if len(sys.argv) == 3 else None)
+
+    # label, bytes per sector, sectors per cluster, clusters, partition start, unit of the MBR addresses
+    layouts = [
+        ('partition at 4.5 GiB, volume over 4 GiB', 512, 8, 1_200_000, 9 * GIB // 2, 512),
+        ('4096 byte sectors, 4096 byte MBR', 4096, 1, 70_000, 1024 * 1024, 4096),
+        ('4096 byte sectors, 512 byte MBR', 4096, 1, 70_000, 1024 * 1024, 512),
+        ('4096 byte sectors at 6 GiB', 4096, 2, 600_000, 6 * GIB, 4096),
+    ]
+    passed = True
+    try:
+        for idx, (label, bps, spc, clusters, part_start, mbr_unit) in enumerate(layouts):
+            image_path = os.path.join(scratch, 'image%d.img' % idx)
+            files, cluster_size = build_image(image_path, bps, spc, clusters, part_start, mbr_unit)
+            passed &= check_image(binary, os.path.join(scratch, 'run%d' % idx), label, files, cluster_size, image_path)
+    finally:
+        shutil.rmtree(scratch)
+    return 0 if passed else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())